@@ -0,0 +1,164 @@
+// System include
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <ctype.h>
+
+// Project include
+#include "spellcheck.h"
+#include "arena.h"
+
+// Block header is kept aligned, so data starts aligned for any type
+#define ARENA_HEADER_SIZE ((sizeof(ArenaBlock) + 15) & ~(size_t)15)
+
+// Static function declarations
+static ArenaBlock *newBlock(Arena *arena, size_t size);
+
+
+int arenaInitialize(Arena *arena, size_t block_size)
+{
+    assert(arena != NULL);
+
+    arena->current = NULL;
+    arena->block_size = (block_size != 0) ? block_size : ARENA_BLOCK_SIZE;
+    arena->blocks = 0;
+    arena->used = 0;
+    arena->reserved = 0;
+
+    return OK;
+}
+
+void *arenaAlloc(Arena *arena, size_t size, size_t align)
+{
+    ArenaBlock *block = NULL;
+    size_t offset = 0;
+
+    assert(arena != NULL);
+    assert(align != 0 && (align & (align - 1)) == 0);
+
+    block = arena->current;
+    if (block != NULL)
+    {
+        offset = (block->used + align - 1) & ~(align - 1);
+    }
+
+    // Current block can't hold it, the rest of it is wasted
+    if (block == NULL || offset + size > block->size)
+    {
+        if ((block = newBlock(arena, size)) == NULL)
+        {
+            return NULL;
+        }
+        offset = 0;
+    }
+
+    block->used = offset + size;
+    arena->used += size;
+
+    return (char *)block + ARENA_HEADER_SIZE + offset;
+}
+
+char *arenaCopyWord(Arena *arena, const char *word, size_t length)
+{
+    char *copy = (char *)arenaAlloc(arena, length + 1, 1);
+
+    if (copy != NULL)
+    {
+        for (size_t pos = 0; pos < length; pos++)
+        {
+            copy[pos] = tolower((unsigned char)word[pos]);
+        }
+        copy[length] = 0;
+    }
+    return copy;
+}
+
+void arenaMerge(Arena *arena, Arena *from)
+{
+    ArenaBlock *last = NULL;
+
+    assert(arena != NULL);
+    assert(from != NULL);
+
+    if (from->current != NULL)
+    {
+        // Keep allocating from our current block, the others go behind it
+        for (last = from->current; last->next != NULL; last = last->next)
+        {
+        }
+        if (arena->current != NULL)
+        {
+            last->next = arena->current->next;
+            arena->current->next = from->current;
+        }
+        else
+        {
+            arena->current = from->current;
+        }
+
+        arena->blocks += from->blocks;
+        arena->used += from->used;
+        arena->reserved += from->reserved;
+    }
+    arenaInitialize(from, from->block_size);
+}
+
+void arenaRelease(Arena *arena)
+{
+    assert(arena != NULL);
+
+    while (arena->current != NULL)
+    {
+        ArenaBlock *delete = arena->current;
+        arena->current = delete->next;
+        free(delete);
+    }
+    arenaInitialize(arena, arena->block_size);
+}
+
+void arenaReport(const Arena *arena, const char *name)
+{
+    assert(arena != NULL);
+
+    printf("INFO: arena [%s] used=[%lu] reserved=[%lu] blocks=[%lu] fill=[%.1f%%]\n",
+           name, (unsigned long)arena->used, (unsigned long)arena->reserved,
+           (unsigned long)arena->blocks,
+           arena->reserved ? 100.0 * arena->used / arena->reserved : 0.0);
+}
+
+
+
+/*******************************************************************************
+ * Static functions
+ ******************************************************************************/
+
+/******************************************************************************
+ * newBlock
+ *
+ * @param Arena *arena arena that will own the block
+ * @param size_t size minimum usable bytes needed
+ *
+ * Allocate a new block and make it the current one.
+ * Blocks are never smaller than block_size, so a few of them are enough
+ */
+static ArenaBlock *newBlock(Arena *arena, size_t size)
+{
+    ArenaBlock *block = NULL;
+
+    if (size < arena->block_size)
+    {
+        size = arena->block_size;
+    }
+
+    if ((block = (ArenaBlock *)malloc(ARENA_HEADER_SIZE + size)) != NULL)
+    {
+        block->next = arena->current;
+        block->size = size;
+        block->used = 0;
+
+        arena->current = block;
+        arena->blocks++;
+        arena->reserved += ARENA_HEADER_SIZE + size;
+    }
+    return block;
+}
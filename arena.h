@@ -0,0 +1,121 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+/*******************************************************************************
+ * ARENA DESIGN - Bump allocator
+ *
+ * The dictionary allocates a lot of small objects (words, nodes) that all live
+ * until the program exit. Instead of a malloc for every one of them we carve
+ * them out of a few big blocks, bumping a pointer.
+ *
+ * Nothing is freed one by one: arenaRelease drops the whole blocks list.
+ *
+ *   +---------+     +---------+     +---------+
+ *   |current  |---->|block 2  |---->|block 1  |---->NULL
+ *   +---------+     +---------+     +---------+
+ *   |word|word|     |node|word|     |word|node|
+ *   |node|....|     |word|node|     |word|word|
+ *   |  free   |     +---------+     +---------+
+ *   +---------+
+ *
+ ******************************************************************************/
+
+#define ARENA_BLOCK_SIZE (1024 * 1024) // Default size of an arena block
+
+typedef struct ArenaBlockT{
+    struct ArenaBlockT  *next;      // Previous (full) block
+    size_t               size;      // Usable bytes of this block
+    size_t               used;      // Bytes already handed out
+}ArenaBlock;
+
+typedef struct {
+    ArenaBlock      *current;       // Block we are allocating from
+    size_t          block_size;     // Minimum size of a new block
+    size_t          blocks;         // Number of blocks allocated
+    size_t          used;           // Bytes handed out to the callers
+    size_t          reserved;       // Bytes allocated for the blocks
+}Arena;
+
+
+/*
+ * arenaInitialize
+ *
+ * Initialize an empty arena, no memory is allocated until the first request
+ *
+ * @param Arena * arena arena to initialize
+ * @param size_t  block_size size of the blocks, 0 for ARENA_BLOCK_SIZE
+ *
+ */
+int arenaInitialize(Arena *arena, size_t block_size);
+
+
+/*
+ * arenaAlloc
+ *
+ * Get size bytes from the arena, aligned to align (power of two).
+ * If the current block is full a new one is allocated, big enough for the
+ * request if this is bigger than the block size.
+ *
+ * @param Arena * arena arena to allocate from
+ * @param size_t  size bytes requested
+ * @param size_t  align alignment requested, 1 for strings
+ * @return pointer to the memory, NULL if out of memory
+ *
+ */
+void *arenaAlloc(Arena *arena, size_t size, size_t align);
+
+
+/*
+ * arenaCopyWord
+ *
+ * Copy length bytes of a word in the arena, lower casing them and adding
+ * the NULL terminator
+ *
+ * @param Arena      * arena arena to allocate from
+ * @param const char * word word to copy
+ * @param size_t       length length of the word
+ * @return the copy, NULL if out of memory
+ *
+ */
+char *arenaCopyWord(Arena *arena, const char *word, size_t length);
+
+
+/*
+ * arenaMerge
+ *
+ * Move all the blocks of an arena into another one, so they are released
+ * together. Pointers returned by both arenas stay valid, the source arena is
+ * left empty. Useful to join arenas filled by different threads
+ *
+ * @param Arena * arena arena receiving the blocks
+ * @param Arena * from arena giving its blocks
+ *
+ */
+void arenaMerge(Arena *arena, Arena *from);
+
+
+/*
+ * arenaRelease
+ *
+ * Free all the blocks of the arena, all pointers returned are gone
+ *
+ * @param Arena * arena arena to release
+ *
+ */
+void arenaRelease(Arena *arena);
+
+
+/*
+ * arenaReport
+ *
+ * Print the statistics of the arena (bytes used/reserved, blocks)
+ *
+ * @param const Arena * arena arena to report
+ * @param const char  * name name printed with the statistics
+ *
+ */
+void arenaReport(const Arena *arena, const char *name);
+
+#endif // _ARENA_H
@@ -0,0 +1,908 @@
+// System include
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Project include
+#include "spellcheck.h"
+#include "dictionary.h"
+#include "tokenizer.h"
+
+/*******************************************************************************
+ * SPELLBENCH - Throughput benchmark of the spellcheck
+ *
+ * For every scale (1 = the files as they are) the benchmark measures:
+ *
+ *   load    dictionary build, in dictionary words/s
+ *   lookup  lookupWord on every word of the document, in lookups/s
+ *   filter  the same with the Bloom filter (BLOOM_BITS bits per word) in
+ *           front of the lookups, in lookups/s
+ *   cache   lookupCached on the same words, folded as the checker has them,
+ *           in lookups/s
+ *   batch   lookupBatch on the same words, LOOKUP_BATCH at a time, in
+ *           lookups/s (compare with lookup)
+ *   perfect the same with the DICTIONARY_PERFECT backend, in lookups/s
+ *           (compare with batch)
+ *   suggest suggestWords (BENCH_SUGGEST words each) on the first
+ *           BENCH_MISSPELLED misspelled words of the document, in
+ *           suggestions/s
+ *   e2e     the spellcheck program on dictionary + document (output to
+ *           /dev/null), in document words/s
+ *
+ * Scaled inputs are written in a temporary directory: the document is
+ * repeated scale times, the dictionary gets scale - 1 more copies of every
+ * word with a suffix, so the sets really grow.
+ * load and e2e run "cold" (files dropped from the page cache before every
+ * trial, when the kernel allows it) and "warm" (after a run that reads them).
+ *
+ * Output is one JSON object per line: one "info" line, then one line per
+ * trial and one "summary" line (min and median) per measure. Compare the
+ * summaries of two builds to catch a regression.
+ *
+ ******************************************************************************/
+
+#define MAX_SCALES  8   // Scales in -s
+#define MAX_TRIALS  100 // Trials in -t
+#define BENCH_SUGGEST       5       // Suggestions asked for a misspelled word
+#define BENCH_MISSPELLED    1000    // Misspelled words timed by suggest
+
+#ifndef BENCH_CFLAGS
+#define BENCH_CFLAGS "" // Flags of the build, set by the Makefile
+#endif
+
+// Command line options
+typedef struct {
+    char            data[PATH_MAX];         // Directory of the input files
+    const char      *dict_name;             // Dictionary in data
+    const char      *doc_name;              // Document in data
+    char            program[PATH_MAX];      // spellcheck binary
+    unsigned int    trials;                 // Trials of every measure
+    unsigned int    threads;                // -j of the spellcheck
+    unsigned int    scales[MAX_SCALES];     // Input scales
+    unsigned int    count;                  // Scales in scales
+}BenchOptions;
+
+// Input files of one scale
+typedef struct {
+    unsigned int    scale;
+    char            dict[PATH_MAX];
+    char            doc[PATH_MAX];
+    size_t          dict_words;             // Lines of the dictionary
+    size_t          doc_words;              // Words of the document
+}BenchInput;
+
+// How benchLookup looks the words up
+typedef enum {
+    BENCH_WORD = 0,     // lookupWord
+    BENCH_CACHED,       // lookupCached
+    BENCH_BATCHED,      // lookupBatch
+    BENCH_PERFECT       // lookupBatch on the DICTIONARY_PERFECT backend
+}BenchLookup;
+
+// A word of the document, as the checker looks it up
+typedef struct {
+    const char      *word;
+    size_t          length;
+}BenchWord;
+
+// Static function declarations
+static int parseOptions(int argc, char *argv[], BenchOptions *options);
+static void printUsage(const char *name);
+static int prepareInput(const BenchOptions *options, const char *work, unsigned int scale, BenchInput *input);
+static int scaleFiles(const char *dict_src, const char *doc_src, BenchInput *input);
+static int benchLoad(const BenchOptions *options, const BenchInput *input, int cold);
+static int benchLookup(const BenchOptions *options, const BenchInput *input, unsigned int filter, BenchLookup mode);
+static int benchSuggest(const BenchOptions *options, const BenchInput *input);
+static int benchProgram(const BenchOptions *options, const BenchInput *input, int cold);
+static int loadDictionary(const char *path, Dictionary *dictionary, unsigned int threads, unsigned int suggest,
+                          unsigned int filter, DictionaryBackend backend);
+static BenchWord *collectWords(Dictionary *dictionary, const char *text, size_t size, size_t *count);
+static size_t countWords(const char *path);
+static size_t countLines(const char *path);
+static void dropCache(const char *path);
+static double now(void);
+static void printTrial(const char *bench, const BenchInput *input, const char *cache, unsigned int trial,
+                       double seconds, double rate, const char *unit);
+static void printSummary(const char *bench, const BenchInput *input, const char *cache, double *seconds,
+                         unsigned int trials, double work, const char *unit);
+static int compareTime(const void *left, const void *right);
+
+
+
+/*******************************************************************************
+ * main
+ ******************************************************************************/
+int main(int argc, char *argv[])
+{
+    int rc = OK;
+    BenchOptions options;
+    char work[] = "/tmp/spellbench.XXXXXX";
+
+    if (parseOptions(argc, argv, &options) != OK)
+    {
+        printUsage(argv[0]);
+        exit(NOK);
+    }
+    // Run in the work directory, whatever the program leaves (gmon.out)
+    // goes away with it
+    if (mkdtemp(work) == NULL || chdir(work) != 0)
+    {
+        fprintf(stderr, "ERROR: Can't create work directory: errno %d\n", errno);
+        exit(NOK);
+    }
+
+    printf("{\"bench\":\"info\",\"cflags\":\"%s\",\"threads\":%u,\"trials\":%u,"
+           "\"dictionary\":\"%s\",\"document\":\"%s\"}\n",
+           BENCH_CFLAGS, options.threads, options.trials, options.dict_name, options.doc_name);
+
+    for (unsigned int scale = 0; rc == OK && scale < options.count; scale++)
+    {
+        BenchInput input;
+
+        if ((rc = prepareInput(&options, work, options.scales[scale], &input)) == OK)
+        {
+            printf("{\"bench\":\"input\",\"scale\":%u,\"dictionary_words\":%zu,\"document_words\":%zu}\n",
+                   input.scale, input.dict_words, input.doc_words);
+            fflush(stdout);
+
+            if ((rc = benchLoad(&options, &input, 1)) == OK &&
+                (rc = benchLoad(&options, &input, 0)) == OK &&
+                (rc = benchLookup(&options, &input, 0, BENCH_WORD)) == OK &&
+                (rc = benchLookup(&options, &input, BLOOM_BITS, BENCH_WORD)) == OK &&
+                (rc = benchLookup(&options, &input, 0, BENCH_CACHED)) == OK &&
+                (rc = benchLookup(&options, &input, 0, BENCH_BATCHED)) == OK &&
+                (rc = benchLookup(&options, &input, 0, BENCH_PERFECT)) == OK &&
+                (rc = benchSuggest(&options, &input)) == OK &&
+                (rc = benchProgram(&options, &input, 1)) == OK)
+            {
+                rc = benchProgram(&options, &input, 0);
+            }
+        }
+        if (input.scale != 1)
+        {
+            unlink(input.dict);
+            unlink(input.doc);
+        }
+    }
+
+    unlink("gmon.out");
+    if (chdir("/") != 0 || rmdir(work) != 0)
+    {
+        fprintf(stderr, "WARNING: Can't remove work directory %s\n", work);
+    }
+
+    exit(rc);
+}
+
+
+
+/*******************************************************************************
+ * Static functions
+ ******************************************************************************/
+
+/*
+ * Parse the command line options
+ *
+ * @param int argc number of arguments
+ * @param char * argv[] arguments
+ * @param BenchOptions * options filled with the options found
+ * @return OK or NOK
+ */
+static int parseOptions(int argc, char *argv[], BenchOptions *options)
+{
+    int option = 0;
+    char *scales = NULL, *end = NULL;
+    const char *data = ".";
+
+    options->dict_name = "dictionary_long.txt";
+    options->doc_name = "document_long.txt";
+    options->trials = 5;
+    options->threads = 1;
+    options->scales[0] = 1;
+    options->scales[1] = 10;
+    options->scales[2] = 100;
+    options->count = 3;
+
+    while ((option = getopt(argc, argv, "d:t:j:s:")) != -1)
+    {
+        switch (option)
+        {
+            case 'd':
+                data = optarg;
+                break;
+            case 't':
+                options->trials = strtoul(optarg, &end, 10);
+                if (*end != 0 || options->trials == 0 || options->trials > MAX_TRIALS)
+                {
+                    fprintf(stderr, "ERROR: Invalid number of trials %s (1-%d)\n", optarg, MAX_TRIALS);
+                    return NOK;
+                }
+                break;
+            case 'j':
+                options->threads = strtoul(optarg, &end, 10);
+                if (*end != 0 || options->threads == 0)
+                {
+                    fprintf(stderr, "ERROR: Invalid number of threads %s\n", optarg);
+                    return NOK;
+                }
+                break;
+            case 's':
+                options->count = 0;
+                for (scales = strtok(optarg, ","); scales != NULL; scales = strtok(NULL, ","))
+                {
+                    unsigned long scale = strtoul(scales, &end, 10);
+
+                    if (*end != 0 || scale == 0 || options->count == MAX_SCALES)
+                    {
+                        fprintf(stderr, "ERROR: Invalid scales (up to %d, comma separated)\n", MAX_SCALES);
+                        return NOK;
+                    }
+                    options->scales[options->count++] = scale;
+                }
+                break;
+            default:
+                return NOK;
+        }
+    }
+
+    // Paths must survive the move to the work directory
+    if (realpath(data, options->data) == NULL)
+    {
+        fprintf(stderr, "ERROR: Can't find directory %s: errno %d\n", data, errno);
+        return NOK;
+    }
+    if (argc - optind != 1 || realpath(argv[optind], options->program) == NULL)
+    {
+        return NOK;
+    }
+    return OK;
+}
+
+/*
+ * Print how to use the program
+ *
+ * @param const char * name program name
+ */
+static void printUsage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-d dir] [-t trials] [-j threads] [-s scales] <spellcheck>\n", name);
+    fprintf(stderr, "\t-d directory of dictionary_long.txt and document_long.txt (.)\n");
+    fprintf(stderr, "\t-t trials of every measure (5)\n");
+    fprintf(stderr, "\t-j threads of the dictionary build and of the spellcheck (1)\n");
+    fprintf(stderr, "\t-s input scales, comma separated (1,10,100)\n");
+}
+
+/*
+ * Get the input files of a scale, writing them if scaled
+ *
+ * @param const BenchOptions * options data directory and files
+ * @param const char * work directory for the scaled files
+ * @param unsigned int scale input scale
+ * @param BenchInput * input filled with paths and sizes
+ * @return OK or NOK
+ */
+static int prepareInput(const BenchOptions *options, const char *work, unsigned int scale, BenchInput *input)
+{
+    char dict[PATH_MAX], doc[PATH_MAX];
+
+    input->scale = scale;
+    if (snprintf(dict, sizeof(dict), "%s/%s", options->data, options->dict_name) >= (int)sizeof(dict) ||
+        snprintf(doc, sizeof(doc), "%s/%s", options->data, options->doc_name) >= (int)sizeof(doc))
+    {
+        fprintf(stderr, "ERROR: Path too long %s\n", options->data);
+        return NOK;
+    }
+
+    if (scale == 1)
+    {
+        if (realpath(dict, input->dict) == NULL || realpath(doc, input->doc) == NULL)
+        {
+            fprintf(stderr, "ERROR: Can't find %s or %s: errno %d\n", dict, doc, errno);
+            return NOK;
+        }
+    }
+    else
+    {
+        snprintf(input->dict, sizeof(input->dict), "%s/dictionary_x%u.txt", work, scale);
+        snprintf(input->doc, sizeof(input->doc), "%s/document_x%u.txt", work, scale);
+        if (scaleFiles(dict, doc, input) != OK)
+        {
+            return NOK;
+        }
+    }
+
+    input->dict_words = countLines(input->dict);
+    input->doc_words = countWords(input->doc);
+
+    return OK;
+}
+
+/*
+ * Write the scaled dictionary and document
+ *
+ * @param const char * dict_src dictionary to scale
+ * @param const char * doc_src document to scale
+ * @param BenchInput * input scale and paths of the files to write
+ * @return OK or NOK
+ *
+ * Copy r of a dictionary word gets a suffix made of the letters of r in base
+ * 26, so it is a new word with the same initial
+ */
+static int scaleFiles(const char *dict_src, const char *doc_src, BenchInput *input)
+{
+    int rc = OK;
+    FILE *in = NULL, *out = NULL;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len = 0;
+
+    if ((in = fopen(dict_src, "r")) == NULL || (out = fopen(input->dict, "w")) == NULL)
+    {
+        fprintf(stderr, "ERROR: Can't scale %s: errno %d\n", dict_src, errno);
+        rc = NOK;
+    }
+    for (unsigned int copy = 0; rc == OK && copy < input->scale; copy++)
+    {
+        rewind(in);
+        while ((len = getline(&line, &size, in)) != -1)
+        {
+            char suffix[16];
+            unsigned int pos = sizeof(suffix) - 1, value = copy;
+
+            while (len > 0 && isspace((unsigned char)line[len - 1]))
+            {
+                len--;
+            }
+            suffix[pos] = 0;
+            while (copy != 0 && pos > 0)
+            {
+                suffix[--pos] = 'a' + value % 26;
+                if ((value /= 26) == 0)
+                {
+                    break;
+                }
+            }
+            fprintf(out, "%.*s%s\n", (int)len, line, suffix + pos);
+        }
+    }
+    if (in != NULL)
+    {
+        fclose(in);
+    }
+    if (out != NULL && fclose(out) != 0)
+    {
+        rc = NOK;
+    }
+
+    in = out = NULL;
+    if (rc == OK && ((in = fopen(doc_src, "r")) == NULL || (out = fopen(input->doc, "w")) == NULL))
+    {
+        fprintf(stderr, "ERROR: Can't scale %s: errno %d\n", doc_src, errno);
+        rc = NOK;
+    }
+    for (unsigned int copy = 0; rc == OK && copy < input->scale; copy++)
+    {
+        rewind(in);
+        while ((len = getline(&line, &size, in)) != -1)
+        {
+            fwrite(line, 1, len, out);
+        }
+    }
+    if (in != NULL)
+    {
+        fclose(in);
+    }
+    if (out != NULL && fclose(out) != 0)
+    {
+        rc = NOK;
+    }
+
+    free(line);
+    return rc;
+}
+
+/*
+ * Time the dictionary build
+ *
+ * @param const BenchOptions * options trials and threads
+ * @param const BenchInput * input files to use
+ * @param int cold 1 to drop the dictionary from the page cache every trial
+ * @return OK or NOK
+ */
+static int benchLoad(const BenchOptions *options, const BenchInput *input, int cold)
+{
+    double seconds[MAX_TRIALS];
+    const char *cache = cold ? "cold" : "warm";
+
+    for (unsigned int trial = 0; trial <= options->trials; trial++)
+    {
+        Dictionary dictionary;
+        double start = 0;
+
+        if (cold)
+        {
+            dropCache(input->dict);
+        }
+        start = now();
+        if (loadDictionary(input->dict, &dictionary, options->threads, 0, 0, DICTIONARY_SETS) != OK)
+        {
+            return NOK;
+        }
+
+        // Trial 0 of a warm measure only brings the file in the cache
+        if (cold || trial != 0)
+        {
+            unsigned int index = cold ? trial : trial - 1;
+
+            if (index < options->trials)
+            {
+                seconds[index] = now() - start;
+                printTrial("load", input, cache, index, seconds[index],
+                           input->dict_words / seconds[index], "words/s");
+            }
+        }
+        deallocateDictionary(&dictionary);
+    }
+    printSummary("load", input, cache, seconds, options->trials, input->dict_words, "words/s");
+    return OK;
+}
+
+/*
+ * Time the lookups of all the words of the document
+ *
+ * @param const BenchOptions * options trials and threads
+ * @param const BenchInput * input files to use
+ * @param unsigned int filter Bloom filter bits per word, 0 for none
+ * @param BenchLookup mode lookupWord, lookupCached or lookupBatch (on the sets
+ *                         or the perfect hash)
+ * @return OK or NOK
+ *
+ * The words are split and trimmed before timing, so only the lookups are
+ * measured, on the same words the checker looks up
+ */
+static int benchLookup(const BenchOptions *options, const BenchInput *input, unsigned int filter, BenchLookup mode)
+{
+    const char *bench = (mode == BENCH_CACHED) ? "cache" : (mode == BENCH_BATCHED) ? "batch" :
+                        (mode == BENCH_PERFECT) ? "perfect" : filter ? "filter" : "lookup";
+    int cached = (mode == BENCH_CACHED), batched = (mode == BENCH_BATCHED || mode == BENCH_PERFECT);
+    int rc = OK;
+    double seconds[MAX_TRIALS];
+    Dictionary dictionary;
+    FILE *doc_fd = NULL;
+    FileMap map;
+    BenchWord *words = NULL;
+    char *folded = NULL;
+    size_t count = 0;
+
+    if (loadDictionary(input->dict, &dictionary, options->threads, 0, filter,
+                       (mode == BENCH_PERFECT) ? DICTIONARY_PERFECT : DICTIONARY_SETS) != OK)
+    {
+        return NOK;
+    }
+    if ((doc_fd = fopen(input->doc, "r")) == NULL || mapFile(doc_fd, &map, 0) != OK ||
+        (words = collectWords(&dictionary, map.data, map.size, &count)) == NULL ||
+        (cached && (folded = (char *)malloc(map.size)) == NULL))
+    {
+        fprintf(stderr, "ERROR: Can't read words of %s\n", input->doc);
+        rc = NOK;
+    }
+    // lookupCached wants the words folded, as the tokenizer gives them
+    for (size_t byte = 0; folded != NULL && byte < map.size; byte++)
+    {
+        folded[byte] = tolower((unsigned char)map.data[byte]);
+    }
+    for (size_t word = 0; folded != NULL && word < count; word++)
+    {
+        words[word].word = folded + (words[word].word - map.data);
+    }
+
+    for (unsigned int trial = 0; rc == OK && trial < options->trials; trial++)
+    {
+        volatile size_t found = 0;
+        double start = now();
+
+        for (size_t word = 0; !batched && word < count; word++)
+        {
+            found += cached ? lookupCached(&dictionary, words[word].word, words[word].length) :
+                              lookupWord(&dictionary, words[word].word, words[word].length);
+        }
+        for (size_t first = 0; batched && first < count; first += LOOKUP_BATCH)
+        {
+            const char *batch[LOOKUP_BATCH];
+            unsigned int lengths[LOOKUP_BATCH], size = (count - first < LOOKUP_BATCH) ? count - first : LOOKUP_BATCH;
+            unsigned char verdicts[LOOKUP_BATCH];
+
+            for (unsigned int word = 0; word < size; word++)
+            {
+                batch[word] = words[first + word].word;
+                lengths[word] = words[first + word].length;
+            }
+            lookupBatch(&dictionary, batch, lengths, size, verdicts);
+            for (unsigned int word = 0; word < size; word++)
+            {
+                found += verdicts[word];
+            }
+        }
+        seconds[trial] = now() - start;
+        printTrial(bench, input, "warm", trial, seconds[trial], count / seconds[trial], "lookups/s");
+    }
+    if (rc == OK)
+    {
+        printSummary(bench, input, "warm", seconds, options->trials, count, "lookups/s");
+    }
+
+    free(folded);
+    free(words);
+    if (doc_fd != NULL)
+    {
+        unmapFile(&map);
+        fclose(doc_fd);
+    }
+    deallocateDictionary(&dictionary);
+    return rc;
+}
+
+/*
+ * Time the suggestions for the misspelled words of the document
+ *
+ * @param const BenchOptions * options trials and threads
+ * @param const BenchInput * input files to use
+ * @return OK or NOK
+ *
+ * Only the first BENCH_MISSPELLED misspelled words are timed: a search is
+ * a lot slower than a lookup and the document repeats itself when scaled
+ */
+static int benchSuggest(const BenchOptions *options, const BenchInput *input)
+{
+    int rc = OK;
+    double seconds[MAX_TRIALS];
+    Dictionary dictionary;
+    FILE *doc_fd = NULL;
+    FileMap map;
+    BenchWord *words = NULL;
+    size_t count = 0, misspelled = 0;
+
+    if (loadDictionary(input->dict, &dictionary, options->threads, BENCH_SUGGEST, 0, DICTIONARY_SETS) != OK)
+    {
+        return NOK;
+    }
+    if ((doc_fd = fopen(input->doc, "r")) == NULL || mapFile(doc_fd, &map, 0) != OK ||
+        (words = collectWords(&dictionary, map.data, map.size, &count)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Can't read words of %s\n", input->doc);
+        rc = NOK;
+    }
+    for (size_t word = 0; rc == OK && word < count && misspelled < BENCH_MISSPELLED; word++)
+    {
+        if (!lookupWord(&dictionary, words[word].word, words[word].length))
+        {
+            words[misspelled++] = words[word];
+        }
+    }
+
+    for (unsigned int trial = 0; rc == OK && misspelled != 0 && trial < options->trials; trial++)
+    {
+        volatile size_t found = 0;
+        GraphMatches matches;
+        double start = now();
+
+        for (size_t word = 0; word < misspelled; word++)
+        {
+            found += suggestWords(&dictionary, words[word].word, words[word].length, &matches);
+        }
+        seconds[trial] = now() - start;
+        printTrial("suggest", input, "warm", trial, seconds[trial], misspelled / seconds[trial], "suggestions/s");
+    }
+    if (rc == OK && misspelled != 0)
+    {
+        printSummary("suggest", input, "warm", seconds, options->trials, misspelled, "suggestions/s");
+    }
+
+    free(words);
+    if (doc_fd != NULL)
+    {
+        unmapFile(&map);
+        fclose(doc_fd);
+    }
+    deallocateDictionary(&dictionary);
+    return rc;
+}
+
+/*
+ * Time the spellcheck program, from start to exit
+ *
+ * @param const BenchOptions * options program, trials and threads
+ * @param const BenchInput * input files to use
+ * @param int cold 1 to drop both files from the page cache every trial
+ * @return OK or NOK
+ */
+static int benchProgram(const BenchOptions *options, const BenchInput *input, int cold)
+{
+    double seconds[MAX_TRIALS];
+    const char *cache = cold ? "cold" : "warm";
+    char threads[16];
+
+    snprintf(threads, sizeof(threads), "%u", options->threads);
+
+    for (unsigned int trial = 0; trial <= options->trials; trial++)
+    {
+        double start = 0;
+        pid_t pid = 0;
+        int status = 0;
+
+        if (cold)
+        {
+            dropCache(input->dict);
+            dropCache(input->doc);
+        }
+        start = now();
+        if ((pid = fork()) == 0)
+        {
+            int null = open("/dev/null", O_WRONLY);
+
+            dup2(null, STDOUT_FILENO);
+            execl(options->program, options->program, "-j", threads, input->dict, input->doc, (char *)NULL);
+            _exit(127);
+        }
+        if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            fprintf(stderr, "ERROR: %s failed on %s\n", options->program, input->doc);
+            return NOK;
+        }
+
+        // Trial 0 of a warm measure only brings the files in the cache
+        if (cold || trial != 0)
+        {
+            unsigned int index = cold ? trial : trial - 1;
+
+            if (index < options->trials)
+            {
+                seconds[index] = now() - start;
+                printTrial("e2e", input, cache, index, seconds[index],
+                           input->doc_words / seconds[index], "words/s");
+            }
+        }
+    }
+    printSummary("e2e", input, cache, seconds, options->trials, input->doc_words, "words/s");
+    return OK;
+}
+
+/*
+ * Build a dictionary from a file
+ *
+ * @param const char * path dictionary file
+ * @param Dictionary * dictionary dictionary to build
+ * @param unsigned int threads build threads
+ * @param unsigned int suggest suggestions per word, 0 if none
+ * @param unsigned int filter Bloom filter bits per word, 0 if none
+ * @param DictionaryBackend backend where the words are kept
+ * @return OK or NOK
+ */
+static int loadDictionary(const char *path, Dictionary *dictionary, unsigned int threads, unsigned int suggest,
+                          unsigned int filter, DictionaryBackend backend)
+{
+    int rc = NOK;
+    FILE *dict_fd = NULL;
+
+    if ((dict_fd = fopen(path, "r")) == NULL)
+    {
+        fprintf(stderr, "ERROR: Can't open dictionary %s: errno %d\n", path, errno);
+        return NOK;
+    }
+    if ((rc = initializeDictionary(dictionary)) == OK)
+    {
+        dictionary->suggest = suggest;
+        dictionary->filter = filter;
+        dictionary->backend = backend;
+        rc = populateDictionary(dict_fd, dictionary, threads);
+    }
+    fclose(dict_fd);
+    return rc;
+}
+
+/*
+ * Collect the words of a text the checker would look up
+ *
+ * @param Dictionary * dictionary dictionary, letters without words are skipped
+ * @param const char * text text to split
+ * @param size_t size bytes of the text
+ * @param size_t * count number of words returned
+ * @return the words (pointing in text), NULL if out of memory
+ */
+static BenchWord *collectWords(Dictionary *dictionary, const char *text, size_t size, size_t *count)
+{
+    Tokens tokens;
+    BenchWord *words = NULL;
+    size_t allocated = 0;
+    TextPosition position = {1, 1};
+
+    *count = 0;
+    if (tokensInitialize(&tokens) != OK)
+    {
+        return NULL;
+    }
+    while (size > 0)
+    {
+        size_t window = (size < TOKEN_WINDOW) ? size : TOKEN_WINDOW;
+        size_t used = tokenizeText(&tokens, text, window, window == size, &position);
+
+        if (*count + tokens.count >= allocated)
+        {
+            BenchWord *grown = NULL;
+
+            allocated = (allocated + tokens.count) * 2 + 1024;
+            if ((grown = (BenchWord *)realloc(words, allocated * sizeof(BenchWord))) == NULL)
+            {
+                free(words);
+                tokensRelease(&tokens);
+                return NULL;
+            }
+            words = grown;
+        }
+        for (size_t word = 0; word < tokens.count; word++)
+        {
+            const WordSpan *span = &tokens.spans[word];
+            unsigned char index = tokens.folded[span->offset] - 'a';
+
+            if (index < ALPHABET_SIZE && dictionary->letters[index].words != 0)
+            {
+                words[*count].word = text + span->offset;
+                words[*count].length = span->trimmed;
+                (*count)++;
+            }
+        }
+        // A word longer than a window is not worth a lookup
+        if (used == 0)
+        {
+            while (used < size && !isspace((unsigned char)text[used]))
+            {
+                used++;
+            }
+        }
+        text += used;
+        size -= used;
+    }
+    tokensRelease(&tokens);
+    return words;
+}
+
+/*
+ * Count the words of a document, as the tokenizer splits them
+ *
+ * @param const char * path document
+ * @return number of words
+ */
+static size_t countWords(const char *path)
+{
+    size_t words = 0;
+    int last = 1;
+    int byte = 0;
+    FILE *fd = fopen(path, "r");
+
+    while (fd != NULL && (byte = getc(fd)) != EOF)
+    {
+        int space = isspace(byte);
+
+        words += (last && !space);
+        last = space;
+    }
+    if (fd != NULL)
+    {
+        fclose(fd);
+    }
+    return words;
+}
+
+/*
+ * Count the lines of a file
+ *
+ * @param const char * path file
+ * @return number of lines
+ */
+static size_t countLines(const char *path)
+{
+    size_t lines = 0;
+    int byte = 0;
+    FILE *fd = fopen(path, "r");
+
+    while (fd != NULL && (byte = getc(fd)) != EOF)
+    {
+        lines += (byte == '\n');
+    }
+    if (fd != NULL)
+    {
+        fclose(fd);
+    }
+    return lines;
+}
+
+/*
+ * Drop a file from the page cache. Only clean pages can be dropped, so the
+ * file is synced first. Best effort, nothing is reported if it fails
+ *
+ * @param const char * path file
+ */
+static void dropCache(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd >= 0)
+    {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+/*
+ * Monotonic time in seconds
+ */
+static double now(void)
+{
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/*
+ * Print the result of a trial
+ *
+ * @param const char * bench measure name
+ * @param const BenchInput * input input of the measure
+ * @param const char * cache "cold" or "warm"
+ * @param unsigned int trial trial number
+ * @param double seconds duration of the trial
+ * @param double rate work done per second
+ * @param const char * unit unit of the rate
+ */
+static void printTrial(const char *bench, const BenchInput *input, const char *cache, unsigned int trial,
+                       double seconds, double rate, const char *unit)
+{
+    printf("{\"bench\":\"%s\",\"scale\":%u,\"cache\":\"%s\",\"trial\":%u,\"seconds\":%.6f,"
+           "\"rate\":%.0f,\"unit\":\"%s\"}\n", bench, input->scale, cache, trial, seconds, rate, unit);
+    fflush(stdout);
+}
+
+/*
+ * Print min and median of the trials of a measure
+ *
+ * @param const char * bench measure name
+ * @param const BenchInput * input input of the measure
+ * @param const char * cache "cold" or "warm"
+ * @param double * seconds durations of the trials, sorted on return
+ * @param unsigned int trials number of trials
+ * @param double work work done by every trial
+ * @param const char * unit unit of the rate
+ */
+static void printSummary(const char *bench, const BenchInput *input, const char *cache, double *seconds,
+                         unsigned int trials, double work, const char *unit)
+{
+    double median = 0;
+
+    qsort(seconds, trials, sizeof(double), compareTime);
+    median = (trials % 2) ? seconds[trials / 2] : (seconds[trials / 2 - 1] + seconds[trials / 2]) / 2;
+
+    printf("{\"bench\":\"summary\",\"measure\":\"%s\",\"scale\":%u,\"cache\":\"%s\",\"trials\":%u,"
+           "\"min\":%.6f,\"median\":%.6f,\"rate\":%.0f,\"unit\":\"%s\"}\n",
+           bench, input->scale, cache, trials, seconds[0], median, work / median, unit);
+    fflush(stdout);
+}
+
+/*
+ * qsort compare of two durations
+ */
+static int compareTime(const void *left, const void *right)
+{
+    double a = *(const double *)left, b = *(const double *)right;
+
+    return (a > b) - (a < b);
+}
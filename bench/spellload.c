@@ -0,0 +1,283 @@
+// System include
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+// Project include
+#include "spellcheck.h"
+#include "dictionary.h"
+#include "file_map.h"
+#include "server.h"
+#include "thread_pool.h"
+
+/*******************************************************************************
+ * SPELLLOAD - Load generator of the spellcheck server
+ *
+ * Every connection is a thread sending the same document again and again,
+ * one request at a time (the next one leaves when the response is in), so
+ * the latency of a request is the time the client waits for it.
+ *
+ * Output is one JSON object per line: one "info" line, then one "load" line
+ * with the requests per second over all the connections and the latency
+ * percentiles, in milliseconds.
+ *
+ *   spellcheck -j 4 --serve /tmp/spell.sock dictionary_long.txt &
+ *   spellload -c 8 -n 1000 -d document_short.txt /tmp/spell.sock
+ *
+ ******************************************************************************/
+
+#define MAX_CONNECTIONS 1024    // Connections in -c
+
+// Command line options
+typedef struct {
+    const char      *socket;        // Server socket
+    const char      *document;      // Document sent in every request
+    unsigned int    connections;    // Concurrent clients
+    unsigned int    requests;       // Requests of every client
+}LoadOptions;
+
+// Shared state of the clients
+typedef struct {
+    const LoadOptions   *options;
+    const char          *text;          // Document
+    size_t              size;
+    double              *latency;       // Seconds, requests per connection
+                                        // for every connection
+    unsigned int        next;           // Next connection to start
+    unsigned int        failed;         // Connections that failed
+}LoadJob;
+
+// Static function declarations
+static int parseOptions(int argc, char *argv[], LoadOptions *options);
+static void printUsage(const char *name);
+static void *loadWorker(void *arg);
+static double now(void);
+static double percentile(const double *sorted, size_t count, double rank);
+static int compareTime(const void *left, const void *right);
+
+
+
+/*******************************************************************************
+ * main
+ ******************************************************************************/
+int main(int argc, char *argv[])
+{
+    LoadOptions options;
+    LoadJob job;
+    FileMap map;
+    FILE *doc_fd = NULL;
+    size_t total = 0;
+    double start = 0, seconds = 0;
+
+    if (parseOptions(argc, argv, &options) != OK)
+    {
+        printUsage(argv[0]);
+        exit(NOK);
+    }
+    if ((doc_fd = fopen(options.document, "r")) == NULL || mapFile(doc_fd, &map, 0) != OK)
+    {
+        fprintf(stderr, "ERROR: Can't map document %s: errno %d\n", options.document, errno);
+        exit(NOK);
+    }
+
+    total = (size_t)options.connections * options.requests;
+    job.options = &options;
+    job.text = map.data;
+    job.size = map.size;
+    job.next = 0;
+    job.failed = 0;
+    if ((job.latency = (double *)malloc(total * sizeof(double))) == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        exit(NOK);
+    }
+
+    printf("{\"bench\":\"info\",\"socket\":\"%s\",\"document\":\"%s\",\"bytes\":%zu,"
+           "\"connections\":%u,\"requests\":%u}\n",
+           options.socket, options.document, map.size, options.connections, options.requests);
+    fflush(stdout);
+
+    start = now();
+    runWorkers(options.connections, loadWorker, &job);
+    seconds = now() - start;
+
+    if (job.failed != 0)
+    {
+        fprintf(stderr, "ERROR: %u connections failed\n", job.failed);
+    }
+    else
+    {
+        qsort(job.latency, total, sizeof(double), compareTime);
+        printf("{\"bench\":\"load\",\"connections\":%u,\"requests\":%zu,\"seconds\":%.6f,\"rate\":%.0f,"
+               "\"unit\":\"requests/s\",\"latency_ms\":{\"min\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,"
+               "\"max\":%.3f}}\n",
+               options.connections, total, seconds, total / seconds, job.latency[0] * 1e3,
+               percentile(job.latency, total, 0.50) * 1e3, percentile(job.latency, total, 0.90) * 1e3,
+               percentile(job.latency, total, 0.99) * 1e3, job.latency[total - 1] * 1e3);
+    }
+
+    free(job.latency);
+    unmapFile(&map);
+    fclose(doc_fd);
+
+    exit(job.failed ? NOK : OK);
+}
+
+
+
+/*******************************************************************************
+ * Static functions
+ ******************************************************************************/
+
+/*
+ * Parse the command line options
+ *
+ * @param int argc number of arguments
+ * @param char * argv[] arguments
+ * @param LoadOptions * options filled with the options found
+ * @return OK or NOK
+ */
+static int parseOptions(int argc, char *argv[], LoadOptions *options)
+{
+    int option = 0;
+    char *end = NULL;
+
+    options->document = "document_short.txt";
+    options->connections = 4;
+    options->requests = 1000;
+
+    while ((option = getopt(argc, argv, "c:n:d:")) != -1)
+    {
+        switch (option)
+        {
+            case 'c':
+                options->connections = strtoul(optarg, &end, 10);
+                if (*end != 0 || options->connections == 0 || options->connections > MAX_CONNECTIONS)
+                {
+                    fprintf(stderr, "ERROR: Invalid number of connections %s (1-%d)\n", optarg, MAX_CONNECTIONS);
+                    return NOK;
+                }
+                break;
+            case 'n':
+                options->requests = strtoul(optarg, &end, 10);
+                if (*end != 0 || options->requests == 0)
+                {
+                    fprintf(stderr, "ERROR: Invalid number of requests %s\n", optarg);
+                    return NOK;
+                }
+                break;
+            case 'd':
+                options->document = optarg;
+                break;
+            default:
+                return NOK;
+        }
+    }
+
+    if (argc - optind != 1)
+    {
+        return NOK;
+    }
+    options->socket = argv[optind];
+    return OK;
+}
+
+/*
+ * Print how to use the program
+ *
+ * @param const char * name program name
+ */
+static void printUsage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-c connections] [-n requests] [-d document] <socket>\n", name);
+    fprintf(stderr, "\t-c concurrent connections, one thread each (4)\n");
+    fprintf(stderr, "\t-n requests sent by every connection (1000)\n");
+    fprintf(stderr, "\t-d document sent in every request (document_short.txt)\n");
+}
+
+/*
+ * Run the requests of one connection, until there are connections left
+ *
+ * @param void * arg the LoadJob
+ *
+ * runWorkers starts as many threads as connections, but a thread that
+ * can't be created doesn't lose its connection: another thread runs it
+ */
+static void *loadWorker(void *arg)
+{
+    LoadJob *job = (LoadJob *)arg;
+    unsigned int index = 0;
+    ServerReply reply = {0, NULL, 0, 0};
+
+    while ((index = nextTask(&job->next)) < job->options->connections)
+    {
+        double *latency = job->latency + (size_t)index * job->options->requests;
+        int fd = connectServer(job->options->socket);
+
+        for (unsigned int request = 0; fd >= 0 && request < job->options->requests; request++)
+        {
+            double start = now();
+
+            if (sendRequest(fd, job->text, job->size, &reply) != OK || reply.status != SERVER_OK)
+            {
+                fprintf(stderr, "ERROR: Request %u of connection %u failed: errno %d\n", request, index, errno);
+                close(fd);
+                fd = -1;
+                break;
+            }
+            latency[request] = now() - start;
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        else
+        {
+            __atomic_fetch_add(&job->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    releaseReply(&reply);
+    return NULL;
+}
+
+/*
+ * Monotonic time
+ *
+ * @return seconds from an arbitrary point
+ */
+static double now(void)
+{
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/*
+ * Nearest rank percentile
+ *
+ * @param const double * sorted values, sorted
+ * @param size_t count number of values
+ * @param double rank percentile, 0 to 1
+ * @return the value at rank
+ */
+static double percentile(const double *sorted, size_t count, double rank)
+{
+    size_t index = (size_t)(rank * count);
+
+    return sorted[(index < count) ? index : count - 1];
+}
+
+/*
+ * qsort comparison of two times
+ */
+static int compareTime(const void *left, const void *right)
+{
+    double a = *(const double *)left, b = *(const double *)right;
+
+    return (a > b) - (a < b);
+}
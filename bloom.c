@@ -0,0 +1,67 @@
+// System include
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// Project include
+#include "spellcheck.h"
+#include "bloom.h"
+
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_WORDS * 64)   // Bits in a block
+
+
+int bloomInitialize(BloomFilter *filter, size_t keys, unsigned int bits)
+{
+    void *blocks = NULL;
+
+    assert(filter != NULL);
+    assert(bits >= 1 && bits <= BLOOM_MAX_BITS);
+
+    filter->blocks = NULL;
+    filter->keys = 0;
+    // At least one block, so a test never reads outside
+    filter->count = (keys * bits + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+    if (filter->count == 0)
+    {
+        filter->count = 1;
+    }
+
+    // Blocks aligned on the cache lines
+    if (posix_memalign(&blocks, BLOOM_BLOCK_WORDS * sizeof(uint64_t),
+                       filter->count * BLOOM_BLOCK_WORDS * sizeof(uint64_t)) != 0)
+    {
+        printf("ERROR: Out of memory for the filter of %zu words\n", keys);
+        return NOK;
+    }
+    memset(blocks, 0, filter->count * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+    filter->blocks = (uint64_t *)blocks;
+
+    return OK;
+}
+
+void bloomAdd(BloomFilter *filter, uint32_t key)
+{
+    uint64_t hash = bloomMix(key);
+    uint64_t *block = filter->blocks + ((hash >> 32) * filter->count >> 32) * BLOOM_BLOCK_WORDS;
+    uint64_t bits = hash * 0x9E3779B97F4A7C15ull;
+
+    assert(filter->blocks != NULL);
+
+    for (int word = 0; word < BLOOM_BLOCK_WORDS; word++)
+    {
+        block[word] |= 1ull << ((bits >> (6 * word)) & 63);
+    }
+    filter->keys++;
+}
+
+void bloomRelease(BloomFilter *filter)
+{
+    assert(filter != NULL);
+
+    free(filter->blocks);
+    filter->blocks = NULL;
+    filter->count = 0;
+    filter->keys = 0;
+}
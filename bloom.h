@@ -0,0 +1,127 @@
+#ifndef _BLOOM_H
+#define _BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************************************
+ * BLOOM - Split block Bloom filter
+ *
+ * A bit array that tells when a word is surely not in the dictionary: every
+ * word sets a few bits, a word with one of its bits clear was never added.
+ * A word with all its bits set may still be missing (a false positive), the
+ * dictionary has to look it up.
+ *
+ * The array is made of 64 bytes blocks, one cache line each. A word picks
+ * one block and sets one bit in each of the 8 words of the block, so a test
+ * reads one cache line, not 8 random ones:
+ *
+ *   hash -> block  | word 0 | word 1 | ... | word 7 |     64 bits each
+ *                      ^        ^              ^
+ *                      one bit per word, 6 bits of the hash each
+ *
+ * With 10 bits per word about 1% of the words not in the dictionary pass,
+ * for 234k words the array is 290 KB: it stays in L2 where the sets don't.
+ *
+ * bloomMayContain is static inline, it runs once per word of the document.
+ *
+ ******************************************************************************/
+
+#define BLOOM_BLOCK_WORDS   8       // 64 bits words in a block (a cache line)
+#define BLOOM_BITS          10      // Default bits per key
+#define BLOOM_MAX_BITS      64      // Most bits per key
+
+typedef struct {
+    uint64_t        *blocks;    // Bits, BLOOM_BLOCK_WORDS words per block,
+                                // NULL if no filter
+    size_t          count;      // Blocks
+    size_t          keys;       // Keys added
+}BloomFilter;
+
+
+/*
+ * bloomMix
+ *
+ * Spread a key (any 32 bits hash) over 64 bits: the high half picks the
+ * block, the bits in it come from the whole
+ *
+ * @param uint32_t key hash of the word
+ * @return the mixed hash
+ *
+ */
+static inline uint64_t bloomMix(uint32_t key)
+{
+    uint64_t hash = key;
+
+    // Finalizer of MurmurHash3: every bit of the key moves every bit
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+
+/*
+ * bloomMayContain
+ *
+ * Test a key
+ *
+ * @param const BloomFilter * filter built filter
+ * @param uint32_t            key hash of the word
+ * @return 0 if the key was surely not added, 1 if it may have been
+ *
+ */
+static inline int bloomMayContain(const BloomFilter *filter, uint32_t key)
+{
+    uint64_t hash = bloomMix(key);
+    const uint64_t *block = filter->blocks + ((hash >> 32) * filter->count >> 32) * BLOOM_BLOCK_WORDS;
+    uint64_t bits = hash * 0x9E3779B97F4A7C15ull;
+    uint64_t found = 1;
+
+    for (int word = 0; word < BLOOM_BLOCK_WORDS; word++)
+    {
+        found &= block[word] >> ((bits >> (6 * word)) & 63);
+    }
+    return (int)found;
+}
+
+
+/*
+ * bloomInitialize
+ *
+ * Allocate an empty filter sized for keys keys
+ *
+ * @param BloomFilter * filter filter to initialize
+ * @param size_t        keys keys that will be added
+ * @param unsigned int  bits bits per key, 1 to BLOOM_MAX_BITS
+ * @return OK or NOK if out of memory
+ *
+ */
+int bloomInitialize(BloomFilter *filter, size_t keys, unsigned int bits);
+
+
+/*
+ * bloomAdd
+ *
+ * Add a key
+ *
+ * @param BloomFilter * filter filter to add to
+ * @param uint32_t      key hash of the word
+ *
+ */
+void bloomAdd(BloomFilter *filter, uint32_t key);
+
+
+/*
+ * bloomRelease
+ *
+ * Free the filter, the filter is empty (blocks NULL) afterwards
+ *
+ * @param BloomFilter * filter filter to release
+ *
+ */
+void bloomRelease(BloomFilter *filter);
+
+#endif // _BLOOM_H
@@ -0,0 +1,130 @@
+#ifndef _CASE_FOLD_H
+#define _CASE_FOLD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*******************************************************************************
+ * CASE FOLD - ASCII lower case on 16/32 bytes blocks
+ *
+ * A byte is upper case when byte - 'A' <= 25 (unsigned), folding it is adding
+ * 0x20. With SSE2/AVX2 this is a few instructions for a whole block, so the
+ * tokenizer folds the document this way and compareWord checks a word a
+ * block at a time instead of a tolower per byte.
+ *
+ * Only ASCII is folded, like tolower in the C locale.
+ *
+ * Everything here is static inline, these are called once per word (or per
+ * block) in the hottest loops.
+ *
+ ******************************************************************************/
+
+#define CASE_FOLD_PAGE 4096  // Smallest page size, a load can't cross it
+
+#if defined(__SSE2__)
+/*
+ * foldBlock16
+ *
+ * Lower case 16 bytes
+ *
+ * @param __m128i bytes bytes to fold
+ * @return the folded bytes
+ *
+ */
+static inline __m128i foldBlock16(__m128i bytes)
+{
+    __m128i upper = _mm_sub_epi8(bytes, _mm_set1_epi8('A'));
+
+    // x <= n unsigned is min(x, n) == x
+    upper = _mm_cmpeq_epi8(_mm_min_epu8(upper, _mm_set1_epi8('Z' - 'A')), upper);
+    return _mm_add_epi8(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+#if defined(__AVX2__)
+/*
+ * foldBlock32
+ *
+ * Lower case 32 bytes
+ *
+ * @param __m256i bytes bytes to fold
+ * @return the folded bytes
+ *
+ */
+static inline __m256i foldBlock32(__m256i bytes)
+{
+    __m256i upper = _mm256_sub_epi8(bytes, _mm256_set1_epi8('A'));
+
+    upper = _mm256_cmpeq_epi8(_mm256_min_epu8(upper, _mm256_set1_epi8('Z' - 'A')), upper);
+    return _mm256_add_epi8(bytes, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+#endif
+
+/*
+ * compareWord
+ *
+ * Compare a folded word with a word in any case. Only the second one gets
+ * folded: dictionary words are stored folded.
+ * Whole blocks are compared at once. The tail is loaded as a full block and
+ * the bytes after the words are masked out, unless the load could cross a
+ * page (then we go byte by byte, a few bytes at most).
+ *
+ * @param const char * folded word already lower case
+ * @param const char * word word to compare, any case
+ * @param size_t       length length of both words
+ * @return 1 if the words are the same, 0 otherwise
+ *
+ */
+static inline int compareWord(const char *folded, const char *word, size_t length)
+{
+    size_t pos = 0;
+
+#if defined(__AVX2__)
+    for (; pos + 32 <= length; pos += 32)
+    {
+        __m256i left = _mm256_loadu_si256((const __m256i *)(folded + pos));
+        __m256i right = foldBlock32(_mm256_loadu_si256((const __m256i *)(word + pos)));
+
+        if ((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(left, right)) != 0xFFFFFFFFu)
+        {
+            return 0;
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    for (; pos + 16 <= length; pos += 16)
+    {
+        __m128i left = _mm_loadu_si128((const __m128i *)(folded + pos));
+        __m128i right = foldBlock16(_mm_loadu_si128((const __m128i *)(word + pos)));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(left, right)) != 0xFFFF)
+        {
+            return 0;
+        }
+    }
+    if (pos < length &&
+        ((uintptr_t)(folded + pos) % CASE_FOLD_PAGE) <= CASE_FOLD_PAGE - 16 &&
+        ((uintptr_t)(word + pos) % CASE_FOLD_PAGE) <= CASE_FOLD_PAGE - 16)
+    {
+        __m128i left = _mm_loadu_si128((const __m128i *)(folded + pos));
+        __m128i right = foldBlock16(_mm_loadu_si128((const __m128i *)(word + pos)));
+        unsigned int differ = ~(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(left, right));
+
+        return (differ & ((1u << (length - pos)) - 1)) == 0;
+    }
+#endif
+    while (pos < length && folded[pos] == tolower((unsigned char)word[pos]))
+    {
+        pos++;
+    }
+    return (pos == length);
+}
+
+#endif // _CASE_FOLD_H
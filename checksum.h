@@ -0,0 +1,39 @@
+#ifndef _CHECKSUM_H
+#define _CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************************************
+ * CHECKSUM - FNV-1a 64 bits of the files written to disk
+ *
+ * The dictionary images and the line caches check their headers (and the
+ * images their body) with the same hash: both formats go through this one.
+ * It is a byte at a time, good enough to catch truncated or damaged files.
+ *
+ ******************************************************************************/
+
+/*
+ * checksum
+ *
+ * FNV-1a 64 bits of a block of bytes
+ *
+ * @param const void * data bytes to check
+ * @param size_t size number of bytes
+ * @return the hash of the bytes
+ *
+ */
+static inline uint64_t checksum(const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint64_t hash = 14695981039346656037ULL;
+
+    while (size--)
+    {
+        hash ^= *bytes++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+#endif // _CHECKSUM_H
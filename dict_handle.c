@@ -0,0 +1,111 @@
+// System include
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+// Project include
+#include "spellcheck.h"
+#include "dictionary.h"
+#include "dict_handle.h"
+
+// Static function declarations
+static int readersDrained(const DictionaryHandle *handle, uint64_t epoch);
+
+
+int handleInitialize(DictionaryHandle *handle, Dictionary *dictionary, unsigned int readers)
+{
+    assert(handle != NULL);
+    assert(dictionary != NULL);
+    assert(readers > 0);
+
+    if ((handle->readers = (HandleReader *)calloc(readers, sizeof(HandleReader))) == NULL)
+    {
+        printf("ERROR: Dictionary handle of %u readers out of memory\n", readers);
+        return NOK;
+    }
+    handle->current = dictionary;
+    handle->epoch = 1;
+    handle->count = readers;
+    return OK;
+}
+
+Dictionary *handleEnter(DictionaryHandle *handle, unsigned int reader)
+{
+    assert(handle != NULL);
+    assert(reader < handle->count);
+
+    // The slot is set before current is read: a swap that doesn't see the
+    // slot has made its dictionary current already
+    __atomic_store_n(&handle->readers[reader].epoch, __atomic_load_n(&handle->epoch, __ATOMIC_SEQ_CST),
+                     __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&handle->current, __ATOMIC_SEQ_CST);
+}
+
+void handleLeave(DictionaryHandle *handle, unsigned int reader)
+{
+    assert(handle != NULL);
+    assert(reader < handle->count);
+
+    __atomic_store_n(&handle->readers[reader].epoch, 0, __ATOMIC_RELEASE);
+}
+
+Dictionary *handleSwap(DictionaryHandle *handle, Dictionary *dictionary)
+{
+    const struct timespec wait = {0, HANDLE_DRAIN_WAIT};
+    Dictionary *old = NULL;
+    uint64_t epoch = 0;
+
+    assert(handle != NULL);
+    assert(dictionary != NULL);
+
+    old = __atomic_exchange_n(&handle->current, dictionary, __ATOMIC_SEQ_CST);
+    epoch = __atomic_add_fetch(&handle->epoch, 1, __ATOMIC_SEQ_CST);
+
+    // Readers entered before the new epoch may hold old, the ones after it
+    // can't
+    while (!readersDrained(handle, epoch))
+    {
+        nanosleep(&wait, NULL);
+    }
+    return old;
+}
+
+void handleRelease(DictionaryHandle *handle)
+{
+    assert(handle != NULL);
+
+    free(handle->readers);
+    handle->readers = NULL;
+    handle->count = 0;
+}
+
+
+
+/*******************************************************************************
+ * Static functions
+ ******************************************************************************/
+
+/******************************************************************************
+ * readersDrained
+ *
+ * @param const DictionaryHandle *handle handle being swapped
+ * @param uint64_t epoch epoch of the new generation
+ *
+ * Tell if every reader is out, or entered in epoch or later
+ */
+static int readersDrained(const DictionaryHandle *handle, uint64_t epoch)
+{
+    for (unsigned int reader = 0; reader < handle->count; reader++)
+    {
+        uint64_t entered = __atomic_load_n(&handle->readers[reader].epoch, __ATOMIC_SEQ_CST);
+
+        if (entered != 0 && entered < epoch)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
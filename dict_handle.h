@@ -0,0 +1,116 @@
+#ifndef _DICT_HANDLE_H
+#define _DICT_HANDLE_H
+
+#include <stdint.h>
+
+#include "dictionary.h"
+
+/*******************************************************************************
+ * DICTIONARY HANDLE - Swap the dictionary under running readers
+ *
+ * A resident checker (the server) reads its dictionary through a handle, so
+ * a new generation of the words can replace it without stopping the checks.
+ * Reclamation is epoch based:
+ *
+ *   reader                              writer (handleSwap)
+ *   ------                              ------
+ *   slot = epoch          (enter)       current = new dictionary
+ *   dictionary = current                epoch++
+ *   ... check ...                       wait: every slot 0 or >= epoch
+ *   slot = 0              (leave)       old dictionary can go
+ *
+ * A reader never waits nor locks: entering is two loads and a store, it
+ * takes whatever generation is current and keeps it until it leaves (one
+ * request of the server). Only the writer waits, for the readers that may
+ * still hold the old generation, polling their slots. A reader entering
+ * after the swap can't get the old generation, so the wait ends with the
+ * requests in flight.
+ *
+ * Every reader has its own slot, one cache line each: readers don't share
+ * lines with each other, the writer only reads them while swapping.
+ *
+ ******************************************************************************/
+
+#define HANDLE_DRAIN_WAIT   1000000     // Nanoseconds between two polls of
+                                        // the readers while swapping
+
+// Slot of a reader, a cache line
+typedef struct {
+    uint64_t        epoch;      // Epoch the reader entered in, 0 if out
+    uint64_t        padding[7];
+}HandleReader;
+
+typedef struct {
+    Dictionary      *current;   // Generation taken by the readers entering
+    uint64_t        epoch;      // Swaps done + 1
+    HandleReader    *readers;   // Slot of every reader
+    unsigned int    count;      // Readers
+}DictionaryHandle;
+
+
+/*
+ * handleInitialize
+ *
+ * Initialize a handle on a dictionary, for a fixed number of readers
+ *
+ * @param DictionaryHandle * handle handle to initialize
+ * @param Dictionary       * dictionary first generation
+ * @param unsigned int       readers number of readers, every one has a slot
+ * @return OK or NOK if out of memory
+ *
+ */
+int handleInitialize(DictionaryHandle *handle, Dictionary *dictionary, unsigned int readers);
+
+
+/*
+ * handleEnter
+ *
+ * Take the current generation, it stays valid until handleLeave. Never
+ * blocks
+ *
+ * @param DictionaryHandle * handle handle to read
+ * @param unsigned int       reader slot of the reader, below readers
+ * @return the dictionary to use
+ *
+ */
+Dictionary *handleEnter(DictionaryHandle *handle, unsigned int reader);
+
+
+/*
+ * handleLeave
+ *
+ * Give back the generation taken by handleEnter
+ *
+ * @param DictionaryHandle * handle handle read
+ * @param unsigned int       reader slot of the reader
+ *
+ */
+void handleLeave(DictionaryHandle *handle, unsigned int reader);
+
+
+/*
+ * handleSwap
+ *
+ * Make a dictionary the current generation, then wait for the readers that
+ * may still use the old one to leave. One writer at a time
+ *
+ * @param DictionaryHandle * handle handle to update
+ * @param Dictionary       * dictionary new generation, populated
+ * @return the old generation, no reader uses it anymore
+ *
+ */
+Dictionary *handleSwap(DictionaryHandle *handle, Dictionary *dictionary);
+
+
+/*
+ * handleRelease
+ *
+ * Free the slots of the readers, the current generation is left to the
+ * caller
+ *
+ * @param DictionaryHandle * handle handle to release, no reader in it
+ *
+ */
+void handleRelease(DictionaryHandle *handle);
+
+#endif // _DICT_HANDLE_H
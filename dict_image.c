@@ -0,0 +1,476 @@
+// System include
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+// Project include
+#include "spellcheck.h"
+#include "dictionary.h"
+#include "dict_image.h"
+#include "checksum.h"
+
+#define IMAGE_ALIGN 16  // Alignment of every set in the image
+
+// Static function declarations
+static int compileSets(Dictionary *dictionary, const char *path);
+static int loadSets(Dictionary *dictionary);
+static int compilePerfect(Dictionary *dictionary, const char *path);
+static int loadPerfect(Dictionary *dictionary);
+static int isPerfectImage(const FileMap *map);
+static int writeImage(const char *image, size_t size, const char *path);
+static inline size_t alignImage(size_t offset);
+
+
+int compileDictionaryImage(Dictionary *dictionary, const char *path)
+{
+    assert(dictionary != NULL);
+
+    if (dictionary->backend == DICTIONARY_PERFECT)
+    {
+        return compilePerfect(dictionary, path);
+    }
+    return compileSets(dictionary, path);
+}
+
+int loadDictionaryImage(Dictionary *dictionary)
+{
+    assert(dictionary != NULL);
+
+    if (isPerfectImage(&dictionary->map))
+    {
+        return loadPerfect(dictionary);
+    }
+    return loadSets(dictionary);
+}
+
+int verifyDictionaryImage(Dictionary *dictionary)
+{
+    size_t header_size = sizeof(ImageHeader);
+    uint64_t body_checksum = 0;
+
+    assert(dictionary != NULL);
+
+    if (!dictionary->image)
+    {
+        return OK;
+    }
+    if (isPerfectImage(&dictionary->map))
+    {
+        header_size = sizeof(PerfectImageHeader);
+        body_checksum = ((const PerfectImageHeader *)dictionary->map.data)->body_checksum;
+    }
+    else
+    {
+        body_checksum = ((const ImageHeader *)dictionary->map.data)->body_checksum;
+    }
+
+    if (body_checksum != checksum(dictionary->map.data + header_size, dictionary->map.size - header_size))
+    {
+        printf("ERROR: Dictionary image checksum mismatch\n");
+        return NOK;
+    }
+    return OK;
+}
+
+int isDictionaryImage(const FileMap *map)
+{
+    assert(map != NULL);
+
+    return (map->data != NULL && map->size >= sizeof(IMAGE_MAGIC) - 1 &&
+            memcmp(map->data, IMAGE_MAGIC, sizeof(IMAGE_MAGIC) - 1) == 0) || isPerfectImage(map);
+}
+
+
+
+/*******************************************************************************
+ * Static functions
+ ******************************************************************************/
+
+#if defined(HASH_DICTIONARY) || defined(SORTED_DICTIONARY)
+/******************************************************************************
+ * compileSets
+ *
+ * @param Dictionary *dictionary dictionary to save
+ * @param const char *path image file to create
+ *
+ * Only the open-addressing sets can be saved
+ */
+static int compileSets(Dictionary *dictionary, const char *path)
+{
+    printf("ERROR: Can't write %s: images need the open-addressing dictionary "
+           "(build without HASH_DICTIONARY and SORTED_DICTIONARY, or use --backend perfect)\n", path);
+    return NOK;
+}
+
+/******************************************************************************
+ * loadSets
+ *
+ * @param Dictionary *dictionary initialized dictionary, with the image mapped
+ *
+ * Only the open-addressing sets can be loaded
+ */
+static int loadSets(Dictionary *dictionary)
+{
+    printf("ERROR: Dictionary images need the open-addressing dictionary "
+           "(build without HASH_DICTIONARY and SORTED_DICTIONARY)\n");
+    return NOK;
+}
+#else
+/******************************************************************************
+ * compileSets
+ *
+ * @param Dictionary *dictionary dictionary built from text, sets filled
+ * @param const char *path image file to create
+ *
+ * Write the sets as they are, slot words become offsets in the image, the
+ * words go after all the sets
+ */
+static int compileSets(Dictionary *dictionary, const char *path)
+{
+    int rc = OK;
+    size_t size = alignImage(sizeof(ImageHeader)), pool = 0;
+    ImageHeader *header = NULL;
+    char *image = NULL;
+
+    // First pass: sets are copied as they are, words go after all of them
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        DictionaryElement *element = &dictionary->letters[index];
+
+        if (element->slots != NULL)
+        {
+            size = alignImage(size + (element->mask + 1) * sizeof(WordElement));
+            for (unsigned int slot = 0; slot <= element->mask; slot++)
+            {
+                pool += (element->slots[slot].word != 0) ? element->slots[slot].length + 1 : 0;
+            }
+        }
+    }
+
+    if ((image = (char *)calloc(1, size + pool)) == NULL)
+    {
+        printf("ERROR: Image out of memory. Aborting.\n");
+        return NOK;
+    }
+
+    header = (ImageHeader *)image;
+    memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+    header->version = IMAGE_VERSION;
+    header->header_size = sizeof(ImageHeader);
+    header->slot_size = sizeof(WordElement);
+    header->byte_order = IMAGE_BYTE_ORDER;
+    header->size = size + pool;
+
+    // Second pass: copy sets and words, slot words become offsets
+    pool = size;
+    size = alignImage(sizeof(ImageHeader));
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        DictionaryElement *element = &dictionary->letters[index];
+
+        if (element->slots != NULL)
+        {
+            WordElement *slots = (WordElement *)(image + size);
+
+            header->letters[index].slots = size;
+            header->letters[index].mask = element->mask;
+            header->letters[index].words = element->words;
+
+            for (unsigned int slot = 0; slot <= element->mask; slot++)
+            {
+                slots[slot] = element->slots[slot];
+                if (slots[slot].word != 0)
+                {
+                    memcpy(image + pool, SLOT_WORD(dictionary, &element->slots[slot]), slots[slot].length);
+                    slots[slot].word = pool;
+                    pool += slots[slot].length + 1;
+                }
+            }
+            size = alignImage(size + (element->mask + 1) * sizeof(WordElement));
+        }
+    }
+
+    header->body_checksum = checksum(image + sizeof(ImageHeader), header->size - sizeof(ImageHeader));
+    header->header_checksum = checksum(header, offsetof(ImageHeader, header_checksum));
+
+    rc = writeImage(image, header->size, path);
+
+    free(image);
+    return rc;
+}
+
+/******************************************************************************
+ * loadSets
+ *
+ * @param Dictionary *dictionary initialized dictionary, with the image mapped
+ *
+ * Check the header of a sets image and point the letters to its sets
+ */
+static int loadSets(Dictionary *dictionary)
+{
+    const ImageHeader *header = NULL;
+    size_t size = 0;
+
+    header = (const ImageHeader *)dictionary->map.data;
+    size = dictionary->map.size;
+
+    if (size < sizeof(ImageHeader) || !isDictionaryImage(&dictionary->map) ||
+        header->header_checksum != checksum(header, offsetof(ImageHeader, header_checksum)))
+    {
+        printf("ERROR: Dictionary image is corrupted\n");
+        return NOK;
+    }
+    if (header->version != IMAGE_VERSION || header->header_size != sizeof(ImageHeader) ||
+        header->slot_size != sizeof(WordElement) || header->byte_order != IMAGE_BYTE_ORDER)
+    {
+        printf("ERROR: Dictionary image version %u not supported by this build, "
+               "compile it again\n", (unsigned int)header->version);
+        return NOK;
+    }
+    if (header->size != size)
+    {
+        printf("ERROR: Dictionary image is truncated\n");
+        return NOK;
+    }
+
+    // Make sure every set is inside the image before using it
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        const ImageLetter *letter = &header->letters[index];
+
+        if (letter->slots != 0 &&
+            (letter->slots % IMAGE_ALIGN != 0 || letter->slots > size ||
+             ((uint64_t)letter->mask + 1) * sizeof(WordElement) > size - letter->slots ||
+             ((letter->mask + 1) & letter->mask) != 0))
+        {
+            printf("ERROR: Dictionary image is corrupted\n");
+            return NOK;
+        }
+    }
+
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        const ImageLetter *letter = &header->letters[index];
+        DictionaryElement *element = &dictionary->letters[index];
+
+        element->slots = (letter->slots != 0) ? (WordElement *)(dictionary->map.data + letter->slots) : NULL;
+        element->mask = letter->mask;
+        element->words = letter->words;
+    }
+
+    // Access will be random from now on, start reading it in background
+    madvise(dictionary->map.data, size, MADV_WILLNEED);
+
+    dictionary->base = (uintptr_t)dictionary->map.data;
+    dictionary->image = 1;
+    if (dictionary->backend != DICTIONARY_SETS)
+    {
+        printf("WARNING: Dictionary image holds sets, %s not used\n",
+               (dictionary->backend == DICTIONARY_GRAPH) ? "word graph" : "perfect hash");
+        dictionary->backend = DICTIONARY_SETS;
+    }
+
+    return OK;
+}
+#endif
+
+/******************************************************************************
+ * compilePerfect
+ *
+ * @param Dictionary *dictionary dictionary with the perfect hash built
+ * @param const char *path image file to create
+ *
+ * Write the arrays and the pool of the perfect hash as they are, they only
+ * hold offsets
+ */
+static int compilePerfect(Dictionary *dictionary, const char *path)
+{
+    const PerfectHash *perfect = &dictionary->perfect;
+    size_t pilots = alignImage(sizeof(PerfectImageHeader));
+    size_t offsets = alignImage(pilots + perfect->buckets * sizeof(uint32_t));
+    size_t pool = alignImage(offsets + perfect->count * sizeof(uint32_t));
+    PerfectImageHeader *header = NULL;
+    char *image = NULL;
+    int rc = OK;
+
+    // The pool is padded like in memory, calloc zeroes the pad
+    if ((image = (char *)calloc(1, pool + perfect->pool_size + PERFECT_PAD)) == NULL)
+    {
+        printf("ERROR: Image out of memory. Aborting.\n");
+        return NOK;
+    }
+
+    header = (PerfectImageHeader *)image;
+    memcpy(header->magic, PERFECT_IMAGE_MAGIC, sizeof(header->magic));
+    header->version = PERFECT_IMAGE_VERSION;
+    header->header_size = sizeof(PerfectImageHeader);
+    header->byte_order = IMAGE_BYTE_ORDER;
+    header->count = perfect->count;
+    header->buckets = perfect->buckets;
+    header->seed = perfect->seed;
+    header->size = pool + perfect->pool_size + PERFECT_PAD;
+    header->pilots = pilots;
+    header->offsets = offsets;
+    header->pool = pool;
+    header->pool_size = perfect->pool_size;
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        header->words[index] = dictionary->letters[index].words;
+    }
+
+    // No hash at all for a dictionary without words
+    if (perfect->count != 0)
+    {
+        memcpy(image + pilots, perfect->pilots, perfect->buckets * sizeof(uint32_t));
+        memcpy(image + offsets, perfect->offsets, perfect->count * sizeof(uint32_t));
+        memcpy(image + pool, perfect->pool, perfect->pool_size);
+    }
+
+    header->body_checksum = checksum(image + sizeof(PerfectImageHeader), header->size - sizeof(PerfectImageHeader));
+    header->header_checksum = checksum(header, offsetof(PerfectImageHeader, header_checksum));
+
+    rc = writeImage(image, header->size, path);
+
+    free(image);
+    return rc;
+}
+
+/******************************************************************************
+ * loadPerfect
+ *
+ * @param Dictionary *dictionary initialized dictionary, with the image mapped
+ *
+ * Check the header of a perfect hash image and point the hash to its arrays,
+ * the backend becomes DICTIONARY_PERFECT
+ */
+static int loadPerfect(Dictionary *dictionary)
+{
+    const PerfectImageHeader *header = (const PerfectImageHeader *)dictionary->map.data;
+    size_t size = dictionary->map.size;
+    PerfectHash *perfect = &dictionary->perfect;
+
+    if (size < sizeof(PerfectImageHeader) ||
+        header->header_checksum != checksum(header, offsetof(PerfectImageHeader, header_checksum)))
+    {
+        printf("ERROR: Dictionary image is corrupted\n");
+        return NOK;
+    }
+    if (header->version != PERFECT_IMAGE_VERSION || header->header_size != sizeof(PerfectImageHeader) ||
+        header->byte_order != IMAGE_BYTE_ORDER)
+    {
+        printf("ERROR: Dictionary image version %u not supported by this build, "
+               "compile it again\n", (unsigned int)header->version);
+        return NOK;
+    }
+    if (header->size != size)
+    {
+        printf("ERROR: Dictionary image is truncated\n");
+        return NOK;
+    }
+    // Arrays inside the image, the pool ends with a word and its pad
+    if (header->count != 0 &&
+        (header->buckets == 0 ||
+         header->pilots % IMAGE_ALIGN != 0 || header->pilots > size ||
+         (uint64_t)header->buckets * sizeof(uint32_t) > size - header->pilots ||
+         header->offsets % IMAGE_ALIGN != 0 || header->offsets > size ||
+         (uint64_t)header->count * sizeof(uint32_t) > size - header->offsets ||
+         header->pool > size || header->pool_size < 2 || header->pool_size > UINT32_MAX ||
+         header->pool_size + PERFECT_PAD > size - header->pool || dictionary->map.data[header->pool + header->pool_size - 1] != 0))
+    {
+        printf("ERROR: Dictionary image is corrupted\n");
+        return NOK;
+    }
+
+    perfect->count = header->count;
+    perfect->buckets = header->buckets;
+    perfect->seed = header->seed;
+    perfect->pilots = (const uint32_t *)(dictionary->map.data + header->pilots);
+    perfect->offsets = (const uint32_t *)(dictionary->map.data + header->offsets);
+    perfect->pool = dictionary->map.data + header->pool;
+    perfect->pool_size = header->pool_size;
+    // Nothing to free, the arrays are the mapping
+    perfect->memory = NULL;
+    perfect->size = 0;
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        dictionary->letters[index].words = header->words[index];
+    }
+
+    // Access will be random from now on, start reading it in background
+    madvise(dictionary->map.data, size, MADV_WILLNEED);
+
+    dictionary->base = (uintptr_t)dictionary->map.data;
+    dictionary->image = 1;
+    if (dictionary->backend == DICTIONARY_GRAPH)
+    {
+        printf("WARNING: Dictionary image holds a perfect hash, word graph not used\n");
+    }
+    dictionary->backend = DICTIONARY_PERFECT;
+
+    return OK;
+}
+
+/******************************************************************************
+ * isPerfectImage
+ *
+ * @param const FileMap *map mapped dictionary file
+ *
+ * 1 if the file starts with the magic of a perfect hash image
+ */
+static int isPerfectImage(const FileMap *map)
+{
+    return (map->data != NULL && map->size >= sizeof(PERFECT_IMAGE_MAGIC) - 1 &&
+            memcmp(map->data, PERFECT_IMAGE_MAGIC, sizeof(PERFECT_IMAGE_MAGIC) - 1) == 0);
+}
+
+/******************************************************************************
+ * writeImage
+ *
+ * @param const char *image image in memory
+ * @param size_t size bytes of the image
+ * @param const char *path image file to create
+ *
+ * Write the image in its file
+ */
+static int writeImage(const char *image, size_t size, const char *path)
+{
+    FILE *image_fd = NULL;
+    int rc = OK;
+
+    if ((image_fd = fopen(path, "w")) != NULL)
+    {
+        if (fwrite(image, size, 1, image_fd) != 1)
+        {
+            rc = NOK;
+            printf("ERROR: Can't write image %s: errno %d\n", path, errno);
+        }
+        if (fclose(image_fd) != 0)
+        {
+            rc = NOK;
+            printf("ERROR: Can't close image %s: errno %d\n", path, errno);
+        }
+    }
+    else
+    {
+        rc = NOK;
+        printf("ERROR: Can't create image %s: errno %d\n", path, errno);
+    }
+    return rc;
+}
+
+/******************************************************************************
+ * alignImage
+ *
+ * @param size_t offset offset in the image
+ *
+ * Round an offset up to the next IMAGE_ALIGN boundary
+ */
+static inline size_t alignImage(size_t offset)
+{
+    return (offset + IMAGE_ALIGN - 1) & ~(size_t)(IMAGE_ALIGN - 1);
+}
@@ -0,0 +1,150 @@
+#ifndef _DICT_IMAGE_H
+#define _DICT_IMAGE_H
+
+#include <stdint.h>
+
+#include "dictionary.h"
+#include "file_map.h"
+
+/*******************************************************************************
+ * DICTIONARY IMAGE - Precompiled dictionary
+ *
+ * "spellcheck --compile-dict dict.txt -o dict.bin" dumps the hash sets built
+ * from a text dictionary in a binary file. Given to the checker instead of the
+ * text file, the image is mapped and used as it is: no parsing, no folding,
+ * no allocation, so the startup does not depend on the dictionary size.
+ *
+ * Slots in the image hold offsets from the image start (Dictionary.base is
+ * the mapping), so the image is relocatable.
+ *
+ *   +----------------+  ImageHeader: magic, version, layout checks, size,
+ *   |header          |  checksums and where the set of every letter is
+ *   +----------------+
+ *   |set a (slots)   |  WordElement[mask+1], exactly as in memory
+ *   |set b (slots)   |
+ *   |...             |
+ *   +----------------+
+ *   |words           |  folded words, NULL terminated
+ *   +----------------+
+ *
+ * The image is tied to the build that wrote it: slot size and byte order are
+ * checked when loading. Only the open-addressing dictionary can be saved, the
+ * HASH_DICTIONARY chains are plain pointers and the SORTED_DICTIONARY arrays
+ * are not written.
+ *
+ * Perfect hash image
+ *
+ * With --backend perfect the image holds the minimal perfect hash of the
+ * words (see perfect_hash.h) instead of the sets. Its arrays only hold
+ * offsets, so any build can write and use it:
+ *
+ *   +----------------+  PerfectImageHeader: magic, version, byte order,
+ *   |header          |  size, checksums, seed, where the arrays are, words
+ *   +----------------+  of every letter
+ *   |pilots          |  uint32_t[buckets]
+ *   |offsets         |  uint32_t[count]
+ *   +----------------+
+ *   |pool            |  length byte, folded word, NULL, word after word
+ *   +----------------+
+ *
+ ******************************************************************************/
+
+#define IMAGE_MAGIC         "SPCHKDIC"  // First 8 bytes of every image
+#define IMAGE_VERSION       1           // Bump on every layout change
+#define IMAGE_BYTE_ORDER    0x01020304  // Written native, read back to check
+#define PERFECT_IMAGE_MAGIC "SPCHKMPH"  // First 8 bytes of a perfect hash image
+#define PERFECT_IMAGE_VERSION 2         // Bump on every layout change
+
+typedef struct {
+    uint64_t        slots;              // Offset of the set, 0 if no words
+    uint32_t        mask;               // Set size - 1
+    uint32_t        words;              // Words in the set
+}ImageLetter;
+
+typedef struct {
+    char            magic[8];           // IMAGE_MAGIC, not NULL terminated
+    uint32_t        version;            // IMAGE_VERSION
+    uint32_t        header_size;        // sizeof(ImageHeader)
+    uint32_t        slot_size;          // sizeof(WordElement)
+    uint32_t        byte_order;         // IMAGE_BYTE_ORDER
+    uint64_t        size;               // Size of the whole image
+    uint64_t        body_checksum;      // Checksum of what follows the header
+    ImageLetter     letters[ALPHABET_SIZE];
+    uint64_t        header_checksum;    // Checksum of the fields above
+}ImageHeader;
+
+typedef struct {
+    char            magic[8];           // PERFECT_IMAGE_MAGIC
+    uint32_t        version;            // PERFECT_IMAGE_VERSION
+    uint32_t        header_size;        // sizeof(PerfectImageHeader)
+    uint32_t        byte_order;         // IMAGE_BYTE_ORDER
+    uint32_t        count;              // Words (and slots), 0 if none
+    uint32_t        buckets;            // Buckets (and pilots)
+    uint32_t        reserved;           // 0
+    uint64_t        seed;               // Seed of perfectKey
+    uint64_t        size;               // Size of the whole image
+    uint64_t        body_checksum;      // Checksum of what follows the header
+    uint64_t        pilots;             // Offset of the pilots
+    uint64_t        offsets;            // Offset of the offsets
+    uint64_t        pool;               // Offset of the pool
+    uint64_t        pool_size;          // Bytes of the pool
+    uint32_t        words[ALPHABET_SIZE]; // Words of every letter
+    uint64_t        header_checksum;    // Checksum of the fields above
+}PerfectImageHeader;
+
+
+/*
+ * compileDictionaryImage
+ *
+ * Write the hash sets of a dictionary (built from text) in an image file,
+ * or its perfect hash with the DICTIONARY_PERFECT backend
+ *
+ * @param Dictionary * dictionary dictionary to save
+ * @param const char * path image file to create
+ * @return OK or NOK
+ *
+ */
+int compileDictionaryImage(Dictionary *dictionary, const char *path);
+
+
+/*
+ * isDictionaryImage
+ *
+ * Tell if a mapped file is a dictionary image, of sets or perfect hash
+ * (magic check only)
+ *
+ * @param const FileMap * map mapped dictionary file
+ * @return 1 if it looks like an image, 0 otherwise
+ *
+ */
+int isDictionaryImage(const FileMap *map);
+
+
+/*
+ * loadDictionaryImage
+ *
+ * Validate the header of the image mapped in dictionary->map and point the
+ * letters to the sets in the mapping (or the perfect hash to its arrays, the
+ * backend becomes DICTIONARY_PERFECT). This costs the same whatever the size
+ * of the dictionary: the body is not read (see verifyDictionaryImage)
+ *
+ * @param Dictionary * dictionary initialized dictionary, with the image mapped
+ * @return OK or NOK
+ *
+ */
+int loadDictionaryImage(Dictionary *dictionary);
+
+
+/*
+ * verifyDictionaryImage
+ *
+ * Check the body checksum of a loaded image. This reads the whole image, so
+ * it is only done on request (--verify)
+ *
+ * @param Dictionary * dictionary dictionary loaded from an image
+ * @return OK or NOK
+ *
+ */
+int verifyDictionaryImage(Dictionary *dictionary);
+
+#endif // _DICT_IMAGE_H
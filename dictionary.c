@@ -1,3 +1,5 @@
+
+
 // System include
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -6,44 +8,257 @@
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
+#include <sys/stat.h>
+#include <stddef.h>
 
 
 // Project include
 #include "spellcheck.h"
 #include "dictionary.h"
+#include "case_fold.h"
+#include "stats.h"
 #include "parse_text.h"
+#include "dict_image.h"
+#include "thread_pool.h"
+
+#define MIN_TABLE_SIZE  16  // Initial size of a letter hash set
+#define MIN_BUILD_CHUNK (64 * 1024) // Smallest piece of a parallel build
+#define PREFIX_SIZE     8   // Bytes of a word kept in SortedWord.prefix
+#define CACHE_LINE      64  // Alignment of the sorted arrays
+#define CACHE_ENTRIES   4096 // Words in a verdict cache, a power of two
+#define CACHE_WORD      30  // Longest word cached
+#define NO_LETTER       0xFF // Letter of a batch word already answered
+
+// A word found while scanning a chunk of the dictionary
+typedef struct {
+    const char      *word;      // Word (folded view in the mapping)
+    unsigned long   hash;       // hashWord of the word
+    size_t          length;     // Length of the word
+}WordRef;
+
+typedef struct {
+    WordRef         *words;
+    unsigned int    count;
+    unsigned int    size;
+}WordList;
+
+// A piece of the dictionary file scanned by one worker
+typedef struct {
+    char            *text;      // First byte of the chunk (start of a line)
+    size_t          size;       // Bytes in the chunk
+    WordList        letters[ALPHABET_SIZE]; // Words found, in file order
+    WordList        discarded;  // Lines to warn about, in file order
+    int             rc;         // OK or NOK if out of memory
+}DictionaryChunk;
+
+// Shared state of a parallel build
+typedef struct {
+    Dictionary      *dictionary;
+    DictionaryChunk *chunks;
+    unsigned int    count;      // Number of chunks
+    unsigned int    next_scan;  // Next chunk to scan
+    unsigned int    next_letter;// Next letter to fill (index in order)
+    unsigned char   order[ALPHABET_SIZE]; // Letters, biggest first
+    Arena           arenas[ALPHABET_SIZE]; // Nodes of every letter
+    int             rc[ALPHABET_SIZE];     // Result of every letter
+}ParallelBuild;
+
+#ifdef SORTED_DICTIONARY
+// Shared state of the sort of the letters
+typedef struct {
+    Dictionary      *dictionary;
+    unsigned int    next;       // Next letter to sort
+    Arena           arenas[ALPHABET_SIZE]; // Arrays and pool of every letter
+    int             rc[ALPHABET_SIZE];     // Result of every letter
+}SortJob;
+
+// A letter being laid out in Eytzinger order
+typedef struct {
+    WordElement     **order;    // Slots, in word order
+    unsigned int    next;       // Next slot of order to place
+    unsigned int    count;      // Words
+    SortedWord      *sorted;    // Array being filled
+    char            *pool;      // Words being copied
+    uint32_t        used;       // Bytes of the pool used
+}SortLayout;
+#endif
+
+// A word looked up lately and its verdict, 32 bytes
+typedef struct {
+    unsigned char   length;     // Word length, 0 if empty
+    unsigned char   found;      // 1 if in the dictionary
+    char            word[CACHE_WORD];   // Folded word
+}CacheEntry;
+
+// Verdicts of the words looked up lately by a thread, direct mapped: a word
+// can only be in one entry, a new word there replaces the old one
+typedef struct {
+    unsigned long   dictionary; // id of the dictionary of the verdicts
+    CacheEntry      entries[CACHE_ENTRIES];
+}VerdictCache;
+
+static unsigned long dictionaryIds;        // Last id given to a dictionary
+static __thread VerdictCache verdictCache; // Verdicts of the calling thread
+
+// Static function declarations
+static int buildParallel(Dictionary *dictionary, unsigned int threads);
+static void *scanWorker(void *arg);
+static void *fillWorker(void *arg);
+static int appendWord(WordList *list, const char *word, size_t length, unsigned long hash);
+static int addLine(Dictionary *dictionary, char *line, size_t length, int view);
+static int lineLetter(char *line, size_t length, int view);
+static inline size_t trimLine(const char *line, size_t length);
+static int insertWord(DictionaryElement *element, Arena *arena, const char *word, size_t length, unsigned long hash, int view);
+static int growTable(DictionaryElement *element);
+static inline unsigned int slotIndex(unsigned long hash, unsigned int mask);
+static int lookupLayer(Dictionary *dictionary, const char *word, size_t length);
+static void lookupLayerBatch(Dictionary *dictionary, const char *const *words, const unsigned int *lengths,
+                             unsigned int count, unsigned char *found);
+#ifdef HASH_DICTIONARY
+static inline int probeChain(Dictionary *dictionary, unsigned char index, unsigned long hash,
+                             const WordElement *local, const char *word, size_t length);
+#elif !defined(SORTED_DICTIONARY)
+static inline int probeSlots(Dictionary *dictionary, unsigned char index, unsigned int hash, unsigned int slot,
+                             const char *word, size_t length);
+#endif
+static int buildGraph(Dictionary *dictionary);
+static int gatherWords(Dictionary *dictionary, WordList *list);
+static void releaseSets(Dictionary *dictionary);
+static inline int lookupReleased(Dictionary *dictionary, unsigned char index, const char *word, size_t length);
+static int lookupGraph(Dictionary *dictionary, unsigned char index, const char *word, size_t length);
+static int buildPerfect(Dictionary *dictionary);
+static int lookupPerfect(Dictionary *dictionary, unsigned char index, const char *word, size_t length);
+static void lookupPerfectBatch(Dictionary *dictionary, const char *const *words, const unsigned int *lengths,
+                               unsigned int count, unsigned char *found);
+static int compareRefs(const void *left, const void *right);
+static int buildFilter(Dictionary *dictionary);
+static inline int filterRejects(Dictionary *dictionary, unsigned char index, unsigned long hash);
+static size_t dictionaryMemory(const Dictionary *dictionary);
+static uint64_t fingerprintWords(const Dictionary *dictionary);
+static unsigned int suggestLayers(Dictionary *dictionary, const char *word, size_t length, GraphMatches *matches);
+static int compareMatches(unsigned int distance, const char *match, unsigned int other_distance, const char *other,
+                          size_t length);
+#ifdef SORTED_DICTIONARY
+static int sortDictionary(Dictionary *dictionary, unsigned int threads);
+static void *sortWorker(void *arg);
+static int sortLetter(DictionaryElement *element, Arena *arena);
+static void layoutLetter(SortLayout *layout, unsigned int node);
+static int compareSlots(const void *left, const void *right);
+static inline uint64_t wordPrefix(const char *word, size_t length);
+static inline int compareTail(const char *stored, size_t stored_length, const char *word, size_t length);
+#endif
+static inline CacheEntry *cacheEntry(VerdictCache *cache, const char *folded, size_t length);
 
-int initializeDictionary(DictionaryElement *dictionary)
+int initializeDictionary(Dictionary *dictionary)
 {
     int rc = OK;
     unsigned char letter = 0;
-    
+
     // Should never happen....
     assert(dictionary != NULL);
-    
+
     for( ; letter < ALPHABET_SIZE; letter++ )
     {
-        dictionary[letter].initial = letter+97;
-        dictionary[letter].first = NULL;
+        DictionaryElement *element = &dictionary->letters[letter];
+
+        element->initial = letter+97;
+        element->words = 0;
+        element->mask = 0;
+        element->duplicates = 0;
+#ifdef HASH_DICTIONARY
+        element->buckets = NULL;
+#else
+        element->slots = NULL;
+#endif
+#ifdef SORTED_DICTIONARY
+        element->sorted = NULL;
+        element->pool = NULL;
+#endif
     }
-    
+
+    dictionary->base = 0;
+    dictionary->duplicates = 0;
+    dictionary->image = 0;
+    dictionary->map.data = NULL;
+    dictionary->map.size = 0;
+    dictionary->backend = DICTIONARY_SETS;
+    dictionary->suggest = 0;
+    dictionary->filter = 0;
+    dictionary->copy = 0;
+    dictionary->below = NULL;
+    dictionary->exclude = 0;
+    dictionary->id = 0;
+    dictionary->version = 0;
+    dictionary->bloom.blocks = NULL;
+    dictionary->bloom.count = 0;
+    dictionary->bloom.keys = 0;
+    dictionary->perfect.count = 0;
+    dictionary->perfect.memory = NULL;
+    dictionary->perfect.size = 0;
+    graphInitialize(&dictionary->graph);
+    rc = arenaInitialize(&dictionary->arena, 0);
+
     return rc;
 }
 
-int populateDictionary( FILE *dict_fd, DictionaryElement *dictionary)
+int populateDictionary( FILE *dict_fd, Dictionary *dictionary, unsigned int threads)
 {
     int rc = OK;
-    
+
     // Should never happen....
     assert(dictionary != NULL);
-    
-    if (dict_fd != NULL)
+
+    dictionary->id = __atomic_add_fetch(&dictionaryIds, 1, __ATOMIC_RELAXED);
+    if (dict_fd != NULL &&
+        (dictionary->copy ? copyFile(dict_fd, &dictionary->map) : mapFile(dict_fd, &dictionary->map, 1)) == OK &&
+        isDictionaryImage(&dictionary->map))
+    {
+        // Precompiled, nothing to parse
+        rc = loadDictionaryImage(dictionary);
+    }
+    else if (dictionary->map.data != NULL && threads > 1 &&
+             dictionary->map.size >= 2 * MIN_BUILD_CHUNK)
+    {
+        rc = buildParallel(dictionary, threads);
+    }
+    else if (dictionary->map.data != NULL)
+    {
+        char *line = dictionary->map.data;
+        char *end = line + dictionary->map.size;
+
+        // Words stay in the mapping: we only point to them
+        while ((rc == OK) && line < end)
+        {
+            char *newline = (char *)memchr(line, '\n', end - line);
+
+            if (newline == NULL)
+            {
+                newline = end;
+            }
+            // If string is only endline, we just continue
+            if (trimLine(line, newline - line) != 0)
+            {
+                rc = addLine(dictionary, line, trimLine(line, newline - line), 1);
+            }
+            line = newline + 1;
+        }
+    }
+    else if (dict_fd != NULL)
     {
         char *token = NULL;
         ssize_t len = 0;
         size_t size = 0;
+        struct stat info;
+
+        // Words take at most the bytes of the file (endline becomes the
+        // terminator), so a block as big as the file is usually enough
+        if (fstat(fileno(dict_fd), &info) == 0 && S_ISREG(info.st_mode) &&
+            (size_t)info.st_size > dictionary->arena.block_size)
+        {
+            dictionary->arena.block_size = info.st_size;
+        }
 
-        while((len = getline(&token, &size, dict_fd)) != -1)
+        while((rc == OK) && (len = getline(&token, &size, dict_fd)) != -1)
         {
             // Removing endline, we don't like or need it
             // If string is only endline, we just continue
@@ -51,145 +266,2108 @@ int populateDictionary( FILE *dict_fd, DictionaryElement *dictionary)
             {
                 strtok(token, "\n");
 
-                // Accept only alphabetic characters, remember
-                if (isalpha(token[0]))
-                {
-                    // Convert first letter to array index
-                    unsigned char index = tolower(token[0])-97;
-
-                    // We check that we have a valid letter for starting (Aa-Zz)
-                    // before accessing dictionary array
-                    if (index >= 0 && index < ALPHABET_SIZE)
-                    {
-
-                        if (dictionary[index].first == NULL)
-                        {
-                            dictionary[index].first = (WordElement *)malloc(sizeof(WordElement));
-                            if (dictionary[index].first != NULL)
-                            {
-                                dictionary[index].last_add = dictionary[index].first;
+                // The set copies the word in the arena, so the getline
+                // buffer can be reused for the next line
+                size_t length = trimLine(token, strlen(token));
 
-                                // Getline will allocate the memory for us and strtok
-                                // will remove the newline, so the string should be ok
-#ifdef HASH_DICTIONARY
-                                dictionary[index].first->word = hashWord(token);
-#else                                
-                                dictionary[index].first->word = token;
-#endif
-                                dictionary[index].first->length = strlen(token);
-                                dictionary[index].first->next = NULL;
-                                //printf("Word read %s\n", token);
-                            }
-                            else
-                            {
-                                rc = NOK;
-                                printf("ERROR: Dictionary out of memory. Aborting.\n");
-                            }
-                        }
-                        else
-                        {
-                            // Using the last_add pointer we can jump on last element
-                            // without need of scanning the whole list that, in a 
-                            // real world scenario, can become quite big.
-                            // This is important since the dictionary could well
-                            // be not in alphabetic order
-                            WordElement *element = dictionary[index].last_add;
-
-                            element->next = (WordElement *)malloc(sizeof(WordElement));
-                            if (element->next != NULL)
-                            {
-                                // Token should be fine now
-#ifdef HASH_DICTIONARY
-                                element->next->word = hashWord(token);
-#else                                
-                                element->next->word = token;
-#endif
-                                element->next->length = strlen(token);
-
-                                element->next->next = NULL;
-                                dictionary[index].last_add = element->next;
-                                //printf("Word read %s\n", token);
-                            }
-                            else
-                            {
-                                rc = NOK;
-                                printf("ERROR: Dictionary out of memory. Aborting.\n");
-                            }
-                        }
-                    }
-                }
-                else
+                if (length != 0)
                 {
-                    printf("WARNING: dictionary discarded [%s], but continuing.\n", token);
+                    rc = addLine(dictionary, token, length, 0);
                 }
             }
-            // This will make sure getline will allocate buffer for us
-            token = NULL;
         }
+        free(token);
     }
     else
     {
         rc = NOK;
     }
-        
+
+    // An image waits for dictionaryVersion, its words are not read now
+    if (rc == OK && !dictionary->image)
+    {
+        dictionary->version = fingerprintWords(dictionary);
+    }
+    // From the sets (or the perfect hash of an image), before they are
+    // released or sorted
+    if (rc == OK && dictionary->filter != 0)
+    {
+        rc = buildFilter(dictionary);
+    }
+    if (rc == OK && (dictionary->backend == DICTIONARY_GRAPH || dictionary->suggest != 0))
+    {
+        rc = buildGraph(dictionary);
+    }
+    if (rc == OK && dictionary->backend == DICTIONARY_PERFECT && !dictionary->image)
+    {
+        rc = buildPerfect(dictionary);
+    }
+#ifdef SORTED_DICTIONARY
+    // Normalization: the sets dropped the duplicates, now sort them
+    if (rc == OK && !dictionary->image && dictionary->backend == DICTIONARY_SETS)
+    {
+        rc = sortDictionary(dictionary, threads);
+    }
+#endif
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        dictionary->duplicates += dictionary->letters[index].duplicates;
+        STATS_ADD(words, dictionary->letters[index].words);
+    }
+    STATS_ADD(duplicates, dictionary->duplicates);
+    STATS_ADD(memory, dictionaryMemory(dictionary));
+
     return rc;
 }
 
-void deallocateDictionary(DictionaryElement *dictionary)
+#ifdef HASH_DICTIONARY
+void deallocateDictionary(Dictionary *dictionary)
 {
     assert(dictionary != NULL);
 
     for (int index = 0; index < ALPHABET_SIZE; index++)
     {
-        WordElement *local = dictionary[index].first;
+        free(dictionary->letters[index].buckets);
+        dictionary->letters[index].buckets = NULL;
+        dictionary->letters[index].words = 0;
+    }
+    // Nodes and words are all in the arena (or in the mapping)
+    arenaRelease(&dictionary->arena);
+    unmapFile(&dictionary->map);
+    graphRelease(&dictionary->graph);
+    bloomRelease(&dictionary->bloom);
+    perfectRelease(&dictionary->perfect);
+}
 
-        while (local != NULL)
+void parseDictionary(Dictionary *dictionary)
+{
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        WordElement **buckets = dictionary->letters[index].buckets;
+
+        printf("DUMPING LETTER %c ### \n", dictionary->letters[index].initial);
+        sleep(1);
+
+        for (unsigned int bucket = 0; buckets != NULL && bucket <= dictionary->letters[index].mask; bucket++)
         {
-            WordElement *delete = local;
-            local = local->next;
-            //printf("Deleted %s\n", delete->word);
-#ifndef  HASH_DICTIONARY
-            free(delete->word);
-#endif
-            free(delete);
+            for (WordElement *local = buckets[bucket]; local != NULL; local = local->next)
+            {
+                printf("%.*s (hash 0x%lX)\n", (int)local->length, local->word, local->hash);
+            }
+        }
+    }
+    arenaReport(&dictionary->arena, "dictionary");
+}
+
+/******************************************************************************
+ * lookupLayer
+ *
+ * @param Dictionary *dictionary layer to search
+ * @param const char *word word to search, any case
+ * @param size_t length length of the word
+ *
+ * lookupWord in one layer, without the layers below, on the chained buckets (HASH_DICTIONARY)
+ */
+static int lookupLayer(Dictionary *dictionary, const char *word, size_t length)
+{
+    unsigned char index = tolower(word[0])-97;
+    DictionaryElement *element = &dictionary->letters[index];
+    unsigned long hash = 0;
+
+    if (element->buckets == NULL)
+    {
+        // Buckets are gone when the words are in the graph (or perfect hash)
+        return lookupReleased(dictionary, index, word, length);
+    }
+
+
+    hash = hashWord(word, length);
+    if (filterRejects(dictionary, index, hash))
+    {
+        return 0;
+    }
+    return probeChain(dictionary, index, hash, element->buckets[slotIndex(hash, element->mask)], word, length);
+}
+
+/******************************************************************************
+ * lookupLayerBatch
+ *
+ * @param Dictionary *dictionary layer to search
+ * @param const char *const *words words to search, any case
+ * @param const unsigned int *lengths length of every word
+ * @param unsigned int count number of words, at most LOOKUP_BATCH
+ * @param unsigned char *found filled with 1 for every word in the layer
+ *
+ * lookupBatch in one layer, without the layers below, on the chained buckets (HASH_DICTIONARY)
+ */
+static void lookupLayerBatch(Dictionary *dictionary, const char *const *words, const unsigned int *lengths,
+                             unsigned int count, unsigned char *found)
+{
+    unsigned long hashes[LOOKUP_BATCH];
+    WordElement **heads[LOOKUP_BATCH];
+    unsigned char letters[LOOKUP_BATCH];
+
+    assert(count <= LOOKUP_BATCH);
+
+    if (dictionary->perfect.count != 0)
+    {
+        lookupPerfectBatch(dictionary, words, lengths, count, found);
+        return;
+    }
+    // Hash all the words and ask for their bucket heads at once
+    for (unsigned int word = 0; word < count; word++)
+    {
+        unsigned char index = tolower(words[word][0])-97;
+        DictionaryElement *element = &dictionary->letters[index];
+
+        found[word] = 0;
+        letters[word] = NO_LETTER;
+        if (element->buckets == NULL)
+        {
+            found[word] = (unsigned char)lookupReleased(dictionary, index, words[word], lengths[word]);
+            continue;
+        }
+        hashes[word] = hashWord(words[word], lengths[word]);
+        if (filterRejects(dictionary, index, hashes[word]))
+        {
+            continue;
+        }
+        heads[word] = &element->buckets[slotIndex(hashes[word], element->mask)];
+        letters[word] = index;
+        __builtin_prefetch(heads[word]);
+    }
+    // Then for the first nodes of the chains
+    for (unsigned int word = 0; word < count; word++)
+    {
+        if (letters[word] != NO_LETTER && *heads[word] != NULL)
+        {
+            __builtin_prefetch(*heads[word]);
+        }
+    }
+    // Walk the chains, the heads are there by now
+    for (unsigned int word = 0; word < count; word++)
+    {
+        if (letters[word] != NO_LETTER)
+        {
+            found[word] = probeChain(dictionary, letters[word], hashes[word], *heads[word], words[word],
+                                     lengths[word]);
         }
     }
 }
+#elif defined(SORTED_DICTIONARY)
+void deallocateDictionary(Dictionary *dictionary)
+{
+    assert(dictionary != NULL);
+
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        // Left only if the build failed
+        free(dictionary->letters[index].slots);
+        dictionary->letters[index].slots = NULL;
+        dictionary->letters[index].sorted = NULL;
+        dictionary->letters[index].pool = NULL;
+        dictionary->letters[index].words = 0;
+    }
+    // Arrays and words are all in the arena
+    arenaRelease(&dictionary->arena);
+    unmapFile(&dictionary->map);
+    graphRelease(&dictionary->graph);
+    bloomRelease(&dictionary->bloom);
+    perfectRelease(&dictionary->perfect);
+}
 
-void parseDictionary(DictionaryElement *dictionary)
+void parseDictionary(Dictionary *dictionary)
 {
     for (int index = 0; index < ALPHABET_SIZE; index++)
     {
-        WordElement *local = dictionary[index].first;
+        const char *word = dictionary->letters[index].pool;
 
-        printf("DUMPING LETTER %c ### \n", dictionary[index].initial);
+        printf("DUMPING LETTER %c ### \n", dictionary->letters[index].initial);
         sleep(1);
 
-        while (local != NULL)
+        // The pool is in word order, every word NULL terminated
+        for (unsigned int count = 0; count < dictionary->letters[index].words; count++)
         {
-#ifdef HASH_DICTIONARY
-            printf("Word has 0x%X\n", (unsigned int)local->word);
+            printf("%s\n", word);
+            word += strlen(word) + 1;
+        }
+    }
+    arenaReport(&dictionary->arena, "dictionary");
+}
+
+/******************************************************************************
+ * lookupLayer
+ *
+ * @param Dictionary *dictionary layer to search
+ * @param const char *word word to search, any case
+ * @param size_t length length of the word
+ *
+ * lookupWord in one layer, without the layers below, on the sorted arrays (SORTED_DICTIONARY)
+ */
+static int lookupLayer(Dictionary *dictionary, const char *word, size_t length)
+{
+    unsigned char index = tolower(word[0])-97;
+    DictionaryElement *element = &dictionary->letters[index];
+    const SortedWord *sorted = element->sorted, *local = NULL;
+    uint64_t prefix = 0;
+    unsigned int node = 1, probes = 0;
+
+    if (sorted == NULL)
+    {
+        // Never sorted when the words are in the graph (or perfect hash)
+        return lookupReleased(dictionary, index, word, length);
+    }
+
+    // The sorted arrays don't need the hash, only the filter does
+    if (dictionary->bloom.blocks != NULL && filterRejects(dictionary, index, hashWord(word, length)))
+    {
+        return 0;
+    }
+    prefix = wordPrefix(word, length);
+
+    while (node <= element->words)
+    {
+        local = &sorted[node];
+        // The 4 grandchildren are in one cache line, get it while comparing
+        __builtin_prefetch(&sorted[(4 * node <= element->words) ? 4 * node : 0]);
+        // Go right if the node comes before the word: no branch on the
+        // way down, the tail is compared only when the prefixes match
+        node = 2 * node + (local->prefix < prefix ||
+                           (local->prefix == prefix &&
+                            compareTail(element->pool + local->word, local->length, word, length) < 0));
+        probes++;
+    }
+    // Drop the right turns after the last left one: that node is the first
+    // one not before the word
+    node >>= __builtin_ffs(~node);
+    STATS_LOOKUP(index, probes);
+
+    local = &sorted[node];
+    if (node != 0 && local->prefix == prefix && local->length == length &&
+        compareTail(element->pool + local->word, local->length, word, length) == 0)
+    {
+        return 1;
+    }
+    STATS_ADD(false_positives, dictionary->bloom.blocks != NULL);
+    return 0;
+}
+
+/******************************************************************************
+ * lookupLayerBatch
+ *
+ * @param Dictionary *dictionary layer to search
+ * @param const char *const *words words to search, any case
+ * @param const unsigned int *lengths length of every word
+ * @param unsigned int count number of words, at most LOOKUP_BATCH
+ * @param unsigned char *found filled with 1 for every word in the layer
+ *
+ * lookupBatch in one layer, without the layers below, on the sorted arrays (SORTED_DICTIONARY)
+ */
+static void lookupLayerBatch(Dictionary *dictionary, const char *const *words, const unsigned int *lengths,
+                             unsigned int count, unsigned char *found)
+{
+    assert(count <= LOOKUP_BATCH);
+
+    if (dictionary->perfect.count != 0)
+    {
+        lookupPerfectBatch(dictionary, words, lengths, count, found);
+        return;
+    }
+    // A search already fetches the grandchildren of a node while comparing
+    // it, going down all the trees a level at a time only adds work: one
+    // word after the other
+    for (unsigned int word = 0; word < count; word++)
+    {
+        found[word] = (unsigned char)lookupLayer(dictionary, words[word], lengths[word]);
+    }
+}
 #else
-            printf("%s\n", local->word);
+void deallocateDictionary(Dictionary *dictionary)
+{
+    assert(dictionary != NULL);
+
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        // Sets of an image are part of the mapping
+        if (!dictionary->image)
+        {
+            free(dictionary->letters[index].slots);
+        }
+        dictionary->letters[index].slots = NULL;
+        dictionary->letters[index].words = 0;
+    }
+    dictionary->image = 0;
+    dictionary->base = 0;
+    // Words are all in the arena (or in the mapping)
+    arenaRelease(&dictionary->arena);
+    unmapFile(&dictionary->map);
+    graphRelease(&dictionary->graph);
+    bloomRelease(&dictionary->bloom);
+    perfectRelease(&dictionary->perfect);
+}
+
+void parseDictionary(Dictionary *dictionary)
+{
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        WordElement *slots = dictionary->letters[index].slots;
+
+        printf("DUMPING LETTER %c ### \n", dictionary->letters[index].initial);
+        sleep(1);
+
+        for (unsigned int slot = 0; slots != NULL && slot <= dictionary->letters[index].mask; slot++)
+        {
+            if (slots[slot].word != 0)
+            {
+                printf("%.*s\n", (int)slots[slot].length, SLOT_WORD(dictionary, &slots[slot]));
+            }
+        }
+    }
+    arenaReport(&dictionary->arena, "dictionary");
+}
+
+/******************************************************************************
+ * lookupLayer
+ *
+ * @param Dictionary *dictionary layer to search
+ * @param const char *word word to search, any case
+ * @param size_t length length of the word
+ *
+ * lookupWord in one layer, without the layers below, on the open-addressing sets
+ */
+static int lookupLayer(Dictionary *dictionary, const char *word, size_t length)
+{
+    unsigned char index = tolower(word[0])-97;
+    DictionaryElement *element = &dictionary->letters[index];
+    unsigned int hash = 0;
+
+    if (element->slots == NULL)
+    {
+        // Slots are gone when the words are in the graph (or perfect hash)
+        return lookupReleased(dictionary, index, word, length);
+    }
+
+    hash = hashWord(word, length);
+    if (filterRejects(dictionary, index, hash))
+    {
+        return 0;
+    }
+    return probeSlots(dictionary, index, hash, slotIndex(hash, element->mask), word, length);
+}
+
+/******************************************************************************
+ * lookupLayerBatch
+ *
+ * @param Dictionary *dictionary layer to search
+ * @param const char *const *words words to search, any case
+ * @param const unsigned int *lengths length of every word
+ * @param unsigned int count number of words, at most LOOKUP_BATCH
+ * @param unsigned char *found filled with 1 for every word in the layer
+ *
+ * lookupBatch in one layer, without the layers below, on the open-addressing sets
+ */
+static void lookupLayerBatch(Dictionary *dictionary, const char *const *words, const unsigned int *lengths,
+                             unsigned int count, unsigned char *found)
+{
+    unsigned int hashes[LOOKUP_BATCH], slots[LOOKUP_BATCH];
+    unsigned char letters[LOOKUP_BATCH];
+
+    assert(count <= LOOKUP_BATCH);
+
+    if (dictionary->perfect.count != 0)
+    {
+        lookupPerfectBatch(dictionary, words, lengths, count, found);
+        return;
+    }
+    // Hash all the words and ask for their first slots at once
+    for (unsigned int word = 0; word < count; word++)
+    {
+        unsigned char index = tolower(words[word][0])-97;
+        DictionaryElement *element = &dictionary->letters[index];
+
+        found[word] = 0;
+        letters[word] = NO_LETTER;
+        if (element->slots == NULL)
+        {
+            found[word] = (unsigned char)lookupReleased(dictionary, index, words[word], lengths[word]);
+            continue;
+        }
+        hashes[word] = hashWord(words[word], lengths[word]);
+        if (filterRejects(dictionary, index, hashes[word]))
+        {
+            continue;
+        }
+        slots[word] = slotIndex(hashes[word], element->mask);
+        letters[word] = index;
+        __builtin_prefetch(&element->slots[slots[word]]);
+    }
+    // Probe, the first slots are there by now or on the way
+    for (unsigned int word = 0; word < count; word++)
+    {
+        if (letters[word] != NO_LETTER)
+        {
+            found[word] = probeSlots(dictionary, letters[word], hashes[word], slots[word], words[word],
+                                     lengths[word]);
+        }
+    }
+}
 #endif
 
-            local = local->next;
+int lookupWord(Dictionary *dictionary, const char *word, size_t length)
+{
+    unsigned char index = tolower(word[0])-97;
+
+    if (dictionary->below == NULL)
+    {
+        return lookupLayer(dictionary, word, length);
+    }
+    // The first layer that knows the word decides
+    for (Dictionary *layer = dictionary; layer != NULL; layer = layer->below)
+    {
+        if (layer->letters[index].words != 0 && lookupLayer(layer, word, length))
+        {
+            return !layer->exclude;
         }
     }
+    return 0;
 }
 
-#ifdef HASH_DICTIONARY
-unsigned long hashWord(char * str)
+void lookupBatch(Dictionary *dictionary, const char *const *words, const unsigned int *lengths, unsigned int count,
+                 unsigned char *found)
 {
-    unsigned long hash = 5381;
-    int c;
+    const char *asked[LOOKUP_BATCH];
+    unsigned int asked_lengths[LOOKUP_BATCH], positions[LOOKUP_BATCH], pending[LOOKUP_BATCH], left = 0;
+    unsigned char verdicts[LOOKUP_BATCH];
+
+    assert(count <= LOOKUP_BATCH);
 
-    while ((c = *str++))
+    if (dictionary->below == NULL)
     {
-        hash = ((hash << 5) + hash) + tolower(c); /* hash * 33 + c */
+        lookupLayerBatch(dictionary, words, lengths, count, found);
+        return;
     }
+    for (unsigned int word = 0; word < count; word++)
+    {
+        found[word] = 0;
+        pending[left++] = word;
+    }
+    // Every layer gets, in one batch, the words the layers above don't know
+    for (Dictionary *layer = dictionary; layer != NULL && left != 0; layer = layer->below)
+    {
+        unsigned int batch = 0, kept = 0;
 
-    //printf("%s: Word has 0x%lX\n", __func__, hash);
-    return hash;
+        for (unsigned int word = 0; word < left; word++)
+        {
+            if (layer->letters[tolower(words[pending[word]][0])-97].words != 0)
+            {
+                asked[batch] = words[pending[word]];
+                asked_lengths[batch] = lengths[pending[word]];
+                positions[batch++] = word;
+            }
+        }
+        lookupLayerBatch(layer, asked, asked_lengths, batch, verdicts);
+
+        for (unsigned int word = 0, next = 0; word < left; word++)
+        {
+            if (next < batch && positions[next] == word && verdicts[next++])
+            {
+                found[pending[word]] = !layer->exclude;
+            }
+            else
+            {
+                pending[kept++] = pending[word];
+            }
+        }
+        left = kept;
+    }
+}
+
+int lookupCached(Dictionary *dictionary, const char *folded, size_t length)
+{
+    VerdictCache *cache = &verdictCache;
+    CacheEntry *entry = NULL;
+
+    if (length > CACHE_WORD)
+    {
+        return lookupWord(dictionary, folded, length);
+    }
+    if (cache->dictionary != dictionary->id)
+    {
+        memset(cache->entries, 0, sizeof(cache->entries));
+        cache->dictionary = dictionary->id;
+    }
+
+    entry = cacheEntry(cache, folded, length);
+    if (entry->length == length && memcmp(entry->word, folded, length) == 0)
+    {
+        STATS_ADD(cache_hits, 1);
+        return entry->found;
+    }
+    STATS_ADD(cache_misses, 1);
+    entry->found = (unsigned char)lookupWord(dictionary, folded, length);
+    entry->length = (unsigned char)length;
+    memcpy(entry->word, folded, length);
+    return entry->found;
 }
-#endif
\ No newline at end of file
+
+void lookupCachedBatch(Dictionary *dictionary, const char *const *folded, const unsigned int *lengths,
+                       unsigned int count, unsigned char *found)
+{
+    VerdictCache *cache = &verdictCache;
+    CacheEntry *entries[LOOKUP_BATCH];
+    const char *missed[LOOKUP_BATCH];
+    unsigned int missed_lengths[LOOKUP_BATCH], positions[LOOKUP_BATCH], misses = 0;
+    unsigned char verdicts[LOOKUP_BATCH];
+
+    assert(count <= LOOKUP_BATCH);
+
+    if (cache->dictionary != dictionary->id)
+    {
+        memset(cache->entries, 0, sizeof(cache->entries));
+        cache->dictionary = dictionary->id;
+    }
+
+    // Answer what the cache knows, the rest is looked up in one batch
+    for (unsigned int word = 0; word < count; word++)
+    {
+        CacheEntry *entry = (lengths[word] <= CACHE_WORD) ? cacheEntry(cache, folded[word], lengths[word]) : NULL;
+
+        if (entry != NULL && entry->length == lengths[word] && memcmp(entry->word, folded[word], lengths[word]) == 0)
+        {
+            STATS_ADD(cache_hits, 1);
+            found[word] = entry->found;
+            continue;
+        }
+        STATS_ADD(cache_misses, entry != NULL);
+        entries[misses] = entry;
+        missed[misses] = folded[word];
+        missed_lengths[misses] = lengths[word];
+        positions[misses] = word;
+        misses++;
+    }
+    if (misses == 0)
+    {
+        return;
+    }
+    lookupBatch(dictionary, missed, missed_lengths, misses, verdicts);
+
+    for (unsigned int miss = 0; miss < misses; miss++)
+    {
+        found[positions[miss]] = verdicts[miss];
+        if (entries[miss] != NULL)
+        {
+            entries[miss]->found = verdicts[miss];
+            entries[miss]->length = (unsigned char)missed_lengths[miss];
+            memcpy(entries[miss]->word, missed[miss], missed_lengths[miss]);
+        }
+    }
+}
+
+unsigned int suggestWords(Dictionary *dictionary, const char *word, size_t length, GraphMatches *matches)
+{
+    unsigned int count = 0;
+    STATS_TIMER(start);
+
+    assert(dictionary != NULL);
+    assert(matches != NULL);
+
+    matches->count = 0;
+    if (dictionary->suggest == 0)
+    {
+        return 0;
+    }
+    count = (dictionary->below == NULL) ?
+            graphSuggest(&dictionary->graph, word, length, SUGGEST_DISTANCE, dictionary->suggest, matches) :
+            suggestLayers(dictionary, word, length, matches);
+    STATS_ADD(suggested, 1);
+    STATS_ELAPSED(STATS_SUGGEST, start);
+
+    return count;
+}
+
+uint64_t dictionaryVersion(Dictionary *dictionary)
+{
+    assert(dictionary != NULL);
+
+    if (dictionary->version == 0)
+    {
+        dictionary->version = fingerprintWords(dictionary);
+    }
+    if (dictionary->below != NULL)
+    {
+        // The words of a layer count where they are in the stack, and
+        // whether they are added or removed
+        return perfectMix(perfectMix(dictionaryVersion(dictionary->below)) ^ dictionary->version ^
+                          dictionary->exclude) | 1;
+    }
+    return dictionary->version;
+}
+
+unsigned long hashWord(const char *str, size_t length)
+{
+    unsigned long hash = 5381;
+
+    while (length--)
+    {
+        hash = ((hash << 5) + hash) + tolower((unsigned char)*str++); /* hash * 33 + c */
+    }
+
+    //printf("%s: Word has 0x%lX\n", __func__, hash);
+    return hash;
+}
+
+
+
+/*******************************************************************************
+ * Static functions
+ ******************************************************************************/
+
+/******************************************************************************
+ * buildParallel
+ *
+ * @param Dictionary *dictionary dictionary to fill, with the text mapped
+ * @param unsigned int threads number of threads
+ *
+ * Two rounds on the threads. First the file is split in line aligned chunks
+ * and every chunk is scanned (validate, fold, hash) into one word list per
+ * letter. Then every letter is a task: its set gets the words of all the
+ * chunks, in chunk order. Words are so inserted in file order, exactly like
+ * the serial build, and the sets come out identical (slot by slot).
+ * Warnings are collected by the chunks and printed in file order
+ */
+static int buildParallel(Dictionary *dictionary, unsigned int threads)
+{
+    int rc = OK;
+    ParallelBuild job;
+    char *text = dictionary->map.data, *end = text + dictionary->map.size;
+    unsigned int chunks = threads * CHUNKS_PER_THREAD;
+    size_t step = dictionary->map.size / chunks + 1, total[ALPHABET_SIZE];
+
+    if (step < MIN_BUILD_CHUNK)
+    {
+        step = MIN_BUILD_CHUNK;
+        chunks = dictionary->map.size / step + 1;
+    }
+    if ((job.chunks = (DictionaryChunk *)calloc(chunks, sizeof(DictionaryChunk))) == NULL)
+    {
+        printf("ERROR: Dictionary out of memory. Aborting.\n");
+        return NOK;
+    }
+
+    job.dictionary = dictionary;
+    job.count = 0;
+    job.next_scan = 0;
+    job.next_letter = 0;
+
+    while (text < end)
+    {
+        DictionaryChunk *chunk = &job.chunks[job.count++];
+        char *stop = (end - text > (ptrdiff_t)step) ? text + step : end;
+
+        // Move the end of the chunk after the next endline
+        if (stop < end && (stop = (char *)memchr(stop, '\n', end - stop)) != NULL)
+        {
+            stop++;
+        }
+        else
+        {
+            stop = end;
+        }
+        chunk->text = text;
+        chunk->size = stop - text;
+        chunk->rc = OK;
+        text = stop;
+    }
+
+    runWorkers(threads, scanWorker, &job);
+
+    // Letters with more words first, so the big ones don't end up last
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        int pos = index;
+
+        total[index] = 0;
+        for (unsigned int chunk = 0; chunk < job.count; chunk++)
+        {
+            total[index] += job.chunks[chunk].letters[index].count;
+        }
+        while (pos > 0 && total[job.order[pos - 1]] < total[index])
+        {
+            job.order[pos] = job.order[pos - 1];
+            pos--;
+        }
+        job.order[pos] = index;
+
+        arenaInitialize(&job.arenas[index], total[index] * sizeof(WordElement) + 1);
+        job.rc[index] = OK;
+    }
+
+    runWorkers(threads, fillWorker, &job);
+
+    for (unsigned int chunk = 0; chunk < job.count; chunk++)
+    {
+        WordList *discarded = &job.chunks[chunk].discarded;
+
+        for (unsigned int word = 0; word < discarded->count; word++)
+        {
+            printf("WARNING: dictionary discarded [%.*s], but continuing.\n",
+                   (int)discarded->words[word].length, discarded->words[word].word);
+        }
+        if (job.chunks[chunk].rc != OK)
+        {
+            rc = NOK;
+        }
+
+        free(discarded->words);
+        for (int index = 0; index < ALPHABET_SIZE; index++)
+        {
+            free(job.chunks[chunk].letters[index].words);
+        }
+    }
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        arenaMerge(&dictionary->arena, &job.arenas[index]);
+        if (job.rc[index] != OK)
+        {
+            rc = NOK;
+        }
+    }
+    free(job.chunks);
+
+    if (rc != OK)
+    {
+        printf("ERROR: Dictionary out of memory. Aborting.\n");
+    }
+    return rc;
+}
+
+/******************************************************************************
+ * scanWorker
+ *
+ * @param void *arg the ParallelBuild job
+ *
+ * Scan the chunks, until there are chunks left: every line is validated,
+ * folded in place and hashed, then queued on the list of its letter
+ */
+static void *scanWorker(void *arg)
+{
+    ParallelBuild *job = (ParallelBuild *)arg;
+    unsigned int index = 0;
+
+    while ((index = nextTask(&job->next_scan)) < job->count)
+    {
+        DictionaryChunk *chunk = &job->chunks[index];
+        char *line = chunk->text, *end = chunk->text + chunk->size;
+
+        while ((chunk->rc == OK) && line < end)
+        {
+            char *newline = (char *)memchr(line, '\n', end - line);
+
+            if (newline == NULL)
+            {
+                newline = end;
+            }
+            // If string is only endline, we just continue
+            if (trimLine(line, newline - line) != 0)
+            {
+                size_t length = trimLine(line, newline - line);
+                int letter = lineLetter(line, length, 1);
+
+                if (letter >= 0 && letter < ALPHABET_SIZE)
+                {
+                    chunk->rc = appendWord(&chunk->letters[letter], line, length, hashWord(line, length));
+                }
+                else if (letter < 0)
+                {
+                    chunk->rc = appendWord(&chunk->discarded, line, length, 0);
+                }
+            }
+            line = newline + 1;
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ * fillWorker
+ *
+ * @param void *arg the ParallelBuild job
+ *
+ * Fill the letters, until there are letters left. A letter is only touched
+ * by one worker, with its own arena, so no lock is needed
+ */
+static void *fillWorker(void *arg)
+{
+    ParallelBuild *job = (ParallelBuild *)arg;
+    unsigned int next = 0;
+
+    while ((next = nextTask(&job->next_letter)) < ALPHABET_SIZE)
+    {
+        int index = job->order[next];
+
+        for (unsigned int chunk = 0; (job->rc[index] == OK) && chunk < job->count; chunk++)
+        {
+            WordList *list = &job->chunks[chunk].letters[index];
+
+            for (unsigned int word = 0; (job->rc[index] == OK) && word < list->count; word++)
+            {
+                job->rc[index] = insertWord(&job->dictionary->letters[index], &job->arenas[index],
+                                            list->words[word].word, list->words[word].length,
+                                            list->words[word].hash, 1);
+            }
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ * appendWord
+ *
+ * @param WordList *list list to append to
+ * @param const char *word word
+ * @param size_t length length of the word
+ * @param unsigned long hash hash of the word
+ *
+ * Append a word reference to a list, doubling the list as needed
+ */
+static int appendWord(WordList *list, const char *word, size_t length, unsigned long hash)
+{
+    if (list->count == list->size)
+    {
+        unsigned int size = (list->size != 0) ? list->size * 2 : 256;
+        WordRef *words = (WordRef *)realloc(list->words, size * sizeof(WordRef));
+
+        if (words == NULL)
+        {
+            return NOK;
+        }
+        list->words = words;
+        list->size = size;
+    }
+    list->words[list->count].word = word;
+    list->words[list->count].hash = hash;
+    list->words[list->count].length = length;
+    list->count++;
+
+    return OK;
+}
+
+/******************************************************************************
+ * addLine
+ *
+ * @param Dictionary *dictionary dictionary to fill
+ * @param char *line dictionary line, without endline (not NULL terminated)
+ * @param size_t length length of the line
+ * @param int view 1 if the line lives in the mapping and can be kept
+ *
+ * Validate a dictionary line and add it to the set of its initial letter.
+ * A view is lower cased in place, touching only the upper case chars, so
+ * the pages of the private mapping are copied only when really needed
+ */
+static int addLine(Dictionary *dictionary, char *line, size_t length, int view)
+{
+    int rc = OK;
+    int index = lineLetter(line, length, view);
+
+    if (index >= 0 && index < ALPHABET_SIZE)
+    {
+        if ((rc = insertWord(&dictionary->letters[index], &dictionary->arena,
+                             line, length, hashWord(line, length), view)) != OK)
+        {
+            printf("ERROR: Dictionary out of memory. Aborting.\n");
+        }
+    }
+    else if (index < 0)
+    {
+        printf("WARNING: dictionary discarded [%.*s], but continuing.\n", (int)length, line);
+    }
+    return rc;
+}
+
+/******************************************************************************
+ * lineLetter
+ *
+ * @param char *line dictionary line, without endline (not NULL terminated)
+ * @param size_t length length of the line
+ * @param int view 1 if the line lives in the mapping, to lower case in place
+ *
+ * Validate a dictionary line and return the index of its initial letter,
+ * -1 if the line must be discarded with a warning, ALPHABET_SIZE if it must
+ * be silently ignored (a letter outside Aa-Zz).
+ * A view is lower cased in place, touching only the upper case chars, so
+ * the pages of the private mapping are copied only when really needed
+ */
+static int lineLetter(char *line, size_t length, int view)
+{
+    int index = -1;
+
+    // Accept only alphabetic characters, remember
+    if (isalpha((unsigned char)line[0]))
+    {
+        // Convert first letter to array index
+        index = tolower(line[0])-97;
+
+        // We check that we have a valid letter for starting (Aa-Zz)
+        // before accessing dictionary array
+        if (index >= 0 && index < ALPHABET_SIZE)
+        {
+            if (view)
+            {
+                for (size_t pos = 0; pos < length; pos++)
+                {
+                    if (isupper((unsigned char)line[pos]))
+                    {
+                        line[pos] = tolower((unsigned char)line[pos]);
+                    }
+                }
+            }
+        }
+        else
+        {
+            // Not a letter we know, silently dropped as before
+            index = ALPHABET_SIZE;
+        }
+    }
+    return index;
+}
+
+/******************************************************************************
+ * trimLine
+ *
+ * @param const char *line dictionary line, without endline
+ * @param size_t length length of the line
+ *
+ * Length of the line without its trailing whitespace, the one the tokenizer
+ * splits the document on (' ', '\t' to '\r'): the '\r' of a CRLF file
+ * would never let the word match
+ */
+static inline size_t trimLine(const char *line, size_t length)
+{
+    while (length > 0 && (line[length - 1] == ' ' || (line[length - 1] >= '\t' && line[length - 1] <= '\r')))
+    {
+        length--;
+    }
+    return length;
+}
+
+#ifdef HASH_DICTIONARY
+/******************************************************************************
+ * insertWord
+ *
+ * @param DictionaryElement *element letter the word belongs to
+ * @param Arena *arena arena for the node and the word copy
+ * @param const char *word word to add
+ * @param size_t length length of the word
+ * @param unsigned long hash hash of the word (hashWord)
+ * @param int view 1 if word is already lower case and can be kept as is
+ *
+ * A lower case copy of the word is pushed on its bucket chain, unless it is
+ * already there. Node and word copy both come from the arena.
+ * Buckets are doubled when there is more than one word per bucket on average
+ */
+static int insertWord(DictionaryElement *element, Arena *arena, const char *word, size_t length, unsigned long hash, int view)
+{
+    int rc = OK;
+    WordElement **bucket = NULL, *local = NULL;
+
+    if (element->buckets == NULL || element->words + 1 > element->mask + 1)
+    {
+        if ((rc = growTable(element)) != OK)
+        {
+            return rc;
+        }
+    }
+
+    bucket = &element->buckets[slotIndex(hash, element->mask)];
+
+    for (local = *bucket; local != NULL; local = local->next)
+    {
+        if (local->hash == hash && local->length == length &&
+            compareWord(local->word, word, length))
+        {
+            // Already known, nothing to add
+            element->duplicates++;
+            return rc;
+        }
+    }
+
+    if ((local = (WordElement *)arenaAlloc(arena, sizeof(WordElement), sizeof(void *))) == NULL)
+    {
+        return NOK;
+    }
+    if ((local->word = view ? word : arenaCopyWord(arena, word, length)) == NULL)
+    {
+        return NOK;
+    }
+
+    local->hash = hash;
+    local->length = length;
+    local->next = *bucket;
+    *bucket = local;
+    element->words++;
+
+    return rc;
+}
+
+/******************************************************************************
+ * growTable
+ *
+ * @param DictionaryElement *element letter to grow
+ *
+ * Double the number of buckets and move every node on its new chain.
+ * Hashes are stored in the node, so we don't need to recompute them
+ */
+static int growTable(DictionaryElement *element)
+{
+    unsigned int size = (element->buckets == NULL) ? MIN_TABLE_SIZE : (element->mask + 1) * 2;
+    WordElement **buckets = (WordElement **)calloc(size, sizeof(WordElement *));
+
+    if (buckets == NULL)
+    {
+        return NOK;
+    }
+
+    for (unsigned int old = 0; element->buckets != NULL && old <= element->mask; old++)
+    {
+        WordElement *local = element->buckets[old];
+
+        while (local != NULL)
+        {
+            WordElement *move = local;
+            unsigned int bucket = slotIndex(move->hash, size - 1);
+
+            local = local->next;
+            move->next = buckets[bucket];
+            buckets[bucket] = move;
+        }
+    }
+
+    free(element->buckets);
+    element->buckets = buckets;
+    element->mask = size - 1;
+
+    return OK;
+}
+#else
+/******************************************************************************
+ * insertWord
+ *
+ * @param DictionaryElement *element letter the word belongs to
+ * @param Arena *arena arena for the word copy
+ * @param const char *word word to add
+ * @param size_t length length of the word
+ * @param unsigned long hash hash of the word (hashWord)
+ * @param int view 1 if word is already lower case and can be kept as is
+ *
+ * A lower case copy of the word (or the view itself) is added to the letter
+ * hash set, unless it is already there.
+ * The set is kept at most half full so probe sequences stay short.
+ * Sets are only built from text, so the base is 0 and slots hold pointers
+ */
+static int insertWord(DictionaryElement *element, Arena *arena, const char *word, size_t length, unsigned long hash, int view)
+{
+    int rc = OK;
+    unsigned int slot = 0;
+    const char *copy = NULL;
+
+    if (element->slots == NULL || (element->words + 1) * 2 > element->mask + 1)
+    {
+        if ((rc = growTable(element)) != OK)
+        {
+            return rc;
+        }
+    }
+
+    slot = slotIndex(hash, element->mask);
+
+    while (element->slots[slot].word != 0)
+    {
+        WordElement *local = &element->slots[slot];
+
+        if (local->hash == (unsigned int)hash && local->length == length &&
+            compareWord((const char *)local->word, word, length))
+        {
+            // Already known, nothing to add
+            element->duplicates++;
+            return rc;
+        }
+        slot = (slot + 1) & element->mask;
+    }
+
+    if ((copy = view ? word : arenaCopyWord(arena, word, length)) == NULL)
+    {
+        return NOK;
+    }
+    element->slots[slot].word = (uintptr_t)copy;
+    element->slots[slot].hash = hash;
+    element->slots[slot].length = length;
+    element->words++;
+
+    return rc;
+}
+
+/******************************************************************************
+ * growTable
+ *
+ * @param DictionaryElement *element letter to grow
+ *
+ * Double the size of the letter hash set and re-insert all the words.
+ * Hashes are stored in the slot, so we don't need to recompute them
+ */
+static int growTable(DictionaryElement *element)
+{
+    unsigned int size = (element->slots == NULL) ? MIN_TABLE_SIZE : (element->mask + 1) * 2;
+    WordElement *slots = (WordElement *)calloc(size, sizeof(WordElement));
+
+    if (slots == NULL)
+    {
+        return NOK;
+    }
+
+    for (unsigned int old = 0; element->slots != NULL && old <= element->mask; old++)
+    {
+        if (element->slots[old].word != 0)
+        {
+            unsigned int slot = slotIndex(element->slots[old].hash, size - 1);
+
+            while (slots[slot].word != 0)
+            {
+                slot = (slot + 1) & (size - 1);
+            }
+            slots[slot] = element->slots[old];
+        }
+    }
+
+    free(element->slots);
+    element->slots = slots;
+    element->mask = size - 1;
+
+    return OK;
+}
+#endif
+
+/******************************************************************************
+ * slotIndex
+ *
+ * @param unsigned long hash full hash of the word
+ * @param unsigned int mask table size - 1
+ *
+ * djb2 low bits are not great, so we scramble them with a multiplicative
+ * (Fibonacci) step before masking
+ */
+static inline unsigned int slotIndex(unsigned long hash, unsigned int mask)
+{
+    unsigned int mix = (unsigned int)hash * 2654435769u;
+
+    return (mix ^ (mix >> 16)) & mask;
+}
+
+#ifdef HASH_DICTIONARY
+/******************************************************************************
+ * probeChain
+ *
+ * @param Dictionary *dictionary dictionary to search
+ * @param unsigned char index letter of the word
+ * @param unsigned long hash hashWord of the word
+ * @param const WordElement *local first node of the bucket of the word
+ * @param const char *word word to search, any case
+ * @param size_t length length of the word
+ *
+ * Walk a chain until the word, the end of lookupWord and lookupBatch
+ */
+static inline int probeChain(Dictionary *dictionary, unsigned char index, unsigned long hash,
+                             const WordElement *local, const char *word, size_t length)
+{
+    unsigned int probes = 0;
+
+    while (local != NULL)
+    {
+        probes++;
+        // Integer compare first, the string is checked only when the hash
+        // matches, so a collision can't accept a misspelled word
+        if (local->hash == hash && local->length == length &&
+            compareWord(local->word, word, length))
+        {
+            STATS_LOOKUP(index, probes);
+            return 1;
+        }
+        local = local->next;
+    }
+    STATS_LOOKUP(index, probes);
+    STATS_ADD(false_positives, dictionary->bloom.blocks != NULL);
+    return 0;
+}
+#elif !defined(SORTED_DICTIONARY)
+/******************************************************************************
+ * probeSlots
+ *
+ * @param Dictionary *dictionary dictionary to search
+ * @param unsigned char index letter of the word
+ * @param unsigned int hash hashWord of the word
+ * @param unsigned int slot first slot of the word
+ * @param const char *word word to search, any case
+ * @param size_t length length of the word
+ *
+ * Probe the set of the letter from the first slot until the word or an
+ * empty slot, the end of lookupWord and lookupBatch
+ */
+static inline int probeSlots(Dictionary *dictionary, unsigned char index, unsigned int hash, unsigned int slot,
+                             const char *word, size_t length)
+{
+    DictionaryElement *element = &dictionary->letters[index];
+    unsigned int probes = 1;
+
+    // Table is never full, so we always end on an empty slot
+    while (element->slots[slot].word != 0)
+    {
+        WordElement *local = &element->slots[slot];
+
+        // If hash or length doesn't match, wrong word
+        if (local->hash == hash && local->length == length &&
+            compareWord(SLOT_WORD(dictionary, local), word, length))
+        {
+            STATS_LOOKUP(index, probes);
+            return 1;
+        }
+        slot = (slot + 1) & element->mask;
+        probes++;
+    }
+    STATS_LOOKUP(index, probes);
+    STATS_ADD(false_positives, dictionary->bloom.blocks != NULL);
+    return 0;
+}
+#endif
+
+/******************************************************************************
+ * cacheEntry
+ *
+ * @param VerdictCache *cache verdicts of the thread
+ * @param const char *folded word, lower case
+ * @param size_t length length of the word, at most CACHE_WORD
+ *
+ * The only entry where the verdict of a word can be
+ */
+static inline CacheEntry *cacheEntry(VerdictCache *cache, const char *folded, size_t length)
+{
+    uint32_t head = 0, tail = 0, hash = 0;
+
+    // The entry comes from the first and last 4 bytes and the length, not
+    // from all the bytes: cheaper than hashWord, the compare sorts it out
+    if (length >= 4)
+    {
+        memcpy(&head, folded, 4);
+        memcpy(&tail, folded + length - 4, 4);
+    }
+    else
+    {
+        memcpy(&head, folded, length);
+    }
+    hash = (head * 0x9E3779B1u) ^ (tail * 0x85EBCA77u) ^ (uint32_t)length;
+    return &cache->entries[(hash * 0x9E3779B1u) >> (32 - __builtin_ctz(CACHE_ENTRIES))];
+}
+
+/******************************************************************************
+ * buildGraph
+ *
+ * @param Dictionary *dictionary dictionary built, sets (or perfect hash)
+ *                               filled
+ *
+ * Copy the words in the word graph: the graph wants them sorted, so all the
+ * words are gathered and sorted first. With the DICTIONARY_GRAPH backend
+ * sets, arena and mapping are released then, the counters of the letters
+ * stay
+ */
+static int buildGraph(Dictionary *dictionary)
+{
+    WordList list = {NULL, 0, 0};
+    int rc = gatherWords(dictionary, &list);
+
+    // No words, no list: the graph stays empty, nothing is found in it
+    if (rc == OK && list.count != 0)
+    {
+        qsort(list.words, list.count, sizeof(WordRef), compareRefs);
+
+        for (unsigned int word = 0; (rc == OK) && word < list.count; word++)
+        {
+            rc = graphAddWord(&dictionary->graph, list.words[word].word, list.words[word].length);
+        }
+        if (rc == OK)
+        {
+            rc = graphFinish(&dictionary->graph);
+        }
+    }
+    free(list.words);
+
+    if (rc != OK)
+    {
+        printf("ERROR: Can't build the word graph\n");
+        graphRelease(&dictionary->graph);
+        return rc;
+    }
+    if (dictionary->backend != DICTIONARY_GRAPH)
+    {
+        // Suggestions only, lookups stay on the sets
+        return OK;
+    }
+
+    releaseSets(dictionary);
+    return OK;
+}
+
+/******************************************************************************
+ * gatherWords
+ *
+ * @param Dictionary *dictionary dictionary built, sets (or perfect hash)
+ *                               filled
+ * @param WordList *list empty list, filled with all the words, letter after
+ *                       letter, in set order
+ *
+ * The words of the sets, or of the pool when the perfect hash holds them (a
+ * loaded image). Words are not copied, the list points to them
+ */
+static int gatherWords(Dictionary *dictionary, WordList *list)
+{
+    const PerfectHash *perfect = &dictionary->perfect;
+    int rc = OK;
+
+    // Every word of the pool comes after its length byte
+    for (size_t pos = 1; (rc == OK) && perfect->count != 0 && pos < perfect->pool_size; )
+    {
+        size_t length = strlen(perfect->pool + pos);
+
+        rc = appendWord(list, perfect->pool + pos, length, 0);
+        pos += length + 2;
+    }
+
+    for (int index = 0; (rc == OK) && index < ALPHABET_SIZE; index++)
+    {
+        DictionaryElement *element = &dictionary->letters[index];
+
+#ifdef HASH_DICTIONARY
+        for (unsigned int bucket = 0; (rc == OK) && element->buckets != NULL && bucket <= element->mask; bucket++)
+        {
+            for (WordElement *local = element->buckets[bucket]; (rc == OK) && local != NULL; local = local->next)
+            {
+                rc = appendWord(list, local->word, local->length, local->hash);
+            }
+        }
+#else
+        for (unsigned int slot = 0; (rc == OK) && element->slots != NULL && slot <= element->mask; slot++)
+        {
+            if (element->slots[slot].word != 0)
+            {
+                rc = appendWord(list, SLOT_WORD(dictionary, &element->slots[slot]), element->slots[slot].length,
+                                element->slots[slot].hash);
+            }
+        }
+#endif
+    }
+    return rc;
+}
+
+/******************************************************************************
+ * releaseSets
+ *
+ * @param Dictionary *dictionary dictionary built from text, words moved to
+ *                               the word graph or the perfect hash
+ *
+ * Free the sets, the arena and the mapping, the counters of the letters stay
+ */
+static void releaseSets(Dictionary *dictionary)
+{
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+#ifdef HASH_DICTIONARY
+        free(dictionary->letters[index].buckets);
+        dictionary->letters[index].buckets = NULL;
+#else
+        free(dictionary->letters[index].slots);
+        dictionary->letters[index].slots = NULL;
+#endif
+    }
+    arenaRelease(&dictionary->arena);
+    unmapFile(&dictionary->map);
+}
+
+/******************************************************************************
+ * lookupReleased
+ *
+ * @param Dictionary *dictionary dictionary
+ * @param unsigned char index letter of the word, its set is empty
+ * @param const char *word word, any case
+ * @param size_t length length of the word
+ *
+ * lookupWord when the set of the letter is empty: the words may be in the
+ * perfect hash or in the word graph instead
+ */
+static inline int lookupReleased(Dictionary *dictionary, unsigned char index, const char *word, size_t length)
+{
+    if (dictionary->perfect.count != 0)
+    {
+        return lookupPerfect(dictionary, index, word, length);
+    }
+    return (dictionary->graph.edges != NULL) ? lookupGraph(dictionary, index, word, length) : 0;
+}
+
+/******************************************************************************
+ * lookupGraph
+ *
+ * @param Dictionary *dictionary dictionary with the word graph
+ * @param unsigned char index letter of the word, for the statistics
+ * @param const char *word word, any case
+ * @param size_t length length of the word
+ *
+ * lookupWord of the DICTIONARY_GRAPH backend, probes are the edges read
+ */
+static int lookupGraph(Dictionary *dictionary, unsigned char index, const char *word, size_t length)
+{
+    unsigned int probes = 0;
+    int found = 0;
+
+    if (dictionary->bloom.blocks != NULL && filterRejects(dictionary, index, hashWord(word, length)))
+    {
+        return 0;
+    }
+    found = graphLookup(&dictionary->graph, word, length, &probes);
+    STATS_LOOKUP(index, probes);
+    STATS_ADD(false_positives, dictionary->bloom.blocks != NULL && !found);
+    return found;
+}
+
+/******************************************************************************
+ * buildPerfect
+ *
+ * @param Dictionary *dictionary dictionary built from text, sets filled
+ *
+ * Build the perfect hash of the words of the sets, sorted so the pool is in
+ * word order, then release sets, arena and mapping. A dictionary without
+ * words gets no hash, its lookups find nothing
+ */
+static int buildPerfect(Dictionary *dictionary)
+{
+    WordList list = {NULL, 0, 0};
+    const char **words = NULL;
+    uint32_t *lengths = NULL;
+    int rc = gatherWords(dictionary, &list);
+
+    if (rc == OK && list.count != 0)
+    {
+        qsort(list.words, list.count, sizeof(WordRef), compareRefs);
+
+        words = (const char **)malloc(list.count * sizeof(const char *));
+        lengths = (uint32_t *)malloc(list.count * sizeof(uint32_t));
+        if (words == NULL || lengths == NULL)
+        {
+            rc = NOK;
+        }
+        for (unsigned int word = 0; (rc == OK) && word < list.count; word++)
+        {
+            words[word] = list.words[word].word;
+            lengths[word] = (uint32_t)list.words[word].length;
+        }
+        if (rc == OK)
+        {
+            rc = perfectBuild(&dictionary->perfect, words, lengths, list.count);
+        }
+    }
+    free(lengths);
+    free(words);
+    free(list.words);
+
+    if (rc != OK)
+    {
+        printf("ERROR: Can't build the perfect hash\n");
+        return rc;
+    }
+
+    releaseSets(dictionary);
+    return OK;
+}
+
+/******************************************************************************
+ * lookupPerfect
+ *
+ * @param Dictionary *dictionary dictionary with the perfect hash
+ * @param unsigned char index letter of the word, for the statistics
+ * @param const char *word word, any case
+ * @param size_t length length of the word
+ *
+ * lookupWord of the DICTIONARY_PERFECT backend, always one probe
+ */
+static int lookupPerfect(Dictionary *dictionary, unsigned char index, const char *word, size_t length)
+{
+    int found = 0;
+
+    if (dictionary->bloom.blocks != NULL && filterRejects(dictionary, index, hashWord(word, length)))
+    {
+        return 0;
+    }
+    found = perfectLookup(&dictionary->perfect, word, length);
+    STATS_LOOKUP(index, 1);
+    STATS_ADD(false_positives, dictionary->bloom.blocks != NULL && !found);
+    return found;
+}
+
+/******************************************************************************
+ * lookupPerfectBatch
+ *
+ * @param Dictionary *dictionary dictionary with the perfect hash
+ * @param const char *const *words words to search, any case
+ * @param const unsigned int *lengths length of every word
+ * @param unsigned int count number of words, at most LOOKUP_BATCH
+ * @param unsigned char *found filled with the verdicts
+ *
+ * lookupBatch of the DICTIONARY_PERFECT backend. A lookup reads three
+ * arrays, one after the other: the pilot of the bucket gives the slot, the
+ * offset of the slot gives the word. All the words go through one level
+ * before the next, the loads of a level are prefetched together
+ */
+static void lookupPerfectBatch(Dictionary *dictionary, const char *const *words, const unsigned int *lengths,
+                               unsigned int count, unsigned char *found)
+{
+    const PerfectHash *perfect = &dictionary->perfect;
+    uint64_t keys[LOOKUP_BATCH];
+    uint32_t places[LOOKUP_BATCH];
+    unsigned char letters[LOOKUP_BATCH];
+
+    for (unsigned int word = 0; word < count; word++)
+    {
+        unsigned char index = tolower(words[word][0])-97;
+
+        found[word] = 0;
+        letters[word] = NO_LETTER;
+        if (dictionary->bloom.blocks != NULL && filterRejects(dictionary, index, hashWord(words[word], lengths[word])))
+        {
+            continue;
+        }
+        keys[word] = perfectKey(words[word], lengths[word], perfect->seed);
+        places[word] = perfectBucket(keys[word], perfect->buckets);
+        letters[word] = index;
+        __builtin_prefetch(&perfect->pilots[places[word]]);
+    }
+    // Bucket to slot
+    for (unsigned int word = 0; word < count; word++)
+    {
+        if (letters[word] != NO_LETTER)
+        {
+            places[word] = perfectSlot(keys[word], perfect->pilots[places[word]], perfect->count);
+            __builtin_prefetch(&perfect->offsets[places[word]]);
+        }
+    }
+    // Slot to word, the length byte is right before it
+    for (unsigned int word = 0; word < count; word++)
+    {
+        if (letters[word] != NO_LETTER)
+        {
+            __builtin_prefetch(perfect->pool + perfect->offsets[places[word]] - 1);
+        }
+    }
+    for (unsigned int word = 0; word < count; word++)
+    {
+        if (letters[word] != NO_LETTER)
+        {
+            found[word] = (unsigned char)perfectMatch(perfect, places[word], words[word], lengths[word]);
+            STATS_LOOKUP(letters[word], 1);
+            STATS_ADD(false_positives, dictionary->bloom.blocks != NULL && !found[word]);
+        }
+    }
+}
+
+/******************************************************************************
+ * buildFilter
+ *
+ * @param Dictionary *dictionary dictionary built, sets (or perfect hash)
+ *                               filled
+ *
+ * Add every word of the sets to the Bloom filter. The sets keep the hash of
+ * their words, the words are not read again
+ */
+static int buildFilter(Dictionary *dictionary)
+{
+    size_t words = 0;
+
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        words += dictionary->letters[index].words;
+    }
+    if (bloomInitialize(&dictionary->bloom, words, dictionary->filter) != OK)
+    {
+        return NOK;
+    }
+
+    // The pool keeps no hash, the words of an image are hashed again
+    for (size_t pos = 1; dictionary->perfect.count != 0 && pos < dictionary->perfect.pool_size; )
+    {
+        size_t length = strlen(dictionary->perfect.pool + pos);
+
+        bloomAdd(&dictionary->bloom, (uint32_t)hashWord(dictionary->perfect.pool + pos, length));
+        pos += length + 2;
+    }
+
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        const DictionaryElement *element = &dictionary->letters[index];
+
+#ifdef HASH_DICTIONARY
+        for (unsigned int bucket = 0; element->buckets != NULL && bucket <= element->mask; bucket++)
+        {
+            for (const WordElement *local = element->buckets[bucket]; local != NULL; local = local->next)
+            {
+                bloomAdd(&dictionary->bloom, (uint32_t)local->hash);
+            }
+        }
+#else
+        for (unsigned int slot = 0; element->slots != NULL && slot <= element->mask; slot++)
+        {
+            if (element->slots[slot].word != 0)
+            {
+                bloomAdd(&dictionary->bloom, element->slots[slot].hash);
+            }
+        }
+#endif
+    }
+    return OK;
+}
+
+/******************************************************************************
+ * filterRejects
+ *
+ * @param Dictionary *dictionary dictionary, with or without filter
+ * @param unsigned char index letter of the word
+ * @param unsigned long hash hashWord of the word
+ *
+ * 1 if the filter is sure the word is not in the dictionary: the word counts
+ * as a lookup without probes
+ */
+static inline int filterRejects(Dictionary *dictionary, unsigned char index, unsigned long hash)
+{
+    if (dictionary->bloom.blocks == NULL || bloomMayContain(&dictionary->bloom, (uint32_t)hash))
+    {
+        return 0;
+    }
+    STATS_ADD(filtered, 1);
+    STATS_LOOKUP(index, 0);
+    return 1;
+}
+
+/******************************************************************************
+ * compareRefs
+ *
+ * @param const void *left pointer to a WordRef
+ * @param const void *right pointer to a WordRef
+ *
+ * qsort comparison of two folded words: bytes, then length (the order the
+ * word graph wants)
+ */
+static int compareRefs(const void *left, const void *right)
+{
+    const WordRef *a = (const WordRef *)left, *b = (const WordRef *)right;
+    int diff = memcmp(a->word, b->word, (a->length < b->length) ? a->length : b->length);
+
+    return (diff != 0) ? diff : (a->length > b->length) - (a->length < b->length);
+}
+
+/******************************************************************************
+ * dictionaryMemory
+ *
+ * @param const Dictionary *dictionary populated dictionary
+ *
+ * Bytes the dictionary uses: words and nodes in the arena, mapping, tables
+ * of the letters (part of the mapping for an image), word graph, filter and
+ * perfect hash (part of the mapping for an image too)
+ */
+static size_t dictionaryMemory(const Dictionary *dictionary)
+{
+    size_t bytes = dictionary->arena.used + dictionary->map.size +
+                   dictionary->graph.size * sizeof(uint32_t) +
+                   dictionary->bloom.count * BLOOM_BLOCK_WORDS * sizeof(uint64_t) +
+                   dictionary->perfect.size;
+
+    for (int index = 0; !dictionary->image && index < ALPHABET_SIZE; index++)
+    {
+        const DictionaryElement *element = &dictionary->letters[index];
+
+#ifdef HASH_DICTIONARY
+        bytes += (element->buckets != NULL) ? (element->mask + 1) * sizeof(WordElement *) : 0;
+#else
+        bytes += (element->slots != NULL) ? (element->mask + 1) * sizeof(WordElement) : 0;
+#endif
+    }
+    return bytes;
+}
+
+/******************************************************************************
+ * fingerprintWords
+ *
+ * @param const Dictionary *dictionary dictionary with its sets (or perfect
+ *                                     hash) filled
+ *
+ * dictionaryVersion of the words: the sum of a mix of the hash and length
+ * of every word, so the order doesn't count, and of the number of words.
+ * The sets keep the hash of their words (the low 32 bits are the same in
+ * every build), only the pool of the perfect hash is hashed again
+ */
+static uint64_t fingerprintWords(const Dictionary *dictionary)
+{
+    uint64_t sum = 0, words = 0;
+
+    for (size_t pos = 1; dictionary->perfect.count != 0 && pos < dictionary->perfect.pool_size; )
+    {
+        size_t length = strlen(dictionary->perfect.pool + pos);
+
+        sum += perfectMix(((uint64_t)length << 32) | (uint32_t)hashWord(dictionary->perfect.pool + pos, length));
+        words++;
+        pos += length + 2;
+    }
+
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        const DictionaryElement *element = &dictionary->letters[index];
+
+#ifdef HASH_DICTIONARY
+        for (unsigned int bucket = 0; element->buckets != NULL && bucket <= element->mask; bucket++)
+        {
+            for (const WordElement *local = element->buckets[bucket]; local != NULL; local = local->next)
+            {
+                sum += perfectMix(((uint64_t)local->length << 32) | (uint32_t)local->hash);
+                words++;
+            }
+        }
+#else
+        for (unsigned int slot = 0; element->slots != NULL && slot <= element->mask; slot++)
+        {
+            if (element->slots[slot].word != 0)
+            {
+                sum += perfectMix(((uint64_t)element->slots[slot].length << 32) | element->slots[slot].hash);
+                words++;
+            }
+        }
+#endif
+    }
+    // Never 0, that is "not known yet"
+    return perfectMix(sum ^ perfectMix(words)) | 1;
+}
+
+/******************************************************************************
+ * suggestLayers
+ *
+ * @param Dictionary *dictionary top layer of a stack, suggest set
+ * @param const char *word misspelled word, any case
+ * @param size_t length length of the word
+ * @param GraphMatches *matches filled with up to dictionary->suggest words
+ *
+ * suggestWords on a stack of layers: the matches of the graph of every
+ * layer that adds words, merged in the order of graphSuggest. A match the
+ * stack doesn't know (removed by an exclusion list above its layer) is
+ * dropped: with an exclusion list in the stack every layer is asked for
+ * GRAPH_MAX_MATCHES matches, only a list that long can come out short
+ */
+static unsigned int suggestLayers(Dictionary *dictionary, const char *word, size_t length, GraphMatches *matches)
+{
+    GraphMatches found;
+    unsigned int wanted = dictionary->suggest;
+
+    for (const Dictionary *layer = dictionary; layer != NULL; layer = layer->below)
+    {
+        wanted = layer->exclude ? GRAPH_MAX_MATCHES : wanted;
+    }
+
+    matches->count = 0;
+    for (Dictionary *layer = dictionary; layer != NULL; layer = layer->below)
+    {
+        if (layer->exclude || layer->graph.edges == NULL)
+        {
+            continue;
+        }
+        graphSuggest(&layer->graph, word, length, SUGGEST_DISTANCE, wanted, &found);
+
+        for (unsigned int candidate = 0; candidate < found.count; candidate++)
+        {
+            const char *other = found.words[candidate];
+            unsigned int place = 0, known = 0;
+
+            for (place = 0; place < matches->count; place++)
+            {
+                known |= (strcmp(matches->words[place], other) == 0);
+            }
+            if (known || !lookupWord(dictionary, other, strlen(other)))
+            {
+                continue;
+            }
+            // Insert in order, the last one falls out when full
+            for (place = 0; place < matches->count; place++)
+            {
+                if (compareMatches(found.distance[candidate], other, matches->distance[place],
+                                   matches->words[place], length) < 0)
+                {
+                    break;
+                }
+            }
+            if (place >= dictionary->suggest)
+            {
+                continue;
+            }
+            if (matches->count == dictionary->suggest)
+            {
+                matches->count--;
+            }
+            memmove(matches->words[place + 1], matches->words[place],
+                    (matches->count - place) * sizeof(matches->words[0]));
+            memmove(&matches->distance[place + 1], &matches->distance[place], matches->count - place);
+            strcpy(matches->words[place], other);
+            matches->distance[place] = found.distance[candidate];
+            matches->count++;
+        }
+    }
+    return matches->count;
+}
+
+/******************************************************************************
+ * compareMatches
+ *
+ * @param unsigned int distance edits of the first match
+ * @param const char *match first match, lower case
+ * @param unsigned int other_distance edits of the second match
+ * @param const char *other second match, lower case
+ * @param size_t length length of the misspelled word
+ *
+ * Order of the matches of graphSuggest: distance, then difference of
+ * length with the misspelled word, then byte order. Negative if match
+ * comes first
+ */
+static int compareMatches(unsigned int distance, const char *match, unsigned int other_distance, const char *other,
+                          size_t length)
+{
+    size_t match_length = strlen(match), other_length = strlen(other);
+    size_t match_delta = (match_length > length) ? match_length - length : length - match_length;
+    size_t other_delta = (other_length > length) ? other_length - length : length - other_length;
+
+    if (distance != other_distance)
+    {
+        return (distance < other_distance) ? -1 : 1;
+    }
+    if (match_delta != other_delta)
+    {
+        return (match_delta < other_delta) ? -1 : 1;
+    }
+    return strcmp(match, other);
+}
+
+#ifdef SORTED_DICTIONARY
+/******************************************************************************
+ * sortDictionary
+ *
+ * @param Dictionary *dictionary dictionary built from text, sets filled
+ * @param unsigned int threads number of threads
+ *
+ * Turn the set of every letter in its sorted array, on all the threads (a
+ * letter is a task, with its own arena). Words are copied, so the mapping of
+ * the file is not needed anymore
+ */
+static int sortDictionary(Dictionary *dictionary, unsigned int threads)
+{
+    int rc = OK;
+    SortJob job;
+
+    job.dictionary = dictionary;
+    job.next = 0;
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        arenaInitialize(&job.arenas[index], 0);
+        job.rc[index] = OK;
+    }
+
+    runWorkers(threads, sortWorker, &job);
+
+    for (int index = 0; index < ALPHABET_SIZE; index++)
+    {
+        arenaMerge(&dictionary->arena, &job.arenas[index]);
+        if (job.rc[index] != OK)
+        {
+            rc = NOK;
+        }
+    }
+
+    if (rc != OK)
+    {
+        printf("ERROR: Dictionary out of memory. Aborting.\n");
+    }
+    else
+    {
+        unmapFile(&dictionary->map);
+    }
+    return rc;
+}
+
+/******************************************************************************
+ * sortWorker
+ *
+ * @param void *arg the SortJob
+ *
+ * Sort the letters, until there are letters left
+ */
+static void *sortWorker(void *arg)
+{
+    SortJob *job = (SortJob *)arg;
+    unsigned int index = 0;
+
+    while ((index = nextTask(&job->next)) < ALPHABET_SIZE)
+    {
+        job->rc[index] = sortLetter(&job->dictionary->letters[index], &job->arenas[index]);
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ * sortLetter
+ *
+ * @param DictionaryElement *element letter with its set filled
+ * @param Arena *arena arena for the array and the words
+ *
+ * Sort the words of the set, then lay them out in Eytzinger order and copy
+ * them in the pool, in word order. The set is freed
+ */
+static int sortLetter(DictionaryElement *element, Arena *arena)
+{
+    SortLayout layout;
+    size_t bytes = 0;
+
+    if (element->slots == NULL)
+    {
+        return OK;
+    }
+    if ((layout.order = (WordElement **)malloc(element->words * sizeof(WordElement *))) == NULL)
+    {
+        return NOK;
+    }
+
+    layout.count = 0;
+    for (unsigned int slot = 0; slot <= element->mask; slot++)
+    {
+        if (element->slots[slot].word != 0)
+        {
+            layout.order[layout.count++] = &element->slots[slot];
+            bytes += element->slots[slot].length + 1;
+        }
+    }
+    qsort(layout.order, layout.count, sizeof(WordElement *), compareSlots);
+
+    // Node 0 is not used, the search starts from 1
+    if (bytes > UINT32_MAX ||
+        (layout.sorted = (SortedWord *)arenaAlloc(arena, (layout.count + 1) * sizeof(SortedWord),
+                                                  CACHE_LINE)) == NULL ||
+        (layout.pool = (char *)arenaAlloc(arena, bytes, 1)) == NULL)
+    {
+        free(layout.order);
+        return NOK;
+    }
+    layout.next = 0;
+    layout.used = 0;
+    memset(&layout.sorted[0], 0, sizeof(SortedWord));
+    layoutLetter(&layout, 1);
+
+    free(layout.order);
+    free(element->slots);
+    element->slots = NULL;
+    element->mask = 0;
+    element->sorted = layout.sorted;
+    element->pool = layout.pool;
+
+    return OK;
+}
+
+/******************************************************************************
+ * layoutLetter
+ *
+ * @param SortLayout *layout letter being laid out
+ * @param unsigned int node node of the tree to fill, from 1
+ *
+ * In order visit of the tree: the left subtree takes the words before the
+ * node, the right one the words after it. Words come from order in word
+ * order, so the pool gets them in word order too
+ */
+static void layoutLetter(SortLayout *layout, unsigned int node)
+{
+    if (node <= layout->count)
+    {
+        const WordElement *slot = NULL;
+        SortedWord *sorted = &layout->sorted[node];
+
+        layoutLetter(layout, 2 * node);
+
+        slot = layout->order[layout->next++];
+        memcpy(layout->pool + layout->used, (const char *)slot->word, slot->length);
+        layout->pool[layout->used + slot->length] = 0;
+        sorted->prefix = wordPrefix(layout->pool + layout->used, slot->length);
+        sorted->word = layout->used;
+        sorted->length = slot->length;
+        layout->used += slot->length + 1;
+
+        layoutLetter(layout, 2 * node + 1);
+    }
+}
+
+/******************************************************************************
+ * compareSlots
+ *
+ * @param const void *left pointer to a WordElement pointer
+ * @param const void *right pointer to a WordElement pointer
+ *
+ * qsort comparison of two folded words: bytes, then length. This is the
+ * order of prefix and compareTail
+ */
+static int compareSlots(const void *left, const void *right)
+{
+    const WordElement *a = *(WordElement *const *)left, *b = *(WordElement *const *)right;
+    int diff = memcmp((const char *)a->word, (const char *)b->word, (a->length < b->length) ? a->length : b->length);
+
+    return (diff != 0) ? diff : (a->length > b->length) - (a->length < b->length);
+}
+
+/******************************************************************************
+ * wordPrefix
+ *
+ * @param const char *word word, any case
+ * @param size_t length length of the word
+ *
+ * First PREFIX_SIZE bytes of the folded word as a big endian integer, so
+ * integers compare like the words. Short words are padded with 0
+ */
+static inline uint64_t wordPrefix(const char *word, size_t length)
+{
+    uint64_t prefix = 0;
+
+    for (size_t pos = 0; pos < PREFIX_SIZE; pos++)
+    {
+        prefix = (prefix << 8) | ((pos < length) ? (unsigned char)tolower((unsigned char)word[pos]) : 0);
+    }
+    return prefix;
+}
+
+/******************************************************************************
+ * compareTail
+ *
+ * @param const char *stored folded word of the dictionary
+ * @param size_t stored_length length of the stored word
+ * @param const char *word word looked up, any case
+ * @param size_t length length of the word
+ *
+ * Compare two words with the same prefix: the bytes after the prefix, then
+ * the length. Negative if stored comes first, 0 if they are the same word
+ */
+static inline int compareTail(const char *stored, size_t stored_length, const char *word, size_t length)
+{
+    size_t common = (stored_length < length) ? stored_length : length;
+
+    for (size_t pos = PREFIX_SIZE; pos < common; pos++)
+    {
+        int diff = (unsigned char)stored[pos] - tolower((unsigned char)word[pos]);
+
+        if (diff != 0)
+        {
+            return diff;
+        }
+    }
+    return (stored_length > length) - (stored_length < length);
+}
+#endif
@@ -2,7 +2,7 @@
 #define _DICTIONARY_H
 
 /*******************************************************************************
- * DICTIONARY DESIGN - Linked list structure
+ * DICTIONARY DESIGN - Hash set per initial letter
  * 
  * The dictionary DB will be grouped by initial letter of every word, so to
  * optimize the search algorithm, and avoid looping all the words every time
@@ -13,132 +13,456 @@
  * The words must start with an alphabet letter (Aa-Zz) or will be discarded
  * by the dictionary and the document and malformed
  * 
- * Every DictionaryElement will be single linked list, since we should not need
- * to search backwards
+ * Every DictionaryElement owns a flat open-addressing table (linear probing)
+ * of WordElement slots. Words are stored case-folded together with their
+ * full hash and length, so a probe only touches the string when both match.
+ * The table grows (power of two, max 50% load) while the file is read, so
+ * its size follows the number of words under that letter.
  * 
- * Every word is allocated dynamically
- *      NOTE: for sake of simplicity I allocate every single word, but we could
- *     optimize and allocate a number of words (elements) in one pass
+ * Words (and HASH_DICTIONARY nodes) are copied in the dictionary arena, the
+ * slot only keeps the pointer to it. A NULL word marks an empty slot.
+ * The arena is released in one go, see arena.h.
+ * When the dictionary file can be mapped (see file_map.h) words are not
+ * copied at all: the slot points in the mapping, words are not NULL
+ * terminated there, so always use the stored length.
+ *
+ * Slot words are relative to Dictionary.base: for a text dictionary the base
+ * is 0 and the slot holds the pointer itself, for a compiled image (see
+ * dict_image.h) the base is the mapping and the slot holds an offset. This
+ * way the image can be used as it is, wherever it gets mapped.
  *
  *   +-----------+ +-----------+ +-----------+
- *   |Initial A  | |Initial B  | |Initial C  |
+ *   |Initial a  | |Initial b  | |Initial c  |
  *   +-----------+ +-----------+ +-----------+
- *   |All        | |Best       | |Call       | <- This array will be statically
+ *   |slots/mask | |slots/mask | |slots/mask | <- This array will be statically
  *   |           | |           | |           |     initialized
  *   +-----------+ +-----------+ +-----------+
  *         |             |             |
- *         |             |             |
  *   +-----v-----+ +-----v-----+ +-----v-----+
- *   |           | |           | |           |
- *   |Another    | |Brother    | |Class      |
- *   |           | |           | |           |
- *   |           | |           | |           |
+ *   |           | |bye   h|3  | |           |  hash & mask selects the first
+ *   +-----------+ +-----------+ +-----------+  slot, then we probe forward
+ *   |another h|7| |           | |call   h|4 |  until the word or an empty
+ *   +-----------+ +-----------+ +-----------+  slot is found
+ *   |angel  h|5 | |best   h|4 | |class  h|5 |
  *   +-----------+ +-----------+ +-----------+
- *         |             |             |
- *         |             |             |
- *   +-----v-----+ +-----v-----+ +-----v-----+
- *   |           | |           | |           |
- *   |Angel      | |Bye        | |Cludge     |
- *   |           | |           | |           |
- *   |           | |           | |           |
+ *   |           | |brother h|7| |           |
  *   +-----------+ +-----------+ +-----------+
  *
+ * HASH_DICTIONARY - Chained buckets
+ *
+ * Building with -DHASH_DICTIONARY replaces the slots with an array of bucket
+ * heads, every WordElement is a node linked in its bucket. Walking a chain
+ * compares the hash first (integer) and the folded bytes only when the hash
+ * and length match, so a collision never accepts a misspelled word.
+ *
+ * SORTED_DICTIONARY - Compact sorted arrays
+ *
+ * Building with -DSORTED_DICTIONARY keeps the open-addressing sets only while
+ * the file is read (they drop the duplicates), then every letter is sorted
+ * in one compact array, no empty slots, the words copied back to back in
+ * word order. The mapping of the file is released.
+ * The array is in Eytzinger order (the nodes of a complete binary search
+ * tree, level by level, from 1): the search walks down with one compare and
+ * no branch per level, and the grandchildren of a node share a cache line,
+ * so they are prefetched while the node is compared. Most compares are on
+ * the first 8 folded bytes of the word, kept in the node as an integer:
+ *
+ *   sorted  [ - |cat|bye|dog|all|can|cow|egg]    prefix of "all" as integer
+ *                 1   2   3   4   5   6   7      0x616c6c0000000000
+ *
+ * Lookups take log2(words) steps instead of about one probe, in exchange the
+ * dictionary takes about half the memory.
+ *
+ * DICTIONARY_GRAPH - Word graph backend (runtime)
+ *
+ * Setting backend to DICTIONARY_GRAPH before populateDictionary (any build)
+ * moves all the words, once the sets dropped the duplicates, into one
+ * minimal acyclic word graph (see word_graph.h): shared prefixes and
+ * suffixes are stored once, so the dictionary takes a fraction of the sets.
+ * Sets, copied words and mapping are released, only the per letter counters
+ * are kept. A lookup walks one node per byte of the word, reading the edges
+ * of the node until its label, instead of hashing and probing.
+ * A compiled image holds the sets, it is always used as sets.
+ *
+ * DICTIONARY_PERFECT - Minimal perfect hash backend (runtime)
+ *
+ * Setting backend to DICTIONARY_PERFECT moves the words, once the sets
+ * dropped the duplicates, into one minimal perfect hash (see perfect_hash.h):
+ * one pool of words, in order, and a slot per word, no empty ones. A lookup
+ * is one hash, one slot and one compare. The build takes longer than the
+ * sets, it is meant for dictionaries that don't change: compiled with
+ * --backend perfect, the image holds the hash (not the sets) and is mapped
+ * as it is, in any build.
+ * Sets, copied words and mapping are released, the per letter counters are
+ * kept, like DICTIONARY_GRAPH.
+ *
+ * The word graph is also the index of the suggestions (see graphSuggest):
+ * with suggest set before populateDictionary, the graph is built with any
+ * backend, next to the sets, which stay for the lookups.
+ *
+ * Bloom pre-filter (runtime)
+ *
+ * With filter set before populateDictionary (bits per word, any build and
+ * backend) a Bloom filter of all the words sits in front of the lookups
+ * (see bloom.h): a word the filter rejects is surely misspelled and is not
+ * looked up at all. It only speeds up the misspelled words (a known word
+ * still pays the filter and the lookup), --stats counts the words rejected
+ * and the false positives, the words let through and then not found.
+ *
+ * Layers (runtime)
+ *
+ * Populated dictionaries can be stacked: below points to the next layer
+ * down, set any time before the checks. A lookup goes down from the top
+ * layer, the first layer that has the word decides: known, or misspelled
+ * if the layer is an exclusion list (exclude). So a big base, best a
+ * compiled image (mapped read only, its pages shared by every process
+ * using it), takes small overlays of words added or removed, and loading
+ * one more overlay costs its own words only, nothing is rebuilt:
+ *
+ *   overlay  exclude  "colour"          lookup "colour": misspelled
+ *      |
+ *   overlay           "kubernetes"      lookup "kubernetes": known
+ *      |
+ *   base (image)      234k words        lookup "hello": known
+ *
+ * Every layer is a whole dictionary (its own backend, filter, graph), the
+ * caller owns them all and deallocates them one by one. A letter is known
+ * if a layer adding words has it (see letterKnown). The verdict caches
+ * follow the top layer, suggestions are merged from the graphs of the
+ * layers adding words.
  * 
  ******************************************************************************/
 
+#include <stdint.h>
+
+#include "arena.h"
+#include "file_map.h"
+#include "word_graph.h"
+#include "bloom.h"
+#include "perfect_hash.h"
+
+#if defined(HASH_DICTIONARY) && defined(SORTED_DICTIONARY)
+#error "HASH_DICTIONARY and SORTED_DICTIONARY can't be used together"
+#endif
+
 #define ALPHABET_SIZE   26  // Size of the alphabet size
 #define MAX_WORD_LENGTH 100 // Maximum word length
+#define CHUNKS_PER_THREAD 4 // File chunks per thread, to balance the load
+#define SUGGEST_DISTANCE 2  // Edits between a misspelled word and its
+                            // suggestions
+#define LOOKUP_BATCH    16  // Most words of lookupBatch
+#define MAX_LAYERS      16  // Most layers stacked on a dictionary
+
+typedef enum {
+    DICTIONARY_SETS = 0,        // Sets of the build (open addressing, chained
+                                // or sorted)
+    DICTIONARY_GRAPH,           // One word graph for all the letters
+    DICTIONARY_PERFECT          // One minimal perfect hash for all the
+                                // letters
+}DictionaryBackend;
 
 typedef struct WordT{
 #ifdef HASH_DICTIONARY
-    unsigned long        word;    // The first letter of a word
-    struct      WordT   *left;    // Next word in the dictionary
-    struct      WordT   *right;    // Next word in the dictionary
+    const char          *word;    // Case-folded word
+    unsigned long        hash;    // Full hash of the folded word
+    unsigned int         length;  // Word length
+    struct      WordT   *next;    // Next word in the same bucket
 #else
-    char                *word;    // The first letter of a word
-    struct      WordT   *next;    // Next word in the dictionary
-    unsigned char       length;   // Word length
+    uintptr_t            word;    // Case-folded word, relative to the
+                                  // dictionary base, 0 if slot is empty
+    unsigned int         hash;    // Full hash of the folded word
+    unsigned int         length;  // Word length
 #endif
 
-
 }WordElement;
 
+#ifdef SORTED_DICTIONARY
+typedef struct {
+    uint64_t            prefix;   // First 8 folded bytes, big endian, 0 padded
+    uint32_t            word;     // Offset of the word in the letter pool
+    uint32_t            length;   // Word length
+}SortedWord;
+#endif
+
 typedef struct {
     unsigned char   initial;    // The first letter of a word
-    WordElement     *first;     // Pointer to first word for this letter
+    unsigned int    words;      // Number of (distinct) words for this letter
+    unsigned int    mask;       // Table size - 1, size is a power of two
+    unsigned int    duplicates; // Words dropped because already known
 #ifdef HASH_DICTIONARY
-    WordElement     *last_left;
-    WordElement     *last_right;
+    WordElement     **buckets;  // Chain heads, NULL if no words
 #else
-    WordElement     *last_add;  // Pointer to last inserted element, will save time
-                                // when we will populate the dictionary
+    WordElement     *slots;     // Open-addressing table, NULL if no words
+#endif
+#ifdef SORTED_DICTIONARY
+    SortedWord      *sorted;    // Words in Eytzinger order, from 1, NULL if
+                                // no words (slots are gone by then)
+    const char      *pool;      // Words, NULL terminated, in word order
 #endif
 }DictionaryElement;
 
+typedef struct DictionaryT{
+    DictionaryElement   letters[ALPHABET_SIZE]; // One set for every initial
+    Arena               arena;                  // Owns words and nodes
+    FileMap             map;                    // Dictionary file, if mapped
+    uintptr_t           base;                   // Added to slot words, 0 if
+                                                // they are plain pointers
+    unsigned char       image;                  // 1 if the sets live in a
+                                                // compiled image (read only)
+    unsigned int        duplicates;             // Words dropped by the build
+                                                // because already known
+    DictionaryBackend   backend;                // Where the words are kept,
+                                                // set before populating
+    WordGraph           graph;                  // Words, with DICTIONARY_GRAPH
+                                                // or suggest
+    PerfectHash         perfect;                // Words, with
+                                                // DICTIONARY_PERFECT
+    unsigned int        suggest;                // Suggestions per misspelled
+                                                // word, 0 for none, set
+                                                // before populating
+    unsigned int        filter;                 // Bloom filter bits per word,
+                                                // 0 for none, set before
+                                                // populating
+    BloomFilter         bloom;                  // Pre-filter of the lookups,
+                                                // with filter
+    unsigned char       copy;                   // 1 to read the file in
+                                                // memory instead of mapping
+                                                // it (see copyFile), set
+                                                // before populating
+    unsigned long       id;                     // Different for every
+                                                // populateDictionary, so the
+                                                // caches of the verdicts can
+                                                // tell a new dictionary
+    uint64_t            version;                // Fingerprint of the words,
+                                                // 0 until known (see
+                                                // dictionaryVersion)
+    struct DictionaryT  *below;                 // Layer looked up when this
+                                                // one doesn't know a word,
+                                                // NULL for none
+    unsigned char       exclude;                // 1 if the words of the
+                                                // layer are removed from
+                                                // the layers below
+}Dictionary;
+
+#ifndef HASH_DICTIONARY
+// Address of the word of a slot
+#define SLOT_WORD(dictionary, slot) ((const char *)((dictionary)->base + (slot)->word))
+#endif
+
 
 /* 
  * initializeDictionary
  * 
- * Initialize the static array of the dictionary.
+ * Initialize the static array of the dictionary and its arena, the backend
+ * is DICTIONARY_SETS, without suggestions nor filter.
  * Remember, we assume that only letters from Aa-Zz are supported.
  * 
- * @param DictionaryElement * dictionary[] pointer to dictionary root
+ * @param Dictionary * dictionary pointer to dictionary root
  * 
  */
-int initializeDictionary(DictionaryElement *dictionary);
+int initializeDictionary(Dictionary *dictionary);
 
 
 /* 
  * populateDictionary
  * 
- * Scan trough the dictionary file and fill the linked list, starting from
- * every root element for each and every letter (a,b,c,...).
+ * Scan trough the dictionary file and fill the hash set of every root
+ * element for each and every letter (a,b,c,...). Words are case-folded before
+ * being stored and a word already present is not inserted again, it is
+ * counted in dictionary->duplicates (and in the --stats).
+ * Regular files are mapped and scanned in place, other streams (pipes,
+ * stdin) are read with getline. A compiled image (see dict_image.h) is
+ * recognized and used directly.
  * 
  * It is allowed to have empty letters (I.E. no words under "d", or "l", ecc).
  * If we don't have letters populated all words starting with that letter will
  * be handled as "misspelled"
  * 
- * @param DictionaryElement * dictionary[] pointer to dictionary
- * @param FILE              * dict_fd pointer to the dictionary file
+ * With threads > 1 a mapped text dictionary is built in parallel: chunks of
+ * the file are scanned by all the threads, then every thread fills whole
+ * letters. The result (sets and warnings) is the same as the serial build.
+ * 
+ * With the DICTIONARY_GRAPH backend the words end up in the word graph, with
+ * DICTIONARY_PERFECT in the perfect hash, with suggest the words are in the
+ * graph too. With filter the Bloom filter is built from the sets, before
+ * anything else.
+ * 
+ * @param Dictionary * dictionary pointer to dictionary
+ * @param FILE       * dict_fd pointer to the dictionary file
+ * @param unsigned int threads number of threads building the dictionary
  * 
  */
-int populateDictionary(FILE *dict_fd, DictionaryElement *dictionary);
+int populateDictionary(FILE *dict_fd, Dictionary *dictionary, unsigned int threads);
 
 
 /* 
  * deallocateDictionary
  * 
- * Deallocate all the dictionary from memory when program exit
+ * Deallocate all the dictionary from memory when program exit.
+ * Words and nodes go away with the arena, no need to walk them
  * 
- * @param DictionaryElement * dictionary[] pointer to dictionary
+ * @param Dictionary * dictionary pointer to dictionary
  * 
  */
-void deallocateDictionary(DictionaryElement *dictionary);
+void deallocateDictionary(Dictionary *dictionary);
 
 
 /* 
  * parseDictionary
  * 
  * debug function to print all words in the dictionary, essentially a dump
- * of the linked list
+ * of every hash set, followed by the arena statistics
  * 
  * @param char * argv[] Array containing path to files (dict and doc
  * 
  */
-void parseDictionary(DictionaryElement *dictionary);
+void parseDictionary(Dictionary *dictionary);
 
 /* 
- * parseDictionary
+ * letterKnown
  * 
- * debug function to print all words in the dictionary, essentially a dump
- * of the linked list
+ * Tell if any layer adding words has words under a letter: a word of a
+ * letter no layer has is misspelled without a lookup
  * 
- * @param char * argv[] Array containing path to files (dict and doc
+ * @param const Dictionary * dictionary top layer
+ * @param unsigned char      index letter, below ALPHABET_SIZE
+ * @return 1 if some words start with the letter, 0 otherwise
  * 
  */
-#ifdef HASH_DICTIONARY
-unsigned long hashWord(char * str);
-#endif
+static inline int letterKnown(const Dictionary *dictionary, unsigned char index)
+{
+    for (; dictionary != NULL; dictionary = dictionary->below)
+    {
+        if (!dictionary->exclude && dictionary->letters[index].words != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* 
+ * lookupWord
+ * 
+ * Search a word in the dictionary, ignoring the case, through its layers.
+ * The word doesn't need to be NULL terminated, only length bytes are used.
+ * 
+ * @param Dictionary * dictionary pointer to dictionary
+ * @param const char        * word word to search
+ * @param size_t              length length of the word
+ * @return 1 if the word is in the dictionary, 0 otherwise
+ * 
+ */
+int lookupWord(Dictionary *dictionary, const char *word, size_t length);
+
+/* 
+ * lookupCached
+ * 
+ * lookupWord through the verdict cache of the calling thread: about the
+ * last 4096 words looked up (a word replaces the one it shares its entry
+ * with) and whether they are in the dictionary. Text repeats a small
+ * vocabulary a lot, most words are answered from the cache (128 KB, in L2)
+ * without hashing and probing the sets. The cache is emptied when the
+ * dictionary is not the one of its verdicts, words longer than 30 bytes
+ * always go to lookupWord.
+ * 
+ * @param Dictionary * dictionary pointer to dictionary
+ * @param const char * folded word to search, lower case
+ * @param size_t       length length of the word
+ * @return 1 if the word is in the dictionary, 0 otherwise
+ * 
+ */
+int lookupCached(Dictionary *dictionary, const char *folded, size_t length);
+
+
+/* 
+ * lookupBatch
+ * 
+ * lookupWord on a group of words at once. A lookup spends most of its time
+ * waiting for the first slot (or bucket, or tree node) of the word, a cache
+ * miss when the sets are bigger than the caches: all the words are hashed
+ * first and their slots prefetched (the chained buckets prefetch the first
+ * nodes too), then the probes go, one word after the other, on lines
+ * already in the cache or on the way, the misses overlap. The sorted
+ * arrays (SORTED_DICTIONARY) already prefetch down the tree and the word
+ * graph has nothing to prefetch: their words are looked up one by one. The
+ * perfect hash goes a level at a time for all the words: pilots, offsets,
+ * then the words of the pool. With layers, every layer gets the words the
+ * layers above it don't know, in one batch.
+ * 
+ * @param Dictionary        * dictionary pointer to dictionary
+ * @param const char *const * words words to search, any case
+ * @param const unsigned int* lengths length of every word
+ * @param unsigned int        count number of words, at most LOOKUP_BATCH
+ * @param unsigned char     * found filled with 1 for every word in the
+ *                            dictionary, 0 for the others
+ * 
+ */
+void lookupBatch(Dictionary *dictionary, const char *const *words, const unsigned int *lengths, unsigned int count,
+                 unsigned char *found);
+
+
+/* 
+ * lookupCachedBatch
+ * 
+ * lookupCached on a group of words: the words the cache knows are answered
+ * from it, all the others go to lookupBatch together
+ * 
+ * @param Dictionary        * dictionary pointer to dictionary
+ * @param const char *const * folded words to search, lower case
+ * @param const unsigned int* lengths length of every word
+ * @param unsigned int        count number of words, at most LOOKUP_BATCH
+ * @param unsigned char     * found filled with 1 for every word in the
+ *                            dictionary, 0 for the others
+ * 
+ */
+void lookupCachedBatch(Dictionary *dictionary, const char *const *folded, const unsigned int *lengths,
+                       unsigned int count, unsigned char *found);
+
+/* 
+ * suggestWords
+ * 
+ * Find the words of the dictionary closest to a misspelled one, at most
+ * SUGGEST_DISTANCE edits away, best first (see graphSuggest), from all its
+ * layers
+ * 
+ * @param Dictionary   * dictionary dictionary populated with suggest set
+ * @param const char   * word misspelled word, any case
+ * @param size_t         length length of the word
+ * @param GraphMatches * matches filled with up to dictionary->suggest words
+ * @return number of suggestions, 0 if suggest is not set
+ * 
+ */
+unsigned int suggestWords(Dictionary *dictionary, const char *word, size_t length, GraphMatches *matches);
+
+/* 
+ * dictionaryVersion
+ * 
+ * Fingerprint of the words of the dictionary: the same words give the same
+ * version, whatever their order, the build, the backend and whether they
+ * come from text or an image; any word added or removed changes it, and so
+ * does any layer added, removed or moved. This is what a cache of findings
+ * kept between runs is valid for (see line_cache.h). Computed from the sets
+ * while building from text, on the first call for an image (that reads all
+ * its words)
+ * 
+ * @param Dictionary * dictionary populated dictionary
+ * @return the version, never 0
+ * 
+ */
+uint64_t dictionaryVersion(Dictionary *dictionary);
+
+/* 
+ * hashWord
+ * 
+ * djb2 hash of the lower case version of a word, so "Hello" and "hello"
+ * will give the same hash
+ * 
+ * @param const char * str word to hash
+ * @param size_t       length length of the word
+ * 
+ */
+unsigned long hashWord(const char *str, size_t length);
 
 #endif // _DICTIONARY_H
 
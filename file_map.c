@@ -0,0 +1,100 @@
+// System include
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Project include
+#include "spellcheck.h"
+#include "file_map.h"
+
+
+int mapFile(FILE *fd, FileMap *map, int writable)
+{
+    int rc = NOK;
+    struct stat info;
+
+    assert(map != NULL);
+
+    map->data = NULL;
+    map->size = 0;
+
+    // Only regular, non empty files can be mapped
+    if (fd != NULL && fstat(fileno(fd), &info) == 0 &&
+        S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+        void *data = mmap(NULL, info.st_size, prot, MAP_PRIVATE, fileno(fd), 0);
+
+        if (data != MAP_FAILED)
+        {
+            // Both loaders scan the file from start to end
+            madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+            map->data = (char *)data;
+            map->size = info.st_size;
+            rc = OK;
+        }
+    }
+    return rc;
+}
+
+int copyFile(FILE *fd, FileMap *map)
+{
+    int rc = NOK;
+    struct stat info;
+
+    assert(map != NULL);
+
+    map->data = NULL;
+    map->size = 0;
+
+    if (fd != NULL && fstat(fileno(fd), &info) == 0 &&
+        S_ISREG(info.st_mode) && info.st_size > 0)
+    {
+        void *data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        size_t done = 0;
+
+        if (data != MAP_FAILED)
+        {
+            while (done < (size_t)info.st_size)
+            {
+                ssize_t got = pread(fileno(fd), (char *)data + done, info.st_size - done, done);
+
+                // Shorter than it was a moment ago: rewritten meanwhile
+                if (got <= 0)
+                {
+                    break;
+                }
+                done += got;
+            }
+            if (done == (size_t)info.st_size)
+            {
+                map->data = (char *)data;
+                map->size = info.st_size;
+                rc = OK;
+            }
+            else
+            {
+                munmap(data, info.st_size);
+            }
+        }
+    }
+    return rc;
+}
+
+void unmapFile(FileMap *map)
+{
+    assert(map != NULL);
+
+    if (map->data != NULL)
+    {
+        munmap(map->data, map->size);
+    }
+    map->data = NULL;
+    map->size = 0;
+}
@@ -0,0 +1,67 @@
+#ifndef _FILE_MAP_H
+#define _FILE_MAP_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*******************************************************************************
+ * FILE MAP - Zero-copy access to the input files
+ *
+ * Regular files are mapped in memory and the loaders work directly on the
+ * mapped bytes, no getline buffer and no copy of every line.
+ * Pipes, terminals and stdin can't be mapped: in that case mapFile fails and
+ * the caller keeps using the FILE stream (getline) as before.
+ *
+ ******************************************************************************/
+
+typedef struct {
+    char            *data;      // Mapped bytes, NULL if nothing is mapped
+    size_t          size;       // Size of the mapping (file size)
+}FileMap;
+
+
+/*
+ * mapFile
+ *
+ * Map the file behind an open stream, hinting the kernel that we will read
+ * it sequentially. The stream position is not used nor changed.
+ * A writable map is private: changes are never written back to the file, and
+ * only the pages actually modified are copied.
+ *
+ * @param FILE    * fd stream of the file to map
+ * @param FileMap * map filled with the mapping
+ * @param int       writable 1 to get a private writable mapping
+ * @return OK if mapped, NOK if the file can't be mapped (pipe, empty, ...)
+ *
+ */
+int mapFile(FILE *fd, FileMap *map, int writable);
+
+
+/*
+ * copyFile
+ *
+ * Read the file behind an open stream in a private anonymous mapping, same
+ * access as a writable mapFile, but nothing is left backed by the file: for
+ * a process that keeps the bytes while the file may be rewritten in place
+ * (a truncated file faults on the pages mapped from it). The stream
+ * position is not used nor changed.
+ *
+ * @param FILE    * fd stream of the file to copy
+ * @param FileMap * map filled with the copy, released with unmapFile
+ * @return OK if copied, NOK if the file can't be mapped (pipe, empty, ...)
+ *
+ */
+int copyFile(FILE *fd, FileMap *map);
+
+
+/*
+ * unmapFile
+ *
+ * Release a mapping done with mapFile or copyFile, it is safe on an empty map
+ *
+ * @param FileMap * map mapping to release
+ *
+ */
+void unmapFile(FileMap *map);
+
+#endif // _FILE_MAP_H
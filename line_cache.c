@@ -0,0 +1,433 @@
+// System include
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+// Project include
+#include "spellcheck.h"
+#include "report.h"
+#include "line_cache.h"
+#include "checksum.h"
+
+#define LINE_CACHE_LINES    1024    // Lines allocated at first
+#define LINE_CACHE_FINDINGS 256     // Findings allocated at first
+#define LINE_CACHE_POOL     4096    // Suggestion bytes allocated at first
+#define LINE_CACHE_MAX      (UINT32_MAX - 1)    // Most lines or findings, the
+                                                // index holds line + 1
+
+// Static function declarations
+static int readCache(LineCache *cache, FILE *cache_fd, const char *path, uint64_t dictionary, unsigned int suggest);
+static int fitsLine(const LineCache *cache, const CachedLine *line, size_t length);
+static int indexCache(LineCache *cache);
+static uint64_t bodyChecksum(const LineCache *cache);
+
+
+void lineCacheInitialize(LineCache *cache)
+{
+    assert(cache != NULL);
+
+    memset(cache, 0, sizeof(LineCache));
+}
+
+int lineCacheLoad(LineCache *cache, const char *path, uint64_t dictionary, unsigned int suggest)
+{
+    FILE *cache_fd = NULL;
+    int rc = OK;
+
+    assert(cache != NULL);
+    assert(path != NULL);
+
+    if ((cache_fd = fopen(path, "r")) == NULL)
+    {
+        // No cache yet, the first run writes it
+        if (errno != ENOENT)
+        {
+            printf("WARNING: Can't open line cache %s: errno %d, checking the whole document\n", path, errno);
+        }
+        return OK;
+    }
+    rc = readCache(cache, cache_fd, path, dictionary, suggest);
+    fclose(cache_fd);
+
+    if (rc == OK && cache->count != 0 && indexCache(cache) != OK)
+    {
+        printf("ERROR: Line cache of %zu lines out of memory\n", cache->count);
+        rc = NOK;
+    }
+    if (rc != OK || cache->index == NULL)
+    {
+        lineCacheRelease(cache);
+    }
+    return rc;
+}
+
+const CachedLine *lineCacheFind(const LineCache *cache, uint64_t hash, size_t length)
+{
+    assert(cache != NULL);
+
+    if (cache->index == NULL)
+    {
+        return NULL;
+    }
+    for (size_t slot = hash & cache->mask; cache->index[slot] != 0; slot = (slot + 1) & cache->mask)
+    {
+        const CachedLine *line = &cache->lines[cache->index[slot] - 1];
+
+        if (line->hash == hash)
+        {
+            return fitsLine(cache, line, length) ? line : NULL;
+        }
+    }
+    return NULL;
+}
+
+int lineCacheAddLine(LineCache *cache, uint64_t hash)
+{
+    assert(cache != NULL);
+
+    if (cache->count == cache->allocated)
+    {
+        size_t allocated = (cache->allocated != 0) ? cache->allocated * 2 : LINE_CACHE_LINES;
+        CachedLine *lines = NULL;
+
+        if (cache->count == LINE_CACHE_MAX ||
+            (lines = (CachedLine *)realloc(cache->lines, allocated * sizeof(CachedLine))) == NULL)
+        {
+            return NOK;
+        }
+        cache->lines = lines;
+        cache->allocated = allocated;
+    }
+    cache->lines[cache->count].hash = hash;
+    cache->lines[cache->count].first = (uint32_t)cache->found;
+    cache->lines[cache->count].count = 0;
+    cache->count++;
+    return OK;
+}
+
+int lineCacheAddFinding(LineCache *cache, size_t line, const ReportFinding *finding, const char *suggestions)
+{
+    CachedFinding *cached = NULL;
+    size_t bytes = 0;
+
+    assert(cache != NULL);
+    assert(finding != NULL);
+    assert(line < cache->count);
+
+    for (unsigned int suggestion = 0; suggestion < finding->count; suggestion++)
+    {
+        bytes += strlen(suggestions + bytes) + 1;
+    }
+    if (cache->pool_size + bytes > cache->pool_room)
+    {
+        size_t room = (cache->pool_room != 0) ? cache->pool_room * 2 : LINE_CACHE_POOL;
+        char *pool = NULL;
+
+        while (room < cache->pool_size + bytes)
+        {
+            room *= 2;
+        }
+        if (room > UINT32_MAX || (pool = (char *)realloc(cache->pool, room)) == NULL)
+        {
+            return NOK;
+        }
+        cache->pool = pool;
+        cache->pool_room = room;
+    }
+
+    if (cache->found == cache->room)
+    {
+        size_t room = (cache->room != 0) ? cache->room * 2 : LINE_CACHE_FINDINGS;
+        CachedFinding *findings = NULL;
+
+        if (cache->found == LINE_CACHE_MAX ||
+            (findings = (CachedFinding *)realloc(cache->findings, room * sizeof(CachedFinding))) == NULL)
+        {
+            return NOK;
+        }
+        cache->findings = findings;
+        cache->room = room;
+    }
+    // Findings come in line order, the first one of a line starts it
+    if (cache->lines[line].count == 0)
+    {
+        cache->lines[line].first = (uint32_t)cache->found;
+    }
+    assert(cache->lines[line].first + cache->lines[line].count == cache->found);
+    cache->lines[line].count++;
+
+    cached = &cache->findings[cache->found++];
+    cached->column = finding->column;
+    cached->length = finding->length;
+    cached->type = finding->type;
+    cached->suggestions = (uint32_t)cache->pool_size;
+    cached->count = finding->count;
+    if (bytes != 0)
+    {
+        memcpy(cache->pool + cache->pool_size, suggestions, bytes);
+        cache->pool_size += bytes;
+    }
+    return OK;
+}
+
+int lineCacheSave(const LineCache *cache, const char *path, uint64_t dictionary, unsigned int suggest)
+{
+    LineCacheHeader header;
+    FILE *cache_fd = NULL;
+    char *temporary = NULL;
+    int rc = OK;
+
+    assert(cache != NULL);
+    assert(path != NULL);
+
+    if ((temporary = (char *)malloc(strlen(path) + sizeof(".tmp"))) == NULL)
+    {
+        printf("ERROR: Line cache %s out of memory\n", path);
+        return NOK;
+    }
+    sprintf(temporary, "%s.tmp", path);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LINE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = LINE_CACHE_VERSION;
+    header.byte_order = LINE_CACHE_ORDER;
+    header.suggest = suggest;
+    header.dictionary = dictionary;
+    header.lines = cache->count;
+    header.findings = cache->found;
+    header.pool = cache->pool_size;
+    header.body_checksum = bodyChecksum(cache);
+    header.checksum = checksum(&header, offsetof(LineCacheHeader, checksum));
+
+    if ((cache_fd = fopen(temporary, "w")) != NULL)
+    {
+        // An empty part may have no array at all, it is not written
+        if (fwrite(&header, sizeof(header), 1, cache_fd) != 1 ||
+            (cache->count != 0 &&
+             fwrite(cache->lines, sizeof(CachedLine), cache->count, cache_fd) != cache->count) ||
+            (cache->found != 0 &&
+             fwrite(cache->findings, sizeof(CachedFinding), cache->found, cache_fd) != cache->found) ||
+            (cache->pool_size != 0 && fwrite(cache->pool, 1, cache->pool_size, cache_fd) != cache->pool_size))
+        {
+            rc = NOK;
+            printf("ERROR: Can't write line cache %s: errno %d\n", temporary, errno);
+        }
+        if (fclose(cache_fd) != 0 && rc == OK)
+        {
+            rc = NOK;
+            printf("ERROR: Can't close line cache %s: errno %d\n", temporary, errno);
+        }
+        if (rc == OK && rename(temporary, path) != 0)
+        {
+            rc = NOK;
+            printf("ERROR: Can't replace line cache %s: errno %d\n", path, errno);
+        }
+        if (rc != OK)
+        {
+            remove(temporary);
+        }
+    }
+    else
+    {
+        rc = NOK;
+        printf("ERROR: Can't create line cache %s: errno %d\n", temporary, errno);
+    }
+    free(temporary);
+    return rc;
+}
+
+void lineCacheRelease(LineCache *cache)
+{
+    assert(cache != NULL);
+
+    free(cache->lines);
+    free(cache->findings);
+    free(cache->pool);
+    free(cache->index);
+    lineCacheInitialize(cache);
+}
+
+
+
+/*******************************************************************************
+ * Static functions
+ ******************************************************************************/
+
+/******************************************************************************
+ * readCache
+ *
+ * @param LineCache *cache empty cache
+ * @param FILE *cache_fd open cache file
+ * @param const char *path cache file, for the messages
+ * @param uint64_t dictionary dictionaryVersion the findings must be of
+ * @param unsigned int suggest suggestions per word the findings must have
+ *
+ * Read the lines, findings and suggestions of a cache file, checking its
+ * header and its body. A file of another dictionary is not read, a damaged
+ * one is left with a warning: both leave count at 0. NOK only if out of
+ * memory
+ */
+static int readCache(LineCache *cache, FILE *cache_fd, const char *path, uint64_t dictionary, unsigned int suggest)
+{
+    LineCacheHeader header;
+    size_t line = 0;
+
+    if (fread(&header, sizeof(header), 1, cache_fd) != 1 ||
+        memcmp(header.magic, LINE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != LINE_CACHE_VERSION || header.byte_order != LINE_CACHE_ORDER ||
+        header.checksum != checksum(&header, offsetof(LineCacheHeader, checksum)) ||
+        header.lines > LINE_CACHE_MAX || header.findings > LINE_CACHE_MAX || header.pool > UINT32_MAX)
+    {
+        printf("WARNING: Line cache %s is damaged or of another version, checking the whole document\n", path);
+        return OK;
+    }
+    if (header.dictionary != dictionary || header.suggest != suggest || header.lines == 0)
+    {
+        // Verdicts of other words, the document is checked again
+        return OK;
+    }
+
+    cache->lines = (CachedLine *)malloc(header.lines * sizeof(CachedLine));
+    cache->findings = (CachedFinding *)malloc((header.findings ? header.findings : 1) * sizeof(CachedFinding));
+    cache->pool = (char *)malloc(header.pool ? header.pool : 1);
+    if (cache->lines == NULL || cache->findings == NULL || cache->pool == NULL)
+    {
+        printf("ERROR: Line cache %s out of memory\n", path);
+        return NOK;
+    }
+    cache->allocated = header.lines;
+    cache->room = header.findings;
+    cache->pool_room = header.pool;
+    cache->suggest = suggest;
+
+    if (fread(cache->lines, sizeof(CachedLine), header.lines, cache_fd) == header.lines &&
+        fread(cache->findings, sizeof(CachedFinding), header.findings, cache_fd) == header.findings &&
+        fread(cache->pool, 1, header.pool, cache_fd) == header.pool && fgetc(cache_fd) == EOF)
+    {
+        cache->count = header.lines;
+        cache->found = header.findings;
+        cache->pool_size = header.pool;
+        // The findings of every line are checked when it is found
+        if (bodyChecksum(cache) == header.body_checksum &&
+            (cache->pool_size == 0 || cache->pool[cache->pool_size - 1] == 0))
+        {
+            while (line < cache->count &&
+                   (uint64_t)cache->lines[line].first + cache->lines[line].count <= cache->found)
+            {
+                line++;
+            }
+            if (line == cache->count)
+            {
+                return OK;
+            }
+        }
+    }
+    printf("WARNING: Line cache %s is damaged, checking the whole document\n", path);
+    cache->count = 0;
+    cache->found = 0;
+    cache->pool_size = 0;
+    return OK;
+}
+
+/******************************************************************************
+ * fitsLine
+ *
+ * @param const LineCache *cache loaded cache
+ * @param const CachedLine *line line of the cache
+ * @param size_t length bytes of the line of the document
+ *
+ * Tell if the findings of a cached line are inside a line of length bytes,
+ * of a known type, with their suggestions inside the pool. Anything else is
+ * another line of the same hash, or a damaged cache
+ */
+static int fitsLine(const LineCache *cache, const CachedLine *line, size_t length)
+{
+    for (uint32_t finding = line->first; finding < line->first + line->count; finding++)
+    {
+        const CachedFinding *found = &cache->findings[finding];
+        size_t offset = found->suggestions;
+
+        if (found->column == 0 || found->length == 0 || found->column - 1 > length ||
+            found->length > length - (found->column - 1) ||
+            (found->type != REPORT_MISSPELLED && found->type != REPORT_MALFORMED) || found->count > cache->suggest)
+        {
+            return 0;
+        }
+        // The pool ends with a NULL, so strlen stays in it
+        for (uint32_t suggestion = 0; suggestion < found->count; suggestion++)
+        {
+            if (offset >= cache->pool_size)
+            {
+                return 0;
+            }
+            offset += strlen(cache->pool + offset) + 1;
+        }
+    }
+    return 1;
+}
+
+/******************************************************************************
+ * indexCache
+ *
+ * @param LineCache *cache cache with its lines read
+ *
+ * Index the lines by hash, in a table at most half full. Of the lines of a
+ * same hash only the first one is indexed
+ */
+static int indexCache(LineCache *cache)
+{
+    size_t size = 16;
+
+    while (size < cache->count * 2)
+    {
+        size *= 2;
+    }
+    if ((cache->index = (uint32_t *)calloc(size, sizeof(uint32_t))) == NULL)
+    {
+        return NOK;
+    }
+    cache->mask = size - 1;
+
+    for (size_t line = 0; line < cache->count; line++)
+    {
+        size_t slot = cache->lines[line].hash & cache->mask;
+
+        while (cache->index[slot] != 0 && cache->lines[cache->index[slot] - 1].hash != cache->lines[line].hash)
+        {
+            slot = (slot + 1) & cache->mask;
+        }
+        if (cache->index[slot] == 0)
+        {
+            cache->index[slot] = (uint32_t)(line + 1);
+        }
+    }
+    return OK;
+}
+
+/******************************************************************************
+ * bodyChecksum
+ *
+ * @param const LineCache *cache cache to check
+ *
+ * lineHash of the lines, of the findings and of the pool, mixed. It reads
+ * 8 bytes at a time, a lot faster than the header checksum on a big cache
+ */
+static uint64_t bodyChecksum(const LineCache *cache)
+{
+    uint64_t hash = (cache->count != 0) ? lineHash((const char *)cache->lines, cache->count * sizeof(CachedLine)) : 0;
+
+    if (cache->found != 0)
+    {
+        hash = (hash * 0x9E3779B97F4A7C15ull) ^
+               lineHash((const char *)cache->findings, cache->found * sizeof(CachedFinding));
+    }
+    if (cache->pool_size != 0)
+    {
+        hash = (hash * 0x9E3779B97F4A7C15ull) ^ lineHash(cache->pool, cache->pool_size);
+    }
+    return hash;
+}
@@ -0,0 +1,224 @@
+#ifndef _LINE_CACHE_H
+#define _LINE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "report.h"
+
+/*******************************************************************************
+ * LINE CACHE - Findings of a document, line by line, kept between runs
+ *
+ * "spellcheck --cache doc.cache dict.txt doc.txt" checks the document and
+ * writes, in the cache file, a hash of every line and the findings of the
+ * line (column, length and kind, not the line number). The next run on the
+ * edited document hashes every line: a line whose hash is in the cache is
+ * not tokenized nor looked up, its findings are written again from the
+ * cache with its new line number. Only the new and changed lines are
+ * checked, so a one line edit costs about the hashing of the document.
+ *
+ * The cache holds the verdicts of one dictionary: it is keyed by the
+ * dictionary version (see dictionaryVersion) and the number of suggestions
+ * asked (--suggest), a cache of other words or other suggestions is dropped
+ * and the document checked in full. The suggestions are stored too, the
+ * search costs a lot more than the lookups.
+ *
+ *   +----------------+  LineCacheHeader: magic, version, byte order,
+ *   |header          |  dictionary version, counts, checksums
+ *   +----------------+
+ *   |lines           |  CachedLine[lines], in document order
+ *   +----------------+
+ *   |findings        |  CachedFinding[findings], line after line
+ *   +----------------+
+ *   |pool            |  suggestions, NULL terminated, finding after finding
+ *   +----------------+
+ *
+ * A loaded cache is indexed by line hash (open addressing): lines that are
+ * the same (blank ones...) share one entry, they have the same findings.
+ * The file is written next to its final name then renamed, a run killed
+ * halfway leaves the old cache.
+ *
+ * lineHash is static inline, it runs once per line of the document.
+ *
+ ******************************************************************************/
+
+#define LINE_CACHE_MAGIC    "SPCHKLNC"  // First 8 bytes of a cache file
+#define LINE_CACHE_VERSION  1           // Bump on every layout change, or
+                                        // when the same words could get
+                                        // other verdicts (tokenizer)
+#define LINE_CACHE_ORDER    0x01020304  // Written native, read back to check
+
+typedef struct {
+    char            magic[8];           // LINE_CACHE_MAGIC
+    uint32_t        version;            // LINE_CACHE_VERSION
+    uint32_t        byte_order;         // LINE_CACHE_ORDER
+    uint32_t        suggest;            // Suggestions per word asked
+    uint32_t        reserved;           // 0
+    uint64_t        dictionary;         // dictionaryVersion of the findings
+    uint64_t        lines;              // Lines of the document
+    uint64_t        findings;           // Findings of all the lines
+    uint64_t        pool;               // Bytes of the suggestions
+    uint64_t        body_checksum;      // lineHash of what follows the header
+    uint64_t        checksum;           // Checksum of the fields above
+}LineCacheHeader;
+
+typedef struct {
+    uint64_t        hash;               // lineHash of the line
+    uint32_t        first;              // First finding of the line
+    uint32_t        count;              // Findings of the line
+}CachedLine;
+
+typedef struct {
+    uint32_t        column;             // Column of the word, from 1
+    uint32_t        length;             // Length of the word reported
+    uint32_t        type;               // ReportType of the finding
+    uint32_t        suggestions;        // Offset of its suggestions in pool
+    uint32_t        count;              // Suggestions of the word
+}CachedFinding;
+
+typedef struct {
+    CachedLine      *lines;             // Lines, in document order
+    size_t          count;              // Lines in lines
+    size_t          allocated;          // Lines allocated
+    CachedFinding   *findings;          // Findings, line after line
+    size_t          found;              // Findings in findings
+    size_t          room;               // Findings allocated
+    char            *pool;              // Suggestions of the findings
+    size_t          pool_size;          // Bytes in pool
+    size_t          pool_room;          // Bytes allocated for pool
+    unsigned int    suggest;            // Suggestions per word of the cache
+    uint32_t        *index;             // Line + 1 by hash, 0 if free,
+                                        // NULL if not indexed
+    size_t          mask;               // Size of index - 1
+}LineCache;
+
+
+/*
+ * lineHash
+ *
+ * Hash of the bytes of a line, 8 at a time
+ *
+ * @param const char * line line, without its endline
+ * @param size_t       length bytes of the line
+ * @return the hash, the length is part of it
+ *
+ */
+static inline uint64_t lineHash(const char *line, size_t length)
+{
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ length, block = 0;
+
+    for ( ; length >= 8; line += 8, length -= 8)
+    {
+        memcpy(&block, line, 8);
+        hash = (hash ^ block) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+    block = 0;
+    memcpy(&block, line, length);
+    hash = (hash ^ block) * 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 29;
+    hash *= 0xFF51AFD7ED558CCDull;
+    return hash ^ (hash >> 32);
+}
+
+
+/*
+ * lineCacheInitialize
+ *
+ * Initialize an empty cache
+ *
+ * @param LineCache * cache cache to initialize
+ *
+ */
+void lineCacheInitialize(LineCache *cache);
+
+
+/*
+ * lineCacheLoad
+ *
+ * Read a cache file and index its lines. A missing file, a file of another
+ * dictionary or other suggestions, or a damaged one leave the cache empty:
+ * the document will be checked in full (a damaged file gets a warning)
+ *
+ * @param LineCache  * cache empty cache
+ * @param const char * path cache file
+ * @param uint64_t     dictionary dictionaryVersion the findings must be of
+ * @param unsigned int suggest suggestions per word the findings must have
+ * @return OK, or NOK if out of memory
+ *
+ */
+int lineCacheLoad(LineCache *cache, const char *path, uint64_t dictionary, unsigned int suggest);
+
+
+/*
+ * lineCacheFind
+ *
+ * Find a line of the document in a loaded cache, with findings that fit in
+ * it and suggestions in the pool (else the cache is damaged)
+ *
+ * @param const LineCache * cache loaded cache
+ * @param uint64_t          hash lineHash of the line
+ * @param size_t            length bytes of the line
+ * @return the line, NULL if not in the cache
+ *
+ */
+const CachedLine *lineCacheFind(const LineCache *cache, uint64_t hash, size_t length);
+
+
+/*
+ * lineCacheAddLine
+ *
+ * Add the next line of the document, without findings yet
+ *
+ * @param LineCache * cache cache being filled
+ * @param uint64_t    hash lineHash of the line
+ * @return OK or NOK if out of memory
+ *
+ */
+int lineCacheAddLine(LineCache *cache, uint64_t hash);
+
+
+/*
+ * lineCacheAddFinding
+ *
+ * Add a finding kept by a report to a line already added, with its
+ * suggestions. Findings must come in line order
+ *
+ * @param LineCache           * cache cache being filled
+ * @param size_t                line line of the finding, from 0
+ * @param const ReportFinding * finding finding to add
+ * @param const char          * suggestions its suggestions, NULL terminated
+ *                              words one after the other
+ * @return OK or NOK if out of memory
+ *
+ */
+int lineCacheAddFinding(LineCache *cache, size_t line, const ReportFinding *finding, const char *suggestions);
+
+
+/*
+ * lineCacheSave
+ *
+ * Write the cache in a file, replacing it (path.tmp is written first)
+ *
+ * @param const LineCache * cache cache to write
+ * @param const char      * path cache file
+ * @param uint64_t          dictionary dictionaryVersion of the findings
+ * @param unsigned int      suggest suggestions per word of the findings
+ * @return OK or NOK if the file can't be written
+ *
+ */
+int lineCacheSave(const LineCache *cache, const char *path, uint64_t dictionary, unsigned int suggest);
+
+
+/*
+ * lineCacheRelease
+ *
+ * Free the cache, it is empty afterwards
+ *
+ * @param LineCache * cache cache to release
+ *
+ */
+void lineCacheRelease(LineCache *cache);
+
+#endif // _LINE_CACHE_H
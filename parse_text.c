@@ -6,185 +6,1017 @@
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
+#include <stddef.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 // Project include
 #include "spellcheck.h"
 #include "dictionary.h"
 #include "parse_text.h"
+#include "file_map.h"
+#include "report.h"
+#include "thread_pool.h"
+#include "tokenizer.h"
+#include "line_cache.h"
+#include "stats.h"
+
+#define STREAM_BLOCK    (64 * 1024)         // Bytes read at once from a stream
+#define STREAM_BUFFER   (1024 * 1024)       // Stream buffer, longest word kept
+#define BATCH_AHEAD     4                   // Documents per thread checked
+                                            // ahead of the output at most
+
+// A piece of the document checked by one worker
+typedef struct {
+    const char      *text;      // First byte of the chunk (start of a line)
+    size_t          size;       // Bytes in the chunk
+    unsigned int    lines;      // Endlines in the chunk
+    Report          report;     // Findings of the chunk
+    int             rc;         // Result of the check
+}TextChunk;
+
+// Shared state of a parallel check
+typedef struct {
+    Dictionary      *dictionary;
+    TextChunk       *chunks;
+    unsigned int    count;      // Number of chunks
+    unsigned int    next_count; // Next chunk to count lines of
+    unsigned int    next_check; // Next chunk to check
+}ParallelCheck;
+
+// A document of a batch
+typedef struct {
+    const char      *path;
+    Report          report;     // Header and findings of the document
+    size_t          bytes;      // Bytes of the document
+    int             error;      // errno if the document can't be read
+    unsigned char   done;       // report is complete (under lock)
+}BatchDocument;
+
+// Shared state of a batch check
+typedef struct {
+    Dictionary      *dictionary;
+    BatchDocument   *documents;
+    unsigned int    count;      // Number of documents
+    unsigned int    next_check; // Next document to check
+    unsigned int    next_write; // Next document to write (under lock)
+    unsigned int    window;     // Documents checked ahead of next_write
+    unsigned int    ahead;      // Distance of the read ahead
+    int             rc;         // Result of the writes (under lock)
+    pthread_mutex_t lock;
+    pthread_cond_t  written;    // next_write moved
+}BatchCheck;
 
 // Static function declarations
-static unsigned long compareWord(WordElement *word_p, char *word);
-static void purgeWord(char *word, unsigned char *len);
+static int parseParallel(const char *text, size_t size, Dictionary *dictionary, unsigned int threads,
+                         Tokens *tokens, Report *report);
+static int parseIncremental(const char *text, size_t size, Dictionary *dictionary, const char *path,
+                            Tokens *tokens, Report *report);
+static int emptyFile(FILE *doc_fd);
+static int replayLine(const char *text, const CachedLine *cached, const LineCache *old, unsigned int line,
+                      Dictionary *dictionary, Report *report);
+static int cacheFindings(LineCache *cache, Report *report);
+static void *countWorker(void *arg);
+static void *checkWorker(void *arg);
+static void *batchWorker(void *arg);
+static void checkDocument(BatchDocument *document, Tokens *tokens, Dictionary *dictionary);
+static void prefetchDocument(const char *path);
+static int parseStream(int fd, Tokens *tokens, Dictionary *dictionary, Report *report);
+static int parseBuffer(Tokens *tokens, const char *text, size_t size, int last, TextPosition *position,
+                       Dictionary *dictionary, Report *report, size_t *consumed);
+static int checkWords(Dictionary *dictionary, const char *text, const Tokens *tokens, size_t first,
+                      unsigned int count, Report *report);
+static int checkWord(Dictionary *dictionary, const char *word, const char *folded, const WordSpan *span,
+                     Report *report);
+static int reportMisspelled(Dictionary *dictionary, const char *word, const char *folded, size_t length,
+                            const WordSpan *span, Report *report);
 
 
-int parseText(FILE *doc_fd, DictionaryElement *dictionary)
+int parseText(FILE *doc_fd, Dictionary *dictionary, const ParseOptions *options)
 {
     int rc = OK;
-    
+    FileMap map;
+    Report report;
+    Tokens tokens;
+    TextPosition position = {1, 1};
+
     // Should never happen....
     assert(dictionary != NULL);
-    
-    if (doc_fd != NULL)
+    assert(options != NULL);
+
+    if (tokensInitialize(&tokens) != OK)
     {
-        char *token = NULL;
-        unsigned int line = 1;
-        ssize_t len = 0;
-        size_t size = 0;
+        printf("ERROR: Tokenizer out of memory. Aborting.\n");
+        return NOK;
+    }
+    // Findings are written straight to the descriptor, what is still in the
+    // stdout buffer goes out first
+    fflush(stdout);
+    reportInitialize(&report, STDOUT_FILENO, options->format);
 
-        // Reading trough the text
-        while((len = getline(&token, &size, doc_fd)) != -1)
+    if (doc_fd != NULL && !options->stream && options->cache != NULL && emptyFile(doc_fd))
+    {
+        // Nothing to map, but a document all the same: its cache is empty
+        rc = parseIncremental("", 0, dictionary, options->cache, &tokens, &report);
+    }
+    else if (doc_fd != NULL && !options->stream && mapFile(doc_fd, &map, 0) == OK)
+    {
+        // Reading trough the mapped text, no copy of the lines
+        if (options->cache != NULL)
         {
-            // Removing endline, we don't like or need it
-            // If string is only endline, we just continue
-            if (token[0] != '\n')
+            rc = parseIncremental(map.data, map.size, dictionary, options->cache, &tokens, &report);
+        }
+        else if (options->threads > 1)
+        {
+            rc = parseParallel(map.data, map.size, dictionary, options->threads, &tokens, &report);
+        }
+        else
+        {
+            rc = parseBuffer(&tokens, map.data, map.size, 1, &position, dictionary, &report, NULL);
+        }
+        unmapFile(&map);
+    }
+    else if (doc_fd != NULL)
+    {
+        if (options->cache != NULL)
+        {
+            printf("WARNING: Document can't be mapped, line cache %s not used\n", options->cache);
+            fflush(stdout);
+        }
+        // Reading trough the text (pipe or stdin) a block at a time
+        rc = parseStream(fileno(doc_fd), &tokens, dictionary, &report);
+    }
+    else
+    {
+        rc = NOK;
+    }
+
+    if (reportFlush(&report, STDOUT_FILENO) != OK)
+    {
+        rc = NOK;
+    }
+    reportRelease(&report);
+    tokensRelease(&tokens);
+
+    return rc;
+}
+
+int checkText(Tokens *tokens, const char *text, size_t size, Dictionary *dictionary, Report *report)
+{
+    TextPosition position = {1, 1};
+
+    assert(tokens != NULL);
+    assert(report != NULL);
+
+    return parseBuffer(tokens, text, size, 1, &position, dictionary, report, NULL);
+}
+
+int checkDocuments(const char *const *paths, size_t count, Dictionary *dictionary, const ParseOptions *options)
+{
+    int rc = OK;
+    BatchCheck job;
+    unsigned int unreadable = 0;
+    size_t bytes = 0;
+    uint64_t start = 0;
+    double seconds = 0;
+
+    assert(paths != NULL);
+    assert(dictionary != NULL);
+    assert(options != NULL);
+
+    if (count > UINT_MAX)
+    {
+        printf("ERROR: Too many documents %zu (at most %u)\n", count, UINT_MAX);
+        return NOK;
+    }
+    if ((job.documents = (BatchDocument *)malloc((count ? count : 1) * sizeof(BatchDocument))) == NULL)
+    {
+        printf("ERROR: Out of memory for %zu documents\n", count);
+        return NOK;
+    }
+    for (size_t index = 0; index < count; index++)
+    {
+        job.documents[index].path = paths[index];
+        job.documents[index].bytes = 0;
+        job.documents[index].error = 0;
+        job.documents[index].done = 0;
+        reportInitialize(&job.documents[index].report, -1, options->format);
+    }
+    job.dictionary = dictionary;
+    job.count = (unsigned int)count;
+    job.next_check = 0;
+    job.next_write = 0;
+    job.window = options->threads * BATCH_AHEAD;
+    job.ahead = options->threads;
+    job.rc = OK;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.written, NULL);
+
+    // Findings are written straight to the descriptor, what is still in the
+    // stdout buffer goes out first
+    fflush(stdout);
+    start = statsClock();
+    runWorkers(options->threads, batchWorker, &job);
+    seconds = (statsClock() - start) / 1e9;
+
+    for (unsigned int index = 0; index < job.count; index++)
+    {
+        bytes += job.documents[index].bytes;
+        if (job.documents[index].error != 0)
+        {
+            unreadable++;
+            rc = NOK;
+        }
+    }
+    if (job.rc != OK)
+    {
+        rc = NOK;
+    }
+    fprintf(stderr, "INFO: Checked %u documents (%u unreadable), %zu bytes in %.3fs: %.0f documents/s, "
+            "%.1f MB/s\n", job.count, unreadable, bytes, seconds, (seconds > 0) ? job.count / seconds : 0,
+            (seconds > 0) ? bytes / seconds / 1e6 : 0);
+
+    pthread_cond_destroy(&job.written);
+    pthread_mutex_destroy(&job.lock);
+    free(job.documents);
+
+    return rc;
+}
+
+/******************************************************************************
+ * parseParallel
+ *
+ * @param const char *text document
+ * @param size_t size size of the document
+ * @param Dictionary *dictionary dictionary to check against (read only)
+ * @param unsigned int threads number of threads
+ * @param Tokens *tokens tokenizer buffers, for the serial fallback
+ * @param Report *report report, for the serial fallback and the format
+ *
+ * Split the document in line aligned chunks, then two rounds on the
+ * threads: the first one counts the lines of every chunk, so in the second
+ * one every chunk knows its first line number and can be checked.
+ * Reports are written in chunk order at the end, in one go
+ */
+static int parseParallel(const char *text, size_t size, Dictionary *dictionary, unsigned int threads,
+                         Tokens *tokens, Report *report)
+{
+    int rc = OK;
+    ParallelCheck job;
+    const char *end = text + size;
+    size_t step = 0;
+    Report **reports = NULL;
+
+    job.dictionary = dictionary;
+    job.count = 0;
+    job.next_count = 0;
+    job.next_check = 0;
+
+    if ((job.chunks = (TextChunk *)malloc(threads * CHUNKS_PER_THREAD * sizeof(TextChunk))) == NULL ||
+        (reports = (Report **)malloc(threads * CHUNKS_PER_THREAD * sizeof(Report *))) == NULL)
+    {
+        // Not worth failing, just go serial
+        TextPosition position = {1, 1};
+
+        free(job.chunks);
+        return parseBuffer(tokens, text, size, 1, &position, dictionary, report, NULL);
+    }
+
+    step = size / (threads * CHUNKS_PER_THREAD) + 1;
+    while (text < end)
+    {
+        TextChunk *chunk = &job.chunks[job.count++];
+        const char *stop = (end - text > (ptrdiff_t)step) ? text + step : end;
+
+        // Move the end of the chunk after the next endline
+        if (stop < end && (stop = (const char *)memchr(stop, '\n', end - stop)) != NULL)
+        {
+            stop++;
+        }
+        else
+        {
+            stop = end;
+        }
+
+        chunk->text = text;
+        chunk->size = stop - text;
+        chunk->lines = 0;
+        chunk->rc = OK;
+        reportInitialize(&chunk->report, -1, report->format);
+        text = stop;
+    }
+
+    runWorkers(threads, countWorker, &job);
+    runWorkers(threads, checkWorker, &job);
+
+    for (unsigned int chunk = 0; chunk < job.count; chunk++)
+    {
+        reports[chunk] = &job.chunks[chunk].report;
+        if (job.chunks[chunk].rc != OK)
+        {
+            rc = NOK;
+        }
+    }
+    if (reportFlushAll(reports, job.count, report->fd) != OK)
+    {
+        rc = NOK;
+    }
+    for (unsigned int chunk = 0; chunk < job.count; chunk++)
+    {
+        reportRelease(&job.chunks[chunk].report);
+    }
+    free(reports);
+    free(job.chunks);
+
+    return rc;
+}
+
+/******************************************************************************
+ * emptyFile
+ *
+ * @param FILE *doc_fd document stream
+ *
+ * Tell if the document is an empty regular file: mapFile rejects it, but
+ * it is a document to check (and cache) all the same, not a pipe
+ */
+static int emptyFile(FILE *doc_fd)
+{
+    struct stat info;
+
+    return fstat(fileno(doc_fd), &info) == 0 && S_ISREG(info.st_mode) && info.st_size == 0;
+}
+
+/******************************************************************************
+ * parseIncremental
+ *
+ * @param const char *text document
+ * @param size_t size size of the document
+ * @param Dictionary *dictionary dictionary to check against
+ * @param const char *path line cache file
+ * @param Tokens *tokens tokenizer buffers
+ * @param Report *report where findings go
+ *
+ * Check a document against the line cache of its last check. Every line is
+ * hashed: the lines in the cache get their findings from it (replayLine),
+ * the others are gathered in runs of consecutive lines, every run checked
+ * with parseBuffer. The report keeps its findings, they go to the new cache
+ * after every line or run, so the new cache is in document order. It is
+ * written at the end: failing to write it is only worth a warning
+ */
+static int parseIncremental(const char *text, size_t size, Dictionary *dictionary, const char *path,
+                            Tokens *tokens, Report *report)
+{
+    int rc = OK;
+    LineCache old, cache;
+    uint64_t version = dictionaryVersion(dictionary);
+    const char *end = text + size, *run = text;
+    unsigned int line = 1, run_line = 1;
+
+    lineCacheInitialize(&old);
+    lineCacheInitialize(&cache);
+    if (lineCacheLoad(&old, path, version, dictionary->suggest) != OK)
+    {
+        return NOK;
+    }
+    // The warnings of the load go out before the findings
+    fflush(stdout);
+    reportKeep(report);
+
+    // run is the first of the lines not in the cache, run_line its number
+    while (rc == OK && text < end)
+    {
+        const char *stop = (const char *)memchr(text, '\n', end - text);
+        size_t length = (stop != NULL) ? (size_t)(stop - text) : (size_t)(end - text);
+        uint64_t hash = lineHash(text, length);
+        const CachedLine *cached = lineCacheFind(&old, hash, length);
+
+        if (lineCacheAddLine(&cache, hash) != OK)
+        {
+            printf("ERROR: Line cache out of memory at line %u\n", line);
+            rc = NOK;
+        }
+        else if (cached != NULL)
+        {
+            if (run < text)
             {
-                char *saveptr = NULL;
-                char *word = NULL;
-                strtok(token, "\n");
-
-                word = strtok_r(token, " ", &saveptr);
-                do
-                {
-                    // We can end up with word == NULL. This is not healthy
-                    if (word != NULL)
-                    {
-                        // Accept only alphabetic characters, this is a design
-                        // decision.
-                        if (isalpha(word[0]))
-                        {
-                            // Convert first letter to array index
-                            unsigned char index = tolower(word[0])-97;
-
-                            // Be sure to have a valid letter for starting (Aa-Zz)
-                            // before accessing dictionary array, even if we
-                            // should be safe here after the isalpha check
-                            if (index >= 0 && index < ALPHABET_SIZE)
-                            {
-                                unsigned char match = 0;
-                                // We can end up having a letter not populated 
-                                // in the dictionary
-                                if (dictionary[index].first != NULL)
-                                {
-                                    WordElement *local = dictionary[index].first;
-                                    unsigned char wordLen = strlen(word);
-                        
-                                    // Clear "." and ",", so we get less false negative
-                                    purgeWord(word, &wordLen);
-
-                                    while(local != NULL)
-                                    {
-                                        // If length doesn't match, wrong word
-                                        if (local->length == wordLen)
-                                        {
-                                            if ((match = compareWord(local, word)) == 1)
-                                            {
-                                                break;
-                                            }
-                                        }
-                                        local = local->next;
-                                    }
-                                }
-                                if (!match)
-                                {
-                                    printf("INFO: Mispelled word=[%s] at line=[%u]\n", word, line);
-                                }
-                            }
-                        }
-                        else
-                        {
-                            printf("INFO: Malformed word=[%s] at line=[%u]\n", word, line);
-                        }
-                    }
-                }while((word = strtok_r(NULL, " ", &saveptr)) != NULL);
-                
-                // Avoid memory leak with free and reset pointers to start clean
-                free(token);
-                token = NULL;
-                saveptr = NULL;
+                TextPosition position = {run_line, 1};
+
+                rc = parseBuffer(tokens, run, text - run, 1, &position, dictionary, report, NULL);
+                rc = (rc == OK) ? cacheFindings(&cache, report) : rc;
             }
-            
-            // Use this to tell on what line the error is
-            line++;
-            
-            if (rc == NOK)
+            rc = (rc == OK) ? replayLine(text, cached, &old, line, dictionary, report) : rc;
+            rc = (rc == OK) ? cacheFindings(&cache, report) : rc;
+            run = (stop != NULL) ? stop + 1 : end;
+            run_line = line + 1;
+            STATS_ADD(bytes, run - text);
+            STATS_ADD(lines, (stop != NULL) ? 1 : 0);
+            STATS_ADD(lines_reused, 1);
+        }
+        else
+        {
+            STATS_ADD(lines_checked, 1);
+        }
+        text = (stop != NULL) ? stop + 1 : end;
+        line++;
+    }
+    if (rc == OK && run < end)
+    {
+        TextPosition position = {run_line, 1};
+
+        rc = parseBuffer(tokens, run, end - run, 1, &position, dictionary, report, NULL);
+        rc = (rc == OK) ? cacheFindings(&cache, report) : rc;
+    }
+
+    if (rc == OK && lineCacheSave(&cache, path, version, dictionary->suggest) != OK)
+    {
+        // The findings are right, only the next run will be slower
+        if (reportFlush(report, report->fd) != OK)
+        {
+            rc = NOK;
+        }
+        printf("WARNING: Line cache %s not written, the next check will be a full one\n", path);
+        fflush(stdout);
+    }
+    lineCacheRelease(&cache);
+    lineCacheRelease(&old);
+    return rc;
+}
+
+/******************************************************************************
+ * replayLine
+ *
+ * @param const char *text first byte of the line
+ * @param const CachedLine *cached the line in the old cache
+ * @param const LineCache *old old cache, with the findings of the line
+ * @param unsigned int line number of the line now
+ * @param Dictionary *dictionary dictionary of the old cache
+ * @param Report *report where findings go
+ *
+ * Report the findings of an unchanged line as checkWords would, with the
+ * suggestions of the cache: the word comes from the text, at the cached
+ * column and length
+ */
+static int replayLine(const char *text, const CachedLine *cached, const LineCache *old, unsigned int line,
+                      Dictionary *dictionary, Report *report)
+{
+    int rc = OK;
+
+    for (uint32_t finding = cached->first; (rc == OK) && finding < cached->first + cached->count; finding++)
+    {
+        const CachedFinding *found = &old->findings[finding];
+        const char *word = text + found->column - 1;
+
+        if (found->type == REPORT_MALFORMED)
+        {
+            STATS_ADD(malformed, 1);
+            rc = reportWord(report, REPORT_MALFORMED, word, found->length, line, found->column);
+        }
+        else if (dictionary->suggest != 0)
+        {
+            // lineCacheFind checked count against the suggestions asked
+            const char *suggestions[GRAPH_MAX_MATCHES];
+            size_t offset = found->suggestions;
+
+            for (uint32_t suggestion = 0; suggestion < found->count; suggestion++)
             {
-                break;
+                suggestions[suggestion] = old->pool + offset;
+                offset += strlen(suggestions[suggestion]) + 1;
             }
+            STATS_ADD(misspelled, 1);
+            rc = reportSuggestions(report, word, found->length, line, found->column, suggestions, found->count);
+        }
+        else
+        {
+            STATS_ADD(misspelled, 1);
+            rc = reportWord(report, REPORT_MISSPELLED, word, found->length, line, found->column);
+        }
+    }
+    return rc;
+}
+
+/******************************************************************************
+ * cacheFindings
+ *
+ * @param LineCache *cache new cache, with the lines of the findings added
+ * @param Report *report report keeping its findings
+ *
+ * Move the findings kept by the report, and their suggestions, to the lines
+ * of the cache
+ */
+static int cacheFindings(LineCache *cache, Report *report)
+{
+    for (size_t finding = 0; finding < report->kept; finding++)
+    {
+        const ReportFinding *found = &report->findings[finding];
+        const char *suggestions = (found->count != 0) ? report->suggested + found->suggestions : NULL;
+
+        if (lineCacheAddFinding(cache, found->line - 1, found, suggestions) != OK)
+        {
+            printf("ERROR: Line cache out of memory at line %u\n", found->line);
+            return NOK;
+        }
+    }
+    report->kept = 0;
+    report->suggested_used = 0;
+    return OK;
+}
+
+/******************************************************************************
+ * countWorker
+ *
+ * @param void *arg the ParallelCheck job
+ *
+ * Count the endlines of the chunks, until there are chunks left
+ */
+static void *countWorker(void *arg)
+{
+    ParallelCheck *job = (ParallelCheck *)arg;
+    unsigned int index = 0;
+
+    while ((index = nextTask(&job->next_count)) < job->count)
+    {
+        TextChunk *chunk = &job->chunks[index];
+        const char *text = chunk->text, *end = chunk->text + chunk->size;
+
+        while ((text = (const char *)memchr(text, '\n', end - text)) != NULL)
+        {
+            chunk->lines++;
+            text++;
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ * checkWorker
+ *
+ * @param void *arg the ParallelCheck job
+ *
+ * Check the chunks, until there are chunks left. The first line of a chunk
+ * comes from the line count of all the chunks before it. Every worker has
+ * its own tokenizer buffers
+ */
+static void *checkWorker(void *arg)
+{
+    ParallelCheck *job = (ParallelCheck *)arg;
+    unsigned int index = 0;
+    Tokens tokens;
+    int rc = tokensInitialize(&tokens);
+
+    while ((index = nextTask(&job->next_check)) < job->count)
+    {
+        TextPosition position = {1, 1};
+
+        for (unsigned int before = 0; before < index; before++)
+        {
+            position.line += job->chunks[before].lines;
+        }
+        job->chunks[index].rc = (rc == OK) ?
+                                parseBuffer(&tokens, job->chunks[index].text, job->chunks[index].size, 1,
+                                            &position, job->dictionary, &job->chunks[index].report, NULL) : NOK;
+    }
+    tokensRelease(&tokens);
+    STATS_MERGE();
+    return NULL;
+}
+
+/******************************************************************************
+ * batchWorker
+ *
+ * @param void *arg the BatchCheck job
+ *
+ * Check the documents, until there are documents left, reading ahead the
+ * one the job->ahead-th next worker will take. A worker doesn't start a
+ * document more than job->window documents after the next one to write,
+ * so the reports waiting for their turn stay few. The worker finishing the
+ * next document to write writes it, and all the done ones after it, in
+ * order. The document at next_write is always being checked by a running
+ * worker, so the waits always end
+ */
+static void *batchWorker(void *arg)
+{
+    BatchCheck *job = (BatchCheck *)arg;
+    unsigned int index = 0;
+    Tokens tokens;
+    int rc = tokensInitialize(&tokens);
+
+    while ((index = nextTask(&job->next_check)) < job->count)
+    {
+        BatchDocument *document = &job->documents[index];
+
+        pthread_mutex_lock(&job->lock);
+        while (index >= job->next_write + job->window)
+        {
+            pthread_cond_wait(&job->written, &job->lock);
+        }
+        pthread_mutex_unlock(&job->lock);
+
+        if (index + job->ahead < job->count)
+        {
+            prefetchDocument(job->documents[index + job->ahead].path);
+        }
+        if (rc == OK)
+        {
+            checkDocument(document, &tokens, job->dictionary);
+        }
+        else
+        {
+            document->error = ENOMEM;
+            reportDocument(&document->report, document->path, document->error);
+        }
+
+        pthread_mutex_lock(&job->lock);
+        document->done = 1;
+        while (job->next_write < job->count && job->documents[job->next_write].done)
+        {
+            Report *report = &job->documents[job->next_write].report;
+
+            if (reportFlush(report, STDOUT_FILENO) != OK)
+            {
+                job->rc = NOK;
+            }
+            reportRelease(report);
+            job->next_write++;
+            pthread_cond_broadcast(&job->written);
+        }
+        pthread_mutex_unlock(&job->lock);
+    }
+    tokensRelease(&tokens);
+    STATS_MERGE();
+    return NULL;
+}
+
+/******************************************************************************
+ * checkDocument
+ *
+ * @param BatchDocument *document document to check, report filled
+ * @param Tokens *tokens tokenizer buffers of the worker
+ * @param Dictionary *dictionary dictionary to check against
+ *
+ * Check a document of a batch serially into its report, after its header.
+ * A regular file is mapped, anything else (a pipe, an empty file) read as
+ * a stream. A document that can't be opened gets the error header only, a
+ * read error ends its findings with an error header
+ */
+static void checkDocument(BatchDocument *document, Tokens *tokens, Dictionary *dictionary)
+{
+    FILE *doc_fd = NULL;
+    FileMap map;
+    struct stat info;
+    TextPosition position = {1, 1};
+    int rc = OK;
+
+    if ((doc_fd = fopen(document->path, "r")) == NULL)
+    {
+        document->error = errno;
+        reportDocument(&document->report, document->path, document->error);
+        return;
+    }
+    if (fstat(fileno(doc_fd), &info) != 0)
+    {
+        info.st_mode = 0;
+    }
+    if (S_ISDIR(info.st_mode))
+    {
+        // A directory opens, but can't be read
+        document->error = EISDIR;
+        reportDocument(&document->report, document->path, document->error);
+        fclose(doc_fd);
+        return;
+    }
+    document->bytes = S_ISREG(info.st_mode) ? (size_t)info.st_size : 0;
+
+    if (reportDocument(&document->report, document->path, 0) == OK)
+    {
+        if (mapFile(doc_fd, &map, 0) == OK)
+        {
+            rc = parseBuffer(tokens, map.data, map.size, 1, &position, dictionary, &document->report, NULL);
+            unmapFile(&map);
+        }
+        else
+        {
+            errno = 0;
+            rc = parseStream(fileno(doc_fd), tokens, dictionary, &document->report);
+        }
+        if (rc != OK)
+        {
+            document->error = (errno != 0) ? errno : EIO;
+            reportDocument(&document->report, document->path, document->error);
         }
     }
     else
     {
-        rc = NOK;
+        document->error = ENOMEM;
+    }
+    fclose(doc_fd);
+}
+
+/******************************************************************************
+ * prefetchDocument
+ *
+ * @param const char *path document to read ahead
+ *
+ * Ask the kernel to start reading a document in the page cache, so it is
+ * there when a worker maps it. Only a hint: errors are ignored
+ */
+static void prefetchDocument(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd >= 0)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
     }
-    return rc;
 }
 
 /******************************************************************************
- * purgeWord
- * 
- * @param char *word word to purge
- * 
- * This function just try to make the spellcheck smarter, by removing some 
- * common delimeter
+ * parseStream
+ *
+ * @param int fd descriptor to read the text from
+ * @param Tokens *tokens tokenizer buffers
+ * @param Dictionary *dictionary dictionary to check against
+ * @param Report *report where findings go
+ *
+ * Read the text in blocks into a fixed buffer and check it as it comes.
+ * The word cut at the end of a block is moved to the front of the buffer
+ * and checked with the next block, so memory stays at STREAM_BUFFER
+ * whatever the length of the lines. Only a word longer than the buffer
+ * can't be kept whole: it is reported cut at STREAM_BUFFER bytes, the rest
+ * of it is skipped (line and columns stay exact)
  */
-static inline void purgeWord(char *word, unsigned char *len)
-{
-    switch (word[*len -1])
-    {
-        case ',':
-        case '.':
-        case '?':
-        case '!':
-        case ':':
-        case ';':
-            word[*len-1]=0;
-            *len -= 1;
+static int parseStream(int fd, Tokens *tokens, Dictionary *dictionary, Report *report)
+{
+    int rc = OK;
+    char *buffer = NULL;
+    size_t kept = 0;
+    TextPosition position = {1, 1};
+    int end = 0, skip = 0;
+
+    if ((buffer = (char *)malloc(STREAM_BUFFER)) == NULL)
+    {
+        printf("ERROR: Stream buffer out of memory. Aborting.\n");
+        return NOK;
+    }
+
+    while (rc == OK && !end)
+    {
+        ssize_t got = read(fd, buffer + kept, (kept + STREAM_BLOCK <= STREAM_BUFFER) ?
+                                              STREAM_BLOCK : STREAM_BUFFER - kept);
+        size_t size = 0, used = 0, checked = 0;
+
+        if (got < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            printf("ERROR: Can't read document: errno %d\n", errno);
+            rc = NOK;
             break;
-        default:
+        }
+        end = (got == 0);
+        size = kept + got;
+
+        // Rest of a word longer than the buffer, already reported
+        while (skip && used < size && !isspace((unsigned char)buffer[used]))
+        {
+            used++;
+        }
+        skip = skip && (used == size);
+        position.column += used;
+
+        rc = parseBuffer(tokens, buffer + used, size - used, end, &position, dictionary, report, &checked);
+        used += checked;
+
+        // Buffer full with a single word: check what we have, skip the rest
+        if (rc == OK && used == 0 && size == STREAM_BUFFER)
+        {
+            rc = parseBuffer(tokens, buffer, size, 1, &position, dictionary, report, &used);
+            skip = 1;
+        }
+
+        kept = size - used;
+        memmove(buffer, buffer + used, kept);
+    }
+
+    free(buffer);
+    return rc;
+}
+
+/******************************************************************************
+ * parseBuffer
+ *
+ * @param Tokens *tokens tokenizer buffers
+ * @param const char *text text to check, starting at the beginning of a line
+ * @param size_t size size of the text
+ * @param int last 1 if no text follows, the last word ends with the text
+ * @param TextPosition *position position of the first byte, updated
+ * @param Dictionary *dictionary dictionary to check against
+ * @param Report *report where findings go
+ * @param size_t *consumed bytes checked, can be NULL (with last it is size)
+ *
+ * Tokenize the text a window at a time and look up every word. The text is
+ * never modified (it can be a read only mapping), words are looked up in the
+ * folded copy of the tokenizer and reported as they are in the text.
+ * If more text follows, a word touching the end is left unchecked: the
+ * caller has to pass it again, with what comes after it
+ */
+static int parseBuffer(Tokens *tokens, const char *text, size_t size, int last, TextPosition *position,
+                       Dictionary *dictionary, Report *report, size_t *consumed)
+{
+    int rc = OK;
+    unsigned int first = position->line;
+    const char *begin = text;
+
+    while ((rc == OK) && size > 0)
+    {
+        size_t window = (size < TOKEN_WINDOW) ? size : TOKEN_WINDOW;
+        STATS_TIMER(start);
+        size_t used = tokenizeText(tokens, text, window, last && window == size, position);
+        STATS_ELAPSED(STATS_TOKENIZE, start);
+        STATS_TIMER(check);
+
+        for (size_t word = 0; (rc == OK) && word < tokens->count; word += LOOKUP_BATCH)
+        {
+            rc = checkWords(dictionary, text, tokens, word,
+                            (tokens->count - word < LOOKUP_BATCH) ? tokens->count - word : LOOKUP_BATCH, report);
+        }
+        STATS_ADD(tokens, tokens->count);
+
+        if (used == 0 && window == TOKEN_WINDOW)
+        {
+            // A single word longer than a window, it is checked straight
+            // from the text (lookupWord doesn't need it folded)
+            WordSpan span = {0, 0, 0, position->line, position->column};
+
+            while (used < size && !isspace((unsigned char)text[used]))
+            {
+                used++;
+            }
+            if (used == size && !last)
+            {
+                // Its end is not here yet
+                break;
+            }
+            tokenCloseSpan(&span, text, used);
+            rc = checkWord(dictionary, text, text, &span, report);
+            position->column += used;
+            STATS_ADD(tokens, 1);
+        }
+        STATS_ELAPSED(STATS_LOOKUP, check);
+
+        if (used == 0)
+        {
+            // Only a word going on after the text is left
             break;
+        }
+        text += used;
+        size -= used;
+    }
+    STATS_ADD(bytes, text - begin);
+    STATS_ADD(lines, position->line - first);
+
+    if (consumed != NULL)
+    {
+        *consumed = text - begin;
+    }
+    return rc;
+}
+
+/******************************************************************************
+ * checkWords
+ *
+ * @param Dictionary *dictionary dictionary to check against
+ * @param const char *text text of the tokens
+ * @param const Tokens *tokens words of the window
+ * @param size_t first first word to check
+ * @param unsigned int count words to check, at most LOOKUP_BATCH
+ * @param Report *report where findings go
+ *
+ * checkWord on a group of words of the tokenizer: the words to look up are
+ * looked up together (lookupCachedBatch), then the findings are reported
+ * in text order
+ */
+static int checkWords(Dictionary *dictionary, const char *text, const Tokens *tokens, size_t first,
+                      unsigned int count, Report *report)
+{
+    int rc = OK;
+    const char *words[LOOKUP_BATCH];
+    unsigned int lengths[LOOKUP_BATCH], batch = 0;
+    unsigned char found[LOOKUP_BATCH];
+
+    for (unsigned int word = 0; word < count; word++)
+    {
+        const WordSpan *span = &tokens->spans[first + word];
+        unsigned char index = tokens->folded[span->offset] - 'a';
+
+        if (index < ALPHABET_SIZE && letterKnown(dictionary, index))
+        {
+            words[batch] = tokens->folded + span->offset;
+            lengths[batch] = span->trimmed;
+            batch++;
+        }
+    }
+    lookupCachedBatch(dictionary, words, lengths, batch, found);
+
+    batch = 0;
+    for (unsigned int word = 0; (rc == OK) && word < count; word++)
+    {
+        const WordSpan *span = &tokens->spans[first + word];
+        const char *folded = tokens->folded + span->offset;
+        unsigned char index = folded[0] - 'a';
+
+        // Same verdicts as checkWord
+        if (index >= ALPHABET_SIZE)
+        {
+            STATS_ADD(malformed, 1);
+            rc = reportWord(report, REPORT_MALFORMED, text + span->offset, span->length, span->line, span->column);
+        }
+        else if (!letterKnown(dictionary, index))
+        {
+            rc = reportMisspelled(dictionary, text + span->offset, folded, span->length, span, report);
+        }
+        else if (!found[batch++])
+        {
+            rc = reportMisspelled(dictionary, text + span->offset, folded, span->trimmed, span, report);
+        }
     }
+    return rc;
 }
 
 /******************************************************************************
- * compareWord
- * 
- * @param WordElement *word_p dictionary word to compare against
- * @param char *word word to check
- * 
- * This function is very simple: 
- * it loops for the length of the whole string comparing lower case chars.
- * As soon as a char differ it quits
- * 
- * If the loops end comparing all chars, a match has been found
+ * checkWord
+ *
+ * @param Dictionary *dictionary dictionary to check against
+ * @param const char *word word as it is in the text
+ * @param const char *folded the same word, lower case
+ * @param const WordSpan *span length and line of the word
+ * @param Report *report where findings go
+ *
+ * Look up a word, reporting it if it is not in the dictionary
  */
-#ifdef HASH_DICTIONARY
-static inline unsigned long compareWord(WordElement *word_p, char *word)
+static inline int checkWord(Dictionary *dictionary, const char *word, const char *folded, const WordSpan *span,
+                            Report *report)
 {
-    //printf("%s: Comparing 0x%lX == 0x%lX\n", __func__, word_p->word, hashWord(word));
-    return (word_p->word == hashWord(word));
+    // Convert first letter to array index
+    unsigned char index = tolower((unsigned char)folded[0]) - 'a';
+
+    // Accept only alphabetic characters, this is a design
+    // decision.
+    if (index >= ALPHABET_SIZE)
+    {
+        STATS_ADD(malformed, 1);
+        return reportWord(report, REPORT_MALFORMED, word, span->length, span->line, span->column);
+    }
+
+    // We can end up having a letter not populated in the dictionary, the
+    // word is reported as it is
+    if (!letterKnown(dictionary, index))
+    {
+        return reportMisspelled(dictionary, word, folded, span->length, span, report);
+    }
+
+    // Trailing "." and "," are cleared, so we get less false negative
+    if (!lookupCached(dictionary, folded, span->trimmed))
+    {
+        return reportMisspelled(dictionary, word, folded, span->trimmed, span, report);
+    }
+    return OK;
 }
-#else
-static inline unsigned long compareWord(WordElement *word_p, char *word)
+
+/******************************************************************************
+ * reportMisspelled
+ *
+ * @param Dictionary *dictionary dictionary the word is not in
+ * @param const char *word word as it is in the text
+ * @param const char *folded the same word, lower case
+ * @param size_t length bytes of the word to report
+ * @param const WordSpan *span line and column of the word
+ * @param Report *report where findings go
+ *
+ * Report a misspelled word, with its suggestions if the dictionary has them.
+ * Suggestions are searched for the word without its trailing punctuation
+ */
+static int reportMisspelled(Dictionary *dictionary, const char *word, const char *folded, size_t length,
+                            const WordSpan *span, Report *report)
 {
-    int match = 1;
-    unsigned char w1 = 0, w2 = 0;
-    char *dw = word_p->word, *lc = word;
-    
-    assert(word_p != NULL);
-    assert(word != NULL);
+    STATS_ADD(misspelled, 1);
 
-    // I've indulged myself on a recursive function, but timing was awful:
-    //    * recursive time = ~6.5secs
-    //    * strcmp time = ~5.5 secs
-    //    * current time = ~1.4 secs
-    while ((w1 = *dw++) && (w2 = *lc++))
+    if (dictionary->suggest != 0)
     {
-        if (tolower(w1) != tolower(w2))
+        GraphMatches matches;
+        const char *suggestions[GRAPH_MAX_MATCHES];
+        unsigned int count = suggestWords(dictionary, folded, span->trimmed, &matches);
+
+        for (unsigned int match = 0; match < count; match++)
         {
-            match = 0;
-            break;
+            suggestions[match] = matches.words[match];
         }
+        return reportSuggestions(report, word, length, span->line, span->column, suggestions, count);
     }
-    return match;
+    return reportWord(report, REPORT_MISSPELLED, word, length, span->line, span->column);
 }
-#endif
@@ -1,16 +1,87 @@
 #ifndef _PARSE_TEXT_H
 #define _PARSE_TEXT_H
 
+#include "report.h"
+#include "tokenizer.h"
+
+#define MAX_THREADS     256 // Maximum number of checking threads
+
+typedef struct {
+    unsigned int    threads;    // Checking threads, 1 to check serially
+    ReportFormat    format;     // How findings are written
+    unsigned char   stream;     // Read the document as a stream, even if
+                                // it could be mapped
+    const char      *cache;     // Line cache file (--cache), NULL for none
+}ParseOptions;
+
 /* 
  * parseText
  * 
  * Execute the parsing of the document searching for words not in the 
- * dictionary.
+ * dictionary. Findings are written on stdout in options->format.
+ * 
+ * A mapped document is split in line aligned chunks checked by
+ * options->threads threads. Every chunk has its own report, printed in
+ * document order when all chunks are done, so the output is the same as the
+ * serial one. Pipes and stdin (or any document with options->stream) are
+ * read in blocks into a fixed size buffer and checked serially as they come,
+ * memory doesn't grow with the length of the lines.
+ * 
+ * With options->cache a mapped document is checked serially against the
+ * line cache of its last check (see line_cache.h): only the lines not in
+ * it are checked, the cache is rewritten for the next run. The output is
+ * the same as without the cache.
  * 
  * @param const FILE *doc_fd File pointer to document to spellcheck
- * @param DictionaryElement * dictionary[] pointer to dictionary
+ * @param Dictionary * dictionary pointer to dictionary
+ * @param const ParseOptions * options how to check the document
+ * 
+ */
+int parseText(FILE *doc_fd, Dictionary *dictionary, const ParseOptions *options);
+
+
+/* 
+ * checkText
+ * 
+ * Check a whole document in memory, adding the findings to a report. This
+ * is the serial check of parseText without the I/O, for callers that have
+ * the document already (the server)
+ * 
+ * @param Tokens     * tokens tokenizer buffers (see tokensInitialize)
+ * @param const char * text document, not modified
+ * @param size_t       size bytes of the document
+ * @param Dictionary * dictionary pointer to dictionary
+ * @param Report     * report where findings go
+ * @return OK or NOK if the report can't be written
+ * 
+ */
+int checkText(Tokens *tokens, const char *text, size_t size, Dictionary *dictionary, Report *report);
+
+
+
+/* 
+ * checkDocuments
+ * 
+ * Check many documents against the same dictionary (batch mode), loaded
+ * once for all of them. Findings are written on stdout in options->format,
+ * grouped by document and in the order of paths, every group after the
+ * header of its document (see reportDocument).
+ * 
+ * options->threads workers take the documents one at a time and check each
+ * one serially, while the next ones are read ahead (posix_fadvise). A
+ * document done before the ones in front of it waits in memory, a worker
+ * doesn't get more than a few documents per thread ahead of the output.
+ * The documents per second and bytes per second of the batch are printed
+ * on stderr at the end.
+ * 
+ * @param const char *const * paths documents to check, "-" is a file name
+ * @param size_t              count number of documents
+ * @param Dictionary        * dictionary pointer to dictionary
+ * @param const ParseOptions* options workers and format (stream is ignored,
+ *                            what can't be mapped is read as a stream)
+ * @return OK or NOK if a document can't be read or the findings written
  * 
  */
-int parseText(FILE *doc_fd, DictionaryElement *dictionary);
+int checkDocuments(const char *const *paths, size_t count, Dictionary *dictionary, const ParseOptions *options);
 
-#endif // _PARSE_TEXT_H
\ No newline at end of file
+#endif // _PARSE_TEXT_H
@@ -0,0 +1,300 @@
+// System include
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// Project include
+#include "spellcheck.h"
+#include "perfect_hash.h"
+
+#define PERFECT_MAX_BUCKET  64  // Most words in a bucket, more means a bad
+                                // seed
+
+// Work arrays of a build
+typedef struct {
+    const uint64_t  *keys;      // Key of every word
+    uint32_t        count;      // Words
+    uint32_t        buckets;    // Buckets
+    uint32_t        *starts;    // First member of every bucket, buckets + 1
+    uint32_t        *members;   // Words, bucket after bucket
+    uint32_t        *order;     // Buckets, biggest first
+    uint64_t        *taken;     // One bit per slot
+    uint32_t        *slot_words;// Word of every slot
+    uint32_t        *pilots;    // Pilot of every bucket
+}PerfectBuild;
+
+// Static function declarations
+static int placeBuckets(PerfectBuild *build);
+static void sortBuckets(PerfectBuild *build);
+
+
+int perfectBuild(PerfectHash *hash, const char *const *words, const uint32_t *lengths, uint32_t count)
+{
+    int rc = NOK;
+    PerfectBuild build;
+    uint64_t *keys = NULL;
+    uint32_t *places = NULL, *offsets = NULL;
+    char *pool = NULL;
+    size_t pool_size = 0;
+
+    assert(hash != NULL);
+    assert(count > 0);
+
+    hash->count = 0;
+    hash->memory = NULL;
+    hash->size = 0;
+
+    build.count = count;
+    build.buckets = count / PERFECT_LAMBDA + 1;
+    for (uint32_t word = 0; word < count; word++)
+    {
+        pool_size += lengths[word] + 2;
+    }
+    if (pool_size > UINT32_MAX)
+    {
+        printf("ERROR: Words too big for the perfect hash (%zu bytes)\n", pool_size);
+        return NOK;
+    }
+
+    // Pilots, offsets and pool (padded) in one block, the rest only for the
+    // build
+    hash->size = (build.buckets + count) * sizeof(uint32_t) + pool_size + PERFECT_PAD;
+    hash->memory = malloc(hash->size);
+    keys = (uint64_t *)malloc(count * sizeof(uint64_t));
+    places = (uint32_t *)malloc(count * sizeof(uint32_t));
+    build.starts = (uint32_t *)malloc((build.buckets + 1) * sizeof(uint32_t));
+    build.members = (uint32_t *)malloc(count * sizeof(uint32_t));
+    build.order = (uint32_t *)malloc(build.buckets * sizeof(uint32_t));
+    build.taken = (uint64_t *)malloc((count / 64 + 1) * sizeof(uint64_t));
+    build.slot_words = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (hash->memory == NULL || keys == NULL || places == NULL || build.starts == NULL ||
+        build.members == NULL || build.order == NULL || build.taken == NULL || build.slot_words == NULL)
+    {
+        printf("ERROR: Perfect hash of %u words out of memory\n", count);
+    }
+    else
+    {
+        build.pilots = (uint32_t *)hash->memory;
+        build.keys = keys;
+        offsets = build.pilots + build.buckets;
+        pool = (char *)(offsets + count);
+
+        // Every word after its length byte, the offset is the word
+        pool_size = 0;
+        for (uint32_t word = 0; word < count; word++)
+        {
+            pool[pool_size++] = (char)((lengths[word] < PERFECT_LONG) ? lengths[word] : PERFECT_LONG);
+            places[word] = (uint32_t)pool_size;
+            memcpy(pool + pool_size, words[word], lengths[word]);
+            pool_size += lengths[word];
+            pool[pool_size++] = 0;
+        }
+        memset(pool + pool_size, 0, PERFECT_PAD);
+
+        // A seed fails only with two words of the same key (or a huge
+        // bucket), the next one will split them
+        for (unsigned int attempt = 0; rc != OK && attempt < PERFECT_SEEDS; attempt++)
+        {
+            hash->seed = perfectMix(attempt + 1);
+            for (uint32_t word = 0; word < count; word++)
+            {
+                keys[word] = perfectKey(words[word], lengths[word], hash->seed);
+            }
+            rc = placeBuckets(&build);
+        }
+        if (rc == OK)
+        {
+            for (uint32_t slot = 0; slot < count; slot++)
+            {
+                offsets[slot] = places[build.slot_words[slot]];
+            }
+            hash->pilots = build.pilots;
+            hash->offsets = offsets;
+            hash->pool = pool;
+            hash->pool_size = pool_size;
+            hash->buckets = build.buckets;
+            hash->count = count;
+        }
+        else
+        {
+            printf("ERROR: No perfect hash found for %u words (duplicates?)\n", count);
+        }
+    }
+
+    free(build.slot_words);
+    free(build.taken);
+    free(build.order);
+    free(build.members);
+    free(build.starts);
+    free(places);
+    free(keys);
+    if (rc != OK)
+    {
+        free(hash->memory);
+        hash->memory = NULL;
+        hash->size = 0;
+    }
+    return rc;
+}
+
+void perfectRelease(PerfectHash *hash)
+{
+    assert(hash != NULL);
+
+    free(hash->memory);
+    hash->memory = NULL;
+    hash->size = 0;
+    hash->pilots = NULL;
+    hash->offsets = NULL;
+    hash->pool = NULL;
+    hash->pool_size = 0;
+    hash->count = 0;
+    hash->buckets = 0;
+}
+
+
+
+/*******************************************************************************
+ * Static functions
+ ******************************************************************************/
+
+/******************************************************************************
+ * placeBuckets
+ *
+ * @param PerfectBuild *build keys set, arrays allocated
+ *
+ * Give every bucket, biggest first, the first pilot sending all its words
+ * to free slots, different from each other. NOK if a bucket can't be placed
+ * (two words with the same key) or is too big: the seed is bad
+ */
+static int placeBuckets(PerfectBuild *build)
+{
+    uint32_t slots[PERFECT_MAX_BUCKET];
+
+    sortBuckets(build);
+    if (build->starts[build->order[0] + 1] - build->starts[build->order[0]] > PERFECT_MAX_BUCKET)
+    {
+        return NOK;
+    }
+    memset(build->taken, 0, (build->count / 64 + 1) * sizeof(uint64_t));
+    memset(build->pilots, 0, build->buckets * sizeof(uint32_t));
+
+    for (uint32_t rank = 0; rank < build->buckets; rank++)
+    {
+        uint32_t bucket = build->order[rank];
+        const uint32_t *members = build->members + build->starts[bucket];
+        uint32_t size = build->starts[bucket + 1] - build->starts[bucket], pilot = 0;
+
+        if (size == 0)
+        {
+            // Only empty buckets are left
+            break;
+        }
+        // Words of the same key land on the same slot whatever the pilot
+        for (uint32_t first = 0; first < size; first++)
+        {
+            for (uint32_t second = first + 1; second < size; second++)
+            {
+                if (build->keys[members[first]] == build->keys[members[second]])
+                {
+                    return NOK;
+                }
+            }
+        }
+
+        for ( ; pilot < PERFECT_MAX_PILOT; pilot++)
+        {
+            uint32_t placed = 0;
+
+            for ( ; placed < size; placed++)
+            {
+                uint32_t slot = perfectSlot(build->keys[members[placed]], pilot, build->count), other = 0;
+
+                if (build->taken[slot / 64] & (1ull << (slot % 64)))
+                {
+                    break;
+                }
+                while (other < placed && slots[other] != slot)
+                {
+                    other++;
+                }
+                if (other < placed)
+                {
+                    break;
+                }
+                slots[placed] = slot;
+            }
+            if (placed == size)
+            {
+                break;
+            }
+        }
+        if (pilot == PERFECT_MAX_PILOT)
+        {
+            return NOK;
+        }
+
+        build->pilots[bucket] = pilot;
+        for (uint32_t member = 0; member < size; member++)
+        {
+            build->taken[slots[member] / 64] |= 1ull << (slots[member] % 64);
+            build->slot_words[slots[member]] = members[member];
+        }
+    }
+    return OK;
+}
+
+/******************************************************************************
+ * sortBuckets
+ *
+ * @param PerfectBuild *build keys set, arrays allocated
+ *
+ * Group the words by bucket (starts, members), then sort the buckets by
+ * size, biggest first (order). Both are counting sorts
+ */
+static void sortBuckets(PerfectBuild *build)
+{
+    uint32_t sizes[PERFECT_MAX_BUCKET + 2];
+
+    memset(build->starts, 0, (build->buckets + 1) * sizeof(uint32_t));
+    for (uint32_t word = 0; word < build->count; word++)
+    {
+        build->starts[perfectBucket(build->keys[word], build->buckets) + 1]++;
+    }
+    for (uint32_t bucket = 0; bucket < build->buckets; bucket++)
+    {
+        build->starts[bucket + 1] += build->starts[bucket];
+    }
+    // starts[bucket] is moved to the end of the bucket while filling, then
+    // back
+    for (uint32_t word = 0; word < build->count; word++)
+    {
+        build->members[build->starts[perfectBucket(build->keys[word], build->buckets)]++] = word;
+    }
+    memmove(build->starts + 1, build->starts, build->buckets * sizeof(uint32_t));
+    build->starts[0] = 0;
+
+    // Sizes over PERFECT_MAX_BUCKET are counted with it, placeBuckets
+    // rejects them anyway
+    memset(sizes, 0, sizeof(sizes));
+    for (uint32_t bucket = 0; bucket < build->buckets; bucket++)
+    {
+        uint32_t size = build->starts[bucket + 1] - build->starts[bucket];
+
+        sizes[(size > PERFECT_MAX_BUCKET) ? 0 : PERFECT_MAX_BUCKET + 1 - size]++;
+    }
+    for (uint32_t size = 1; size < PERFECT_MAX_BUCKET + 2; size++)
+    {
+        sizes[size] += sizes[size - 1];
+    }
+    // sizes[rank] is now the end of the ranks of a size, fill backwards so
+    // the buckets stay in index order within a size
+    for (uint32_t bucket = build->buckets; bucket-- > 0; )
+    {
+        uint32_t size = build->starts[bucket + 1] - build->starts[bucket];
+
+        build->order[--sizes[(size > PERFECT_MAX_BUCKET) ? 0 : PERFECT_MAX_BUCKET + 1 - size]] = bucket;
+    }
+}
@@ -0,0 +1,222 @@
+#ifndef _PERFECT_HASH_H
+#define _PERFECT_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "case_fold.h"
+
+/*******************************************************************************
+ * PERFECT HASH - Minimal perfect hash of a fixed word list
+ *
+ * A hash function made for one set of words: every word of the set gets its
+ * own slot, from 0 to count - 1, no two words share one and no slot is
+ * empty. A lookup is one hash, one slot and one compare (a word not in the
+ * set lands on the slot of some word, the compare rejects it).
+ *
+ * The words are split in buckets by their hash, about PERFECT_LAMBDA words
+ * per bucket. Every bucket has a pilot, a number mixed with the hash of its
+ * words to give their slots:
+ *
+ *   key = perfectKey(word)
+ *   bucket = high bits of key                 -> pilot = pilots[bucket]
+ *   slot = mix(key ^ pilot)                   -> offsets[slot]
+ *   pool + offsets[slot] == word ?
+ *
+ * The build (hash and displace, as CHD and PTHash) places the buckets from
+ * the biggest to the smallest: for every bucket it tries pilots 0, 1, ...
+ * until all its words land on free slots. Big buckets go first, while most
+ * slots are free; at the end only single words are left, they need about
+ * count / free tries each.
+ *
+ * The words are in one pool, in the order they were given, folded and NULL
+ * terminated, after a byte with their length (255 for 255 or more), so
+ * the compare knows at once a word of another length. offsets is the only
+ * per word array: with PERFECT_LAMBDA 4 the index costs 5 bytes per word,
+ * the words their length + 2. PERFECT_PAD zero bytes follow the pool (in
+ * memory and in the image): compareWord loads the tail of a word as a whole
+ * block, the last word must not end the allocation.
+ *
+ * perfectKey, perfectSlot, perfectMatch and perfectLookup are static
+ * inline, they run once per word of the document.
+ *
+ ******************************************************************************/
+
+#define PERFECT_LAMBDA      4           // Words per bucket, on average
+#define PERFECT_MAX_PILOT   (1u << 24)  // Pilots tried for a bucket
+#define PERFECT_SEEDS       8           // Seeds tried before giving up
+#define PERFECT_LONG        255         // Length byte of the long words
+#define PERFECT_PAD         15          // Zero bytes after the pool, the
+                                        // block compareWord reads past a word
+
+typedef struct {
+    const uint32_t  *pilots;    // Pilot of every bucket
+    const uint32_t  *offsets;   // Word of every slot, offset in pool
+    const char      *pool;      // Words, folded, NULL terminated, every
+                                // one after its length byte
+    uint32_t        count;      // Words (and slots), 0 if no hash
+    uint32_t        buckets;    // Buckets
+    uint64_t        seed;       // Seed of perfectKey
+    size_t          pool_size;  // Bytes of the pool, PERFECT_PAD not
+                                // counted
+    void            *memory;    // Arrays and pool, if built here, NULL
+                                // if they are in a mapped image
+    size_t          size;       // Bytes of memory
+}PerfectHash;
+
+
+/*
+ * perfectMix
+ *
+ * Finalizer of MurmurHash3: every bit of the input moves every bit of the
+ * output
+ *
+ * @param uint64_t value value to mix
+ * @return the mixed value
+ *
+ */
+static inline uint64_t perfectMix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDull;
+    value ^= value >> 33;
+    value *= 0xC4CEB9FE1A85EC53ull;
+    value ^= value >> 33;
+    return value;
+}
+
+
+/*
+ * perfectKey
+ *
+ * Hash a word, ignoring the case: FNV-1a on the folded bytes, then mixed
+ *
+ * @param const char * word word (not NULL terminated)
+ * @param size_t       length length of the word
+ * @param uint64_t     seed seed of the hash
+ * @return the key of the word
+ *
+ */
+static inline uint64_t perfectKey(const char *word, size_t length, uint64_t seed)
+{
+    uint64_t key = 14695981039346656037ull ^ seed;
+
+    for (size_t pos = 0; pos < length; pos++)
+    {
+        unsigned char byte = (unsigned char)word[pos];
+
+        byte += ((unsigned char)(byte - 'A') < 26) ? 0x20 : 0;
+        key = (key ^ byte) * 1099511628211ull;
+    }
+    return perfectMix(key);
+}
+
+
+/*
+ * perfectSlot
+ *
+ * Slot of a key with a pilot
+ *
+ * @param uint64_t key perfectKey of the word
+ * @param uint32_t pilot pilot of the bucket of the key
+ * @param uint32_t count number of slots
+ * @return the slot, 0 to count - 1
+ *
+ */
+static inline uint32_t perfectSlot(uint64_t key, uint32_t pilot, uint32_t count)
+{
+    uint64_t mixed = perfectMix(key ^ ((pilot + 1ull) * 0x9E3779B97F4A7C15ull));
+
+    // Multiply and shift instead of a modulo
+    return (uint32_t)(((mixed & 0xFFFFFFFFull) * count) >> 32);
+}
+
+
+/*
+ * perfectBucket
+ *
+ * Bucket of a key
+ *
+ * @param uint64_t key perfectKey of the word
+ * @param uint32_t buckets number of buckets
+ * @return the bucket, 0 to buckets - 1
+ *
+ */
+static inline uint32_t perfectBucket(uint64_t key, uint32_t buckets)
+{
+    return (uint32_t)(((key >> 32) * buckets) >> 32);
+}
+
+
+/*
+ * perfectMatch
+ *
+ * Compare a word with the word of its slot, ignoring the case
+ *
+ * @param const PerfectHash * hash built (or loaded) hash, with count != 0
+ * @param uint32_t            slot slot of the word
+ * @param const char        * word word to search (not NULL terminated)
+ * @param size_t              length length of the word
+ * @return 1 if the word is the one of the slot, 0 otherwise
+ *
+ */
+static inline int perfectMatch(const PerfectHash *hash, uint32_t slot, const char *word, size_t length)
+{
+    const char *stored = hash->pool + hash->offsets[slot];
+
+    if (length < PERFECT_LONG)
+    {
+        return (unsigned char)stored[-1] == length && compareWord(stored, word, length);
+    }
+    return (unsigned char)stored[-1] == PERFECT_LONG && strlen(stored) == length && compareWord(stored, word, length);
+}
+
+
+/*
+ * perfectLookup
+ *
+ * Search a word, ignoring the case
+ *
+ * @param const PerfectHash * hash built (or loaded) hash, with count != 0
+ * @param const char        * word word to search (not NULL terminated)
+ * @param size_t              length length of the word
+ * @return 1 if the word is one of the words of the hash, 0 otherwise
+ *
+ */
+static inline int perfectLookup(const PerfectHash *hash, const char *word, size_t length)
+{
+    uint64_t key = perfectKey(word, length, hash->seed);
+
+    return perfectMatch(hash, perfectSlot(key, hash->pilots[perfectBucket(key, hash->buckets)], hash->count),
+                        word, length);
+}
+
+
+/*
+ * perfectBuild
+ *
+ * Build the hash of a word list, copying the words in its pool
+ *
+ * @param PerfectHash        * hash hash to build
+ * @param const char * const * words words, folded, without duplicates
+ * @param const uint32_t     * lengths length of every word, at least 1
+ * @param uint32_t             count number of words, at least 1
+ * @return OK, or NOK if out of memory or no hash was found (duplicates)
+ *
+ */
+int perfectBuild(PerfectHash *hash, const char *const *words, const uint32_t *lengths, uint32_t count);
+
+
+/*
+ * perfectRelease
+ *
+ * Free a hash built by perfectBuild (a hash in an image only forgets the
+ * mapping), the hash is empty (count 0) afterwards
+ *
+ * @param PerfectHash * hash hash to release
+ *
+ */
+void perfectRelease(PerfectHash *hash);
+
+#endif // _PERFECT_HASH_H
@@ -0,0 +1,547 @@
+// System include
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+// Project include
+#include "spellcheck.h"
+#include "report.h"
+#include "stats.h"
+
+// Longest fixed part of a finding: prefix, numbers, brackets and quotes
+#define REPORT_LINE_OVERHEAD 96
+// Worst case bytes of one word byte, a JSON \u00XX escape
+#define REPORT_ESCAPE_SIZE 6
+#define REPORT_KEPT     1024    // Findings kept allocated at first
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// Fixed pieces of every format, by ReportType
+static const char *textPrefix[] = {
+    "INFO: Mispelled word=[",
+    "INFO: Malformed word=["
+};
+static const char *typeName[] = {
+    "misspelled",
+    "malformed"
+};
+
+// Static function declarations
+static int formatWord(Report *report, ReportType type, const char *word, size_t length, unsigned int line,
+                      unsigned int column, const char *const *suggestions, int count);
+static int reserveReport(Report *report, size_t size);
+static int keepFinding(Report *report, ReportType type, size_t length, unsigned int line, unsigned int column,
+                       const char *const *suggestions, int count);
+static int writeAll(int fd, struct iovec *vector, int count);
+static inline char *putString(char *out, const char *string);
+static inline char *putNumber(char *out, unsigned int number);
+static inline char *putJson(char *out, const char *word, size_t length);
+static inline char *putList(char *out, const char *const *words, int count);
+
+
+void reportInitialize(Report *report, int fd, ReportFormat format)
+{
+    assert(report != NULL);
+
+    report->fd = fd;
+    report->format = format;
+    report->data = NULL;
+    report->used = 0;
+    report->size = 0;
+    report->findings = NULL;
+    report->kept = 0;
+    report->allocated = 0;
+    report->suggested = NULL;
+    report->suggested_used = 0;
+    report->suggested_size = 0;
+    report->keep = 0;
+}
+
+int reportWord(Report *report, ReportType type, const char *word, size_t length, unsigned int line,
+               unsigned int column)
+{
+    assert(report != NULL);
+
+    return formatWord(report, type, word, length, line, column, NULL, -1);
+}
+
+int reportSuggestions(Report *report, const char *word, size_t length, unsigned int line, unsigned int column,
+                      const char *const *suggestions, unsigned int count)
+{
+    assert(report != NULL);
+    assert(suggestions != NULL || count == 0);
+
+    return formatWord(report, REPORT_MISSPELLED, word, length, line, column, suggestions, (int)count);
+}
+
+int reportDocument(Report *report, const char *path, int error)
+{
+    size_t length = 0, escape = 0;
+    char *out = NULL;
+
+    assert(report != NULL);
+    assert(path != NULL);
+
+    length = strlen(path);
+    escape = (report->format == REPORT_JSONL) ? REPORT_ESCAPE_SIZE : 1;
+    if (reserveReport(report, length * escape + REPORT_LINE_OVERHEAD) != OK)
+    {
+        return NOK;
+    }
+
+    out = report->data + report->used;
+    if (report->format == REPORT_JSONL)
+    {
+        out = putString(out, error ? "{\"type\":\"unreadable\",\"path\":\"" : "{\"type\":\"document\",\"path\":\"");
+        out = putJson(out, path, length);
+        *out++ = '"';
+        if (error)
+        {
+            out = putString(out, ",\"errno\":");
+            out = putNumber(out, (unsigned int)error);
+        }
+        *out++ = '}';
+    }
+    else
+    {
+        if (report->format == REPORT_TSV)
+        {
+            out = putString(out, error ? "0\t0\tunreadable\t" : "0\t0\tdocument\t");
+        }
+        else
+        {
+            out = putString(out, error ? "ERROR: Can't read document=[" : "INFO: Document=[");
+        }
+        // One line, one TSV field, whatever the path
+        for (size_t pos = 0; pos < length; pos++)
+        {
+            *out++ = (path[pos] == '\t' || path[pos] == '\n') ? ' ' : path[pos];
+        }
+        if (report->format == REPORT_TEXT)
+        {
+            *out++ = ']';
+            if (error)
+            {
+                out = putString(out, " errno=[");
+                out = putNumber(out, (unsigned int)error);
+                *out++ = ']';
+            }
+        }
+    }
+    *out++ = '\n';
+    report->used = out - report->data;
+
+    if (report->fd >= 0 && report->used >= REPORT_BUFFER_SIZE)
+    {
+        return reportFlush(report, report->fd);
+    }
+    return OK;
+}
+
+void reportKeep(Report *report)
+{
+    assert(report != NULL);
+
+    report->keep = 1;
+}
+
+int reportFlush(Report *report, int fd)
+{
+    return reportFlushAll(&report, 1, fd);
+}
+
+int reportFlushAll(Report *const *reports, size_t count, int fd)
+{
+    int rc = OK;
+    struct iovec vector[IOV_MAX];
+    int used = 0;
+    STATS_TIMER(start);
+
+    assert(reports != NULL);
+
+    for (size_t index = 0; index < count; index++)
+    {
+        if (reports[index]->used != 0)
+        {
+            vector[used].iov_base = reports[index]->data;
+            vector[used].iov_len = reports[index]->used;
+            used++;
+            reports[index]->used = 0;
+        }
+        if (used == IOV_MAX || (index == count - 1 && used != 0))
+        {
+            if (writeAll(fd, vector, used) != OK)
+            {
+                rc = NOK;
+            }
+            used = 0;
+        }
+    }
+    STATS_ELAPSED(STATS_REPORT, start);
+
+    return rc;
+}
+
+void reportRelease(Report *report)
+{
+    assert(report != NULL);
+
+    free(report->data);
+    free(report->findings);
+    free(report->suggested);
+    reportInitialize(report, report->fd, report->format);
+}
+
+
+
+/*******************************************************************************
+ * Static functions
+ ******************************************************************************/
+
+/******************************************************************************
+ * formatWord
+ *
+ * @param Report *report report to add to
+ * @param ReportType type kind of finding
+ * @param const char *word word (not NULL terminated)
+ * @param size_t length length of the word
+ * @param unsigned int line line of the word
+ * @param unsigned int column column of the word
+ * @param const char *const *suggestions suggested words, NULL terminated
+ * @param int count number of suggestions, -1 to write no suggestions field
+ *
+ * Format a finding in the report format, flushing a bound report when full
+ */
+static int formatWord(Report *report, ReportType type, const char *word, size_t length, unsigned int line,
+                      unsigned int column, const char *const *suggestions, int count)
+{
+    size_t escape = (report->format == REPORT_JSONL) ? REPORT_ESCAPE_SIZE : 1;
+    size_t size = length * escape + REPORT_LINE_OVERHEAD;
+    char *out = NULL;
+
+    if (report->keep && keepFinding(report, type, length, line, column, suggestions, count) != OK)
+    {
+        return NOK;
+    }
+    // Every suggestion takes its quotes and separator too
+    for (int suggestion = 0; suggestion < count; suggestion++)
+    {
+        size += strlen(suggestions[suggestion]) * escape + 3;
+    }
+    if (reserveReport(report, size) != OK)
+    {
+        return NOK;
+    }
+
+    out = report->data + report->used;
+    switch (report->format)
+    {
+        case REPORT_TSV:
+            out = putNumber(out, line);
+            *out++ = '\t';
+            out = putNumber(out, column);
+            *out++ = '\t';
+            out = putString(out, typeName[type]);
+            *out++ = '\t';
+            memcpy(out, word, length);
+            out += length;
+            if (count >= 0)
+            {
+                *out++ = '\t';
+                out = putList(out, suggestions, count);
+            }
+            break;
+        case REPORT_JSONL:
+            out = putString(out, "{\"line\":");
+            out = putNumber(out, line);
+            out = putString(out, ",\"column\":");
+            out = putNumber(out, column);
+            out = putString(out, ",\"type\":\"");
+            out = putString(out, typeName[type]);
+            out = putString(out, "\",\"word\":\"");
+            out = putJson(out, word, length);
+            *out++ = '"';
+            if (count >= 0)
+            {
+                out = putString(out, ",\"suggestions\":[");
+                for (int suggestion = 0; suggestion < count; suggestion++)
+                {
+                    out = putString(out, (suggestion != 0) ? ",\"" : "\"");
+                    out = putJson(out, suggestions[suggestion], strlen(suggestions[suggestion]));
+                    *out++ = '"';
+                }
+                *out++ = ']';
+            }
+            *out++ = '}';
+            break;
+        default:
+            out = putString(out, textPrefix[type]);
+            memcpy(out, word, length);
+            out += length;
+            out = putString(out, "] at line=[");
+            out = putNumber(out, line);
+            *out++ = ']';
+            if (count >= 0)
+            {
+                out = putString(out, " suggestions=[");
+                out = putList(out, suggestions, count);
+                *out++ = ']';
+            }
+            break;
+    }
+    *out++ = '\n';
+    report->used = out - report->data;
+
+    if (report->fd >= 0 && report->used >= REPORT_BUFFER_SIZE)
+    {
+        return reportFlush(report, report->fd);
+    }
+    return OK;
+}
+
+/******************************************************************************
+ * keepFinding
+ *
+ * @param Report *report report keeping its findings
+ * @param ReportType type kind of finding
+ * @param size_t length length of the word
+ * @param unsigned int line line of the word
+ * @param unsigned int column column of the word
+ * @param const char *const *suggestions suggested words
+ * @param int count number of suggestions, -1 for none
+ *
+ * Add a finding to the kept ones, and its suggestions to suggested,
+ * doubling the arrays as needed
+ */
+static int keepFinding(Report *report, ReportType type, size_t length, unsigned int line, unsigned int column,
+                       const char *const *suggestions, int count)
+{
+    ReportFinding *finding = NULL;
+    size_t bytes = 0;
+
+    for (int suggestion = 0; suggestion < count; suggestion++)
+    {
+        bytes += strlen(suggestions[suggestion]) + 1;
+    }
+    if (report->suggested_used + bytes > report->suggested_size)
+    {
+        size_t size = (report->suggested_size != 0) ? 2 * report->suggested_size : REPORT_KEPT * 8;
+        char *suggested = NULL;
+
+        while (size < report->suggested_used + bytes)
+        {
+            size *= 2;
+        }
+        if ((suggested = (char *)realloc(report->suggested, size)) == NULL)
+        {
+            return NOK;
+        }
+        report->suggested = suggested;
+        report->suggested_size = size;
+    }
+
+    if (report->kept == report->allocated)
+    {
+        size_t allocated = (report->allocated != 0) ? 2 * report->allocated : REPORT_KEPT;
+        ReportFinding *findings = (ReportFinding *)realloc(report->findings, allocated * sizeof(ReportFinding));
+
+        if (findings == NULL)
+        {
+            return NOK;
+        }
+        report->findings = findings;
+        report->allocated = allocated;
+    }
+
+    finding = &report->findings[report->kept++];
+    finding->line = line;
+    finding->column = column;
+    finding->length = (unsigned int)length;
+    finding->type = type;
+    finding->suggestions = report->suggested_used;
+    finding->count = (count > 0) ? count : 0;
+    for (int suggestion = 0; suggestion < count; suggestion++)
+    {
+        size_t size = strlen(suggestions[suggestion]) + 1;
+
+        memcpy(report->suggested + report->suggested_used, suggestions[suggestion], size);
+        report->suggested_used += size;
+    }
+    return OK;
+}
+
+/******************************************************************************
+ * reserveReport
+ *
+ * @param Report *report report to grow
+ * @param size_t size bytes needed after the used ones
+ *
+ * Make room for size more bytes, doubling the buffer as needed
+ */
+static int reserveReport(Report *report, size_t size)
+{
+    if (report->used + size > report->size)
+    {
+        size_t grow = (report->size != 0) ? report->size : REPORT_BUFFER_SIZE + REPORT_LINE_OVERHEAD;
+        char *data = NULL;
+
+        while (report->used + size > grow)
+        {
+            grow *= 2;
+        }
+        if ((data = (char *)realloc(report->data, grow)) == NULL)
+        {
+            return NOK;
+        }
+        report->data = data;
+        report->size = grow;
+    }
+    return OK;
+}
+
+/******************************************************************************
+ * writeAll
+ *
+ * @param int fd descriptor to write to
+ * @param struct iovec *vector buffers to write, changed on a partial write
+ * @param int count number of buffers
+ *
+ * writev until everything is out, a pipe can take only part of it
+ */
+static int writeAll(int fd, struct iovec *vector, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, vector, count);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return NOK;
+        }
+        // Skip what went out, the first buffer left can be half written
+        while (count > 0 && (size_t)written >= vector->iov_len)
+        {
+            written -= vector->iov_len;
+            vector++;
+            count--;
+        }
+        if (count > 0)
+        {
+            vector->iov_base = (char *)vector->iov_base + written;
+            vector->iov_len -= written;
+        }
+    }
+    return OK;
+}
+
+/******************************************************************************
+ * putString
+ *
+ * @param char *out where to write
+ * @param const char *string NULL terminated string to copy
+ *
+ * Copy a string without its terminator, return the end of the copy
+ */
+static inline char *putString(char *out, const char *string)
+{
+    size_t length = strlen(string);
+
+    memcpy(out, string, length);
+    return out + length;
+}
+
+/******************************************************************************
+ * putNumber
+ *
+ * @param char *out where to write
+ * @param unsigned int number number to write
+ *
+ * Decimal digits of the number, return the end of the digits
+ */
+static inline char *putNumber(char *out, unsigned int number)
+{
+    char digits[16];
+    char *digit = digits + sizeof(digits);
+    size_t length = 0;
+
+    do
+    {
+        *--digit = '0' + number % 10;
+        number /= 10;
+    } while (number != 0);
+
+    length = digits + sizeof(digits) - digit;
+    memcpy(out, digit, length);
+    return out + length;
+}
+
+/******************************************************************************
+ * putJson
+ *
+ * @param char *out where to write, room for REPORT_ESCAPE_SIZE * length
+ * @param const char *word word to write
+ * @param size_t length length of the word
+ *
+ * Copy a word escaping what JSON doesn't allow in a string, return the end
+ * of the copy
+ */
+static inline char *putJson(char *out, const char *word, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    for (size_t pos = 0; pos < length; pos++)
+    {
+        unsigned char byte = (unsigned char)word[pos];
+
+        if (byte == '"' || byte == '\\')
+        {
+            *out++ = '\\';
+            *out++ = byte;
+        }
+        else if (byte < 0x20 || byte == 0x7F)
+        {
+            out = putString(out, "\\u00");
+            *out++ = hex[byte >> 4];
+            *out++ = hex[byte & 0xF];
+        }
+        else
+        {
+            *out++ = byte;
+        }
+    }
+    return out;
+}
+
+/******************************************************************************
+ * putList
+ *
+ * @param char *out where to write
+ * @param const char *const *words NULL terminated words
+ * @param int count number of words
+ *
+ * Copy the words separated by commas, return the end of the copy
+ */
+static inline char *putList(char *out, const char *const *words, int count)
+{
+    for (int word = 0; word < count; word++)
+    {
+        if (word != 0)
+        {
+            *out++ = ',';
+        }
+        out = putString(out, words[word]);
+    }
+    return out;
+}
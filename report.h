@@ -0,0 +1,214 @@
+#ifndef _REPORT_H
+#define _REPORT_H
+
+#include <stddef.h>
+
+/*******************************************************************************
+ * REPORT - Buffered output of the spellcheck findings
+ *
+ * Findings are formatted in a memory buffer instead of being printed one by
+ * one: no printf, the numbers are formatted by hand and the buffer goes out
+ * with write(2), no stdio locking. A report bound to a file descriptor
+ * writes the buffer out when it gets full, a report with no descriptor keeps
+ * everything until reportFlush is called: this is what the workers of a
+ * parallel check use, so the main thread can write the reports in document
+ * order, many of them with a single writev (reportFlushAll).
+ *
+ * Findings can be written as:
+ *
+ *   REPORT_TEXT   INFO: Mispelled word=[Helo] at line=[3]
+ *   REPORT_TSV    3<TAB>7<TAB>misspelled<TAB>Helo
+ *   REPORT_JSONL  {"line":3,"column":7,"type":"misspelled","word":"Helo"}
+ *
+ * With suggestions (reportSuggestions) a misspelled word gets them, best
+ * first, in a "suggestions=[]" field, in a fifth TSV column (comma
+ * separated) or in a "suggestions" array:
+ *
+ *   REPORT_TEXT   INFO: Mispelled word=[Helo] at line=[3] suggestions=[hello,halo]
+ *   REPORT_TSV    3<TAB>7<TAB>misspelled<TAB>Helo<TAB>hello,halo
+ *   REPORT_JSONL  {...,"word":"Helo","suggestions":["hello","halo"]}
+ *
+ * When many documents go to the same output (batch mode) the findings of
+ * every document follow a header telling which one they belong to, or why
+ * it couldn't be read (reportDocument):
+ *
+ *   REPORT_TEXT   INFO: Document=[notes.txt]
+ *                 ERROR: Can't read document=[gone.txt] errno=[2]
+ *   REPORT_TSV    0<TAB>0<TAB>document<TAB>notes.txt
+ *                 0<TAB>0<TAB>unreadable<TAB>gone.txt
+ *   REPORT_JSONL  {"type":"document","path":"notes.txt"}
+ *                 {"type":"unreadable","path":"gone.txt","errno":2}
+ *
+ * Tabs and endlines in a path are written as spaces in text and TSV.
+ *
+ * A report can keep its findings too, as ReportFinding (reportKeep): the
+ * incremental check (see line_cache.h) stores them per line for the next
+ * run. The suggestions of the kept findings are copied in suggested, word
+ * after word. The caller takes them and empties both (kept = 0,
+ * suggested_used = 0).
+ *
+ * Columns are bytes in the line, from 1. Words never contain whitespace, so
+ * TSV needs no quoting; JSON strings are escaped, bytes over 0x7F are copied
+ * as they are.
+ *
+ ******************************************************************************/
+
+#define REPORT_BUFFER_SIZE (256 * 1024) // Flush threshold of a bound report
+
+typedef enum {
+    REPORT_MISSPELLED = 0,      // Word not in the dictionary
+    REPORT_MALFORMED            // Word not starting with a letter
+}ReportType;
+
+typedef enum {
+    REPORT_TEXT = 0,            // INFO: lines, the historical output
+    REPORT_TSV,                 // line, column, type, word
+    REPORT_JSONL                // One JSON object per finding
+}ReportFormat;
+
+// A finding, as reportKeep keeps it
+typedef struct {
+    unsigned int    line;       // Line of the word
+    unsigned int    column;     // Column of the word
+    unsigned int    length;     // Length of the word reported
+    ReportType      type;       // Kind of finding
+    size_t          suggestions;// Offset of its suggestions in suggested
+    unsigned int    count;      // Suggestions of the word
+}ReportFinding;
+
+typedef struct {
+    int             fd;         // Descriptor to flush to, -1 to keep all
+    ReportFormat    format;     // How findings are written
+    char            *data;      // Formatted findings
+    size_t          used;       // Bytes in data
+    size_t          size;       // Bytes allocated for data
+    ReportFinding   *findings;  // Findings kept, with reportKeep
+    size_t          kept;       // Findings in findings
+    size_t          allocated;  // Findings allocated
+    char            *suggested; // Suggestions of the kept findings, NULL
+                                // terminated words
+    size_t          suggested_used; // Bytes in suggested
+    size_t          suggested_size; // Bytes allocated for suggested
+    unsigned char   keep;       // 1 if the findings are kept
+}Report;
+
+
+/*
+ * reportInitialize
+ *
+ * Initialize an empty report
+ *
+ * @param Report       * report report to initialize
+ * @param int            fd descriptor to flush to when full, -1 to keep
+ *                       everything
+ * @param ReportFormat   format how findings are written
+ *
+ */
+void reportInitialize(Report *report, int fd, ReportFormat format);
+
+
+/*
+ * reportWord
+ *
+ * Add a finding to the report
+ *
+ * @param Report     * report report to add to
+ * @param ReportType   type kind of finding
+ * @param const char * word word (not NULL terminated)
+ * @param size_t       length length of the word
+ * @param unsigned int line line of the word
+ * @param unsigned int column column of the word
+ * @return OK, NOK if out of memory or the output can't be written
+ *
+ */
+int reportWord(Report *report, ReportType type, const char *word, size_t length, unsigned int line,
+               unsigned int column);
+
+
+/*
+ * reportSuggestions
+ *
+ * Add a misspelled word with its suggestions to the report
+ *
+ * @param Report            * report report to add to
+ * @param const char        * word word (not NULL terminated)
+ * @param size_t              length length of the word
+ * @param unsigned int        line line of the word
+ * @param unsigned int        column column of the word
+ * @param const char *const * suggestions suggested words, NULL terminated,
+ *                            best first
+ * @param unsigned int        count number of suggestions, can be 0
+ * @return OK, NOK if out of memory or the output can't be written
+ *
+ */
+int reportSuggestions(Report *report, const char *word, size_t length, unsigned int line, unsigned int column,
+                      const char *const *suggestions, unsigned int count);
+
+
+/*
+ * reportDocument
+ *
+ * Add the header of a document to the report, the findings added after it
+ * are the ones of this document
+ *
+ * @param Report     * report report to add to
+ * @param const char * path path of the document
+ * @param int          error 0, or the errno of a document that can't be
+ *                     read (it has no findings)
+ * @return OK, NOK if out of memory or the output can't be written
+ *
+ */
+int reportDocument(Report *report, const char *path, int error);
+
+
+/*
+ * reportKeep
+ *
+ * Keep the findings added from now on in report->findings too, besides
+ * formatting them. Headers of documents are not kept
+ *
+ * @param Report * report report to keep the findings of
+ *
+ */
+void reportKeep(Report *report);
+
+
+/*
+ * reportFlush
+ *
+ * Write the buffered findings to a descriptor and empty the buffer
+ *
+ * @param Report * report report to flush
+ * @param int      fd descriptor to write to
+ * @return OK or NOK if the output can't be written
+ *
+ */
+int reportFlush(Report *report, int fd);
+
+
+/*
+ * reportFlushAll
+ *
+ * Write the buffered findings of many reports, in order, with as few
+ * writev calls as possible, and empty them
+ *
+ * @param Report * const * reports reports to flush
+ * @param size_t           count number of reports
+ * @param int              fd descriptor to write to
+ * @return OK or NOK if the output can't be written
+ *
+ */
+int reportFlushAll(Report *const *reports, size_t count, int fd);
+
+
+/*
+ * reportRelease
+ *
+ * Release the buffers of a report, buffered and kept findings are lost
+ *
+ * @param Report * report report to release
+ *
+ */
+void reportRelease(Report *report);
+
+#endif // _REPORT_H
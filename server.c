@@ -0,0 +1,1239 @@
+// System include
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+
+// Project include
+#include "spellcheck.h"
+#include "dictionary.h"
+#include "dict_handle.h"
+#include "parse_text.h"
+#include "file_map.h"
+#include "report.h"
+#include "server.h"
+#include "thread_pool.h"
+#include "tokenizer.h"
+#include "stats.h"
+
+#define SERVER_BACKLOG  128         // Pending connections on the socket
+#define SERVER_EVENTS   64          // Events taken from epoll at once
+#define SERVER_READ     (64 * 1024) // Room made for every read of a socket
+#define REQUEST_HEADER  4           // Bytes of a request header
+#define WATCH_EVENTS    4096        // Bytes of inotify events read at once
+
+typedef enum {
+    CONNECTION_READING = 0,     // Waiting for a complete request
+    CONNECTION_CHECKING,        // Request queued or in a worker
+    CONNECTION_SENDING          // Response being written
+}ConnectionState;
+
+// A client of the server
+typedef struct ConnectionT {
+    int             fd;
+    ConnectionState state;
+    char            *data;      // Bytes read, a request starts at 0
+    size_t          used;       // Bytes in data
+    size_t          size;       // Bytes allocated for data
+    size_t          request;    // Bytes of data taken by the request served
+    uint32_t        status;     // ServerStatus of the response
+    Report          report;     // Findings of the request served
+    unsigned char   header[SERVER_HEADER];  // Header of the response
+    size_t          sent;       // Bytes of the response sent
+    unsigned char   eof;        // Client sent everything, close when done
+    unsigned char   closed;     // Socket closed while checking, free it
+                                // when the worker is done
+    struct ConnectionT *next;       // Next in the work or done queue
+    struct ConnectionT *previous;   // Connections list, to free them all
+    struct ConnectionT *following;
+}Connection;
+
+// State shared by the event loop, the workers and the reload thread
+typedef struct {
+    DictionaryHandle    handle;     // Dictionary of the workers
+    Dictionary          *first;     // Dictionary of the caller, not freed
+    const ParseOptions  *options;
+    const ServerReload  *reload;    // How to reload, NULL for never
+    const char          *watched;   // Name of the dictionary in its
+                                    // directory, if watched
+    int                 epoll;
+    int                 listener;   // Listening socket
+    int                 signals;    // signalfd of SIGINT, SIGTERM, SIGHUP
+    int                 wake;       // eventfd, a worker has a response
+    int                 watch;      // inotify of the dictionary directory,
+                                    // -1 if not watched
+    unsigned int        next_reader;    // Next handle slot of a worker
+    Connection          *connections;   // All the connections
+    pthread_mutex_t     lock;       // Protects the queues and stop
+    pthread_cond_t      ready;      // Work queued or stop
+    Connection          *work;      // Requests to check, FIFO
+    Connection          *work_tail;
+    Connection          *done;      // Requests checked
+    pthread_cond_t      reloading;  // Reload asked or stop
+    unsigned char       pending;    // A reload is asked
+    unsigned char       stop;       // Workers have to return
+}Server;
+
+// Static function declarations
+static int openListener(const char *path);
+static void *eventLoop(void *arg);
+static void *serveWorker(void *arg);
+static void *reloadWorker(void *arg);
+static void reloadDictionary(Server *server);
+static int watchDictionary(Server *server, const char *path);
+static int readSignals(Server *server);
+static void readWatch(Server *server);
+static void askReload(Server *server);
+static void acceptClients(Server *server);
+static void readRequest(Server *server, Connection *connection);
+static void nextRequest(Server *server, Connection *connection);
+static void sendResponse(Server *server, Connection *connection);
+static void finishRequests(Server *server);
+static int watchConnection(Server *server, Connection *connection, uint32_t events);
+static void closeConnection(Server *server, Connection *connection);
+static int reserveData(Connection *connection, size_t size);
+static int readDocument(FILE *doc_fd, char **data, size_t *size);
+static int writeFully(int fd, const void *data, size_t size);
+static int readFully(int fd, void *data, size_t size);
+
+
+int runServer(const char *path, Dictionary *dictionary, const ParseOptions *options, const ServerReload *reload)
+{
+    Server server;
+    struct epoll_event event;
+    sigset_t mask;
+    pthread_t loop, reloader;
+    int reloading = 0;
+
+    assert(path != NULL);
+    assert(dictionary != NULL);
+    assert(options != NULL);
+
+    memset(&server, 0, sizeof(server));
+    if (handleInitialize(&server.handle, dictionary, options->threads) != OK)
+    {
+        return NOK;
+    }
+    server.first = dictionary;
+    server.options = options;
+    server.reload = reload;
+    server.signals = server.wake = server.epoll = server.watch = -1;
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+    pthread_cond_init(&server.reloading, NULL);
+
+    // Signals are taken by the loop, every thread started from here on
+    // inherits the mask
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    if ((server.listener = openListener(path)) < 0 ||
+        (server.signals = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0 ||
+        (server.wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+        (server.epoll = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        printf("ERROR: Can't start the server on %s: errno %d\n", path, errno);
+        if (server.listener >= 0)
+        {
+            close(server.listener);
+            unlink(path);
+        }
+        if (server.signals >= 0)
+        {
+            close(server.signals);
+        }
+        if (server.wake >= 0)
+        {
+            close(server.wake);
+        }
+        pthread_cond_destroy(&server.reloading);
+        pthread_cond_destroy(&server.ready);
+        pthread_mutex_destroy(&server.lock);
+        handleRelease(&server.handle);
+        return NOK;
+    }
+
+    // The special descriptors are told apart by the address of their field
+    event.events = EPOLLIN;
+    event.data.ptr = &server.listener;
+    epoll_ctl(server.epoll, EPOLL_CTL_ADD, server.listener, &event);
+    event.data.ptr = &server.signals;
+    epoll_ctl(server.epoll, EPOLL_CTL_ADD, server.signals, &event);
+    event.data.ptr = &server.wake;
+    epoll_ctl(server.epoll, EPOLL_CTL_ADD, server.wake, &event);
+
+    if (reload != NULL)
+    {
+        if (pthread_create(&reloader, NULL, reloadWorker, &server) == 0)
+        {
+            reloading = 1;
+        }
+        else
+        {
+            printf("WARNING: Can't start the reload thread: errno %d, the dictionary won't be reloaded\n", errno);
+            server.reload = NULL;
+        }
+    }
+    if (server.reload != NULL && reload->watch != NULL && watchDictionary(&server, reload->watch) != OK)
+    {
+        printf("WARNING: Can't watch %s: errno %d, reload it with SIGHUP\n", reload->watch, errno);
+    }
+
+    printf("INFO: Serving on %s with %u workers\n", path, options->threads);
+    fflush(stdout);
+
+    if (pthread_create(&loop, NULL, eventLoop, &server) == 0)
+    {
+        runWorkers(options->threads, serveWorker, &server);
+        pthread_join(loop, NULL);
+    }
+    else
+    {
+        printf("ERROR: Can't start the event loop: errno %d\n", errno);
+        pthread_mutex_lock(&server.lock);
+        server.stop = 1;
+        pthread_cond_broadcast(&server.reloading);
+        pthread_mutex_unlock(&server.lock);
+    }
+    if (reloading)
+    {
+        // A reload going on is finished first
+        pthread_join(reloader, NULL);
+    }
+
+    // Workers are gone, whatever they left in the queues can go
+    while (server.connections != NULL)
+    {
+        closeConnection(&server, server.connections);
+    }
+    // A reloaded generation is ours, the first one the caller's
+    if (server.handle.current != server.first)
+    {
+        deallocateDictionary(server.handle.current);
+        free(server.handle.current);
+    }
+    handleRelease(&server.handle);
+    if (server.watch >= 0)
+    {
+        close(server.watch);
+    }
+    close(server.epoll);
+    close(server.wake);
+    close(server.signals);
+    close(server.listener);
+    unlink(path);
+    pthread_cond_destroy(&server.reloading);
+    pthread_cond_destroy(&server.ready);
+    pthread_mutex_destroy(&server.lock);
+
+    printf("INFO: Server stopped\n");
+    return OK;
+}
+
+int runClient(const char *path, FILE *doc_fd)
+{
+    int rc = NOK, fd = -1;
+    FileMap map;
+    char *data = NULL;
+    size_t size = 0;
+    ServerReply reply = {0, NULL, 0, 0};
+
+    assert(path != NULL);
+    assert(doc_fd != NULL);
+
+    if ((fd = connectServer(path)) < 0)
+    {
+        printf("ERROR: Can't connect to %s: errno %d\n", path, errno);
+        return NOK;
+    }
+
+    // A regular file goes out straight from the mapping
+    if (mapFile(doc_fd, &map, 0) == OK)
+    {
+        rc = sendRequest(fd, map.data, map.size, &reply);
+        unmapFile(&map);
+    }
+    else if (readDocument(doc_fd, &data, &size) == OK)
+    {
+        rc = sendRequest(fd, data, size, &reply);
+        free(data);
+    }
+    else
+    {
+        printf("ERROR: Can't read document: errno %d\n", errno);
+        close(fd);
+        return NOK;
+    }
+
+    if (rc != OK)
+    {
+        printf("ERROR: Request to %s failed: errno %d\n", path, errno);
+    }
+    else if (reply.status != SERVER_OK)
+    {
+        rc = NOK;
+        printf("ERROR: Server can't check the document: status %u\n", reply.status);
+    }
+    else
+    {
+        fwrite(reply.data, 1, reply.length, stdout);
+    }
+
+    releaseReply(&reply);
+    close(fd);
+    return rc;
+}
+
+int connectServer(const char *path)
+{
+    struct sockaddr_un address;
+    int fd = -1;
+
+    assert(path != NULL);
+
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0 &&
+        connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        int error = errno;
+
+        close(fd);
+        errno = error;
+        fd = -1;
+    }
+    return fd;
+}
+
+int sendRequest(int fd, const char *text, size_t size, ServerReply *reply)
+{
+    uint32_t header[SERVER_HEADER / sizeof(uint32_t)];
+    size_t length = 0;
+
+    assert(reply != NULL);
+
+    if (size > SERVER_MAX_REQUEST)
+    {
+        // Not worth sending, the server would refuse it
+        reply->status = SERVER_TOO_LARGE;
+        reply->length = 0;
+        return OK;
+    }
+
+    header[0] = htonl((uint32_t)size);
+    if (writeFully(fd, header, REQUEST_HEADER) != OK || writeFully(fd, text, size) != OK ||
+        readFully(fd, header, SERVER_HEADER) != OK)
+    {
+        return NOK;
+    }
+    reply->status = ntohl(header[0]);
+    length = ntohl(header[1]);
+
+    if (length > reply->size)
+    {
+        char *data = (char *)realloc(reply->data, length);
+
+        if (data == NULL)
+        {
+            return NOK;
+        }
+        reply->data = data;
+        reply->size = length;
+    }
+    reply->length = length;
+    return readFully(fd, reply->data, length);
+}
+
+void releaseReply(ServerReply *reply)
+{
+    assert(reply != NULL);
+
+    free(reply->data);
+    reply->data = NULL;
+    reply->length = reply->size = 0;
+}
+
+
+
+/*******************************************************************************
+ * Static functions
+ ******************************************************************************/
+
+/******************************************************************************
+ * openListener
+ *
+ * @param const char *path path of the socket
+ *
+ * Bind and listen on a non blocking Unix socket. A socket file already at
+ * path is removed only if nobody answers on it, a running server is never
+ * taken over
+ */
+static int openListener(const char *path)
+{
+    struct sockaddr_un address;
+    struct stat info;
+    int fd = -1;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+    {
+        if ((fd = connectServer(path)) >= 0)
+        {
+            close(fd);
+            errno = EADDRINUSE;
+            return -1;
+        }
+        unlink(path);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) >= 0 &&
+        (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SERVER_BACKLOG) != 0))
+    {
+        int error = errno;
+
+        close(fd);
+        errno = error;
+        fd = -1;
+    }
+    return fd;
+}
+
+/******************************************************************************
+ * eventLoop
+ *
+ * @param void *arg the Server
+ *
+ * Wait on all the sockets and handle what is ready, until SIGINT or SIGTERM
+ * comes. Then the workers (and the reload thread) are told to stop
+ */
+static void *eventLoop(void *arg)
+{
+    Server *server = (Server *)arg;
+    struct epoll_event events[SERVER_EVENTS];
+    int running = 1;
+
+    while (running)
+    {
+        int count = epoll_wait(server->epoll, events, SERVER_EVENTS, -1);
+        int finished = 0;
+
+        if (count < 0 && errno != EINTR)
+        {
+            printf("ERROR: Event loop failed: errno %d\n", errno);
+            break;
+        }
+        for (int event = 0; event < count; event++)
+        {
+            void *source = events[event].data.ptr;
+
+            if (source == &server->listener)
+            {
+                acceptClients(server);
+            }
+            else if (source == &server->signals)
+            {
+                running = readSignals(server);
+            }
+            else if (source == &server->watch)
+            {
+                readWatch(server);
+            }
+            else if (source == &server->wake)
+            {
+                finished = 1;
+            }
+            else
+            {
+                Connection *connection = (Connection *)source;
+
+                if (connection->state == CONNECTION_CHECKING)
+                {
+                    // Only a hang up gets here, the worker still owns the
+                    // connection: stop watching it, it is freed later
+                    epoll_ctl(server->epoll, EPOLL_CTL_DEL, connection->fd, NULL);
+                    connection->closed = 1;
+                }
+                else if (events[event].events & (EPOLLERR | EPOLLHUP) &&
+                         !(events[event].events & EPOLLIN))
+                {
+                    closeConnection(server, connection);
+                }
+                else if (connection->state == CONNECTION_SENDING)
+                {
+                    sendResponse(server, connection);
+                }
+                else
+                {
+                    readRequest(server, connection);
+                }
+            }
+        }
+        // After the other events: sending a response can close connections
+        // that still have an event in this batch
+        if (finished)
+        {
+            finishRequests(server);
+        }
+    }
+
+    pthread_mutex_lock(&server->lock);
+    server->stop = 1;
+    pthread_cond_broadcast(&server->ready);
+    pthread_cond_broadcast(&server->reloading);
+    pthread_mutex_unlock(&server->lock);
+
+    return NULL;
+}
+
+/******************************************************************************
+ * serveWorker
+ *
+ * @param void *arg the Server
+ *
+ * Check the queued requests until the server stops. The findings go in the
+ * report of the connection, then the connection is handed back to the loop.
+ * Every worker reads the dictionary handle through its own slot
+ */
+static void *serveWorker(void *arg)
+{
+    Server *server = (Server *)arg;
+    Tokens tokens;
+    int rc = tokensInitialize(&tokens);
+    const uint64_t one = 1;
+    unsigned int reader = nextTask(&server->next_reader);
+
+    pthread_mutex_lock(&server->lock);
+    while (!server->stop)
+    {
+        Connection *connection = server->work;
+        Dictionary *dictionary = NULL;
+
+        if (connection == NULL)
+        {
+            pthread_cond_wait(&server->ready, &server->lock);
+            continue;
+        }
+        if ((server->work = connection->next) == NULL)
+        {
+            server->work_tail = NULL;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        // The whole request is checked with the same generation
+        dictionary = handleEnter(&server->handle, reader);
+        connection->status = (rc == OK && checkText(&tokens, connection->data + REQUEST_HEADER,
+                                                    connection->request - REQUEST_HEADER, dictionary,
+                                                    &connection->report) == OK) ? SERVER_OK : SERVER_FAILED;
+        handleLeave(&server->handle, reader);
+
+        pthread_mutex_lock(&server->lock);
+        connection->next = server->done;
+        server->done = connection;
+        if (write(server->wake, &one, sizeof(one)) != sizeof(one))
+        {
+            // Fails only if the counter overflows, the loop is awake anyway
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    tokensRelease(&tokens);
+    STATS_MERGE();
+    return NULL;
+}
+
+/******************************************************************************
+ * reloadWorker
+ *
+ * @param void *arg the Server
+ *
+ * Reload the dictionary every time it is asked, until the server stops.
+ * Reloads asked while one is going on make one more
+ */
+static void *reloadWorker(void *arg)
+{
+    Server *server = (Server *)arg;
+
+    pthread_mutex_lock(&server->lock);
+    while (!server->stop)
+    {
+        if (!server->pending)
+        {
+            pthread_cond_wait(&server->reloading, &server->lock);
+            continue;
+        }
+        server->pending = 0;
+        pthread_mutex_unlock(&server->lock);
+
+        reloadDictionary(server);
+
+        pthread_mutex_lock(&server->lock);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    STATS_MERGE();
+    return NULL;
+}
+
+/******************************************************************************
+ * reloadDictionary
+ *
+ * @param Server *server the server
+ *
+ * Build a new dictionary next to the current one and swap it in. The old
+ * one is released once the workers checking with it are done. If the build
+ * fails the current one stays
+ */
+static void reloadDictionary(Server *server)
+{
+    Dictionary *dictionary = (Dictionary *)malloc(sizeof(Dictionary)), *old = NULL;
+    uint64_t start = statsClock();
+
+    printf("INFO: Reloading the dictionary\n");
+    fflush(stdout);
+
+    if (dictionary == NULL || server->reload->load(dictionary, server->reload->context) != OK)
+    {
+        printf("WARNING: Dictionary not reloaded, the current one stays\n");
+        fflush(stdout);
+        free(dictionary);
+        return;
+    }
+
+    old = handleSwap(&server->handle, dictionary);
+    deallocateDictionary(old);
+    if (old != server->first)
+    {
+        free(old);
+    }
+    printf("INFO: Dictionary reloaded in %.3fs\n", (statsClock() - start) / 1e9);
+    fflush(stdout);
+}
+
+/******************************************************************************
+ * watchDictionary
+ *
+ * @param Server *server the server
+ * @param const char *path dictionary file
+ *
+ * Watch the directory of the dictionary with inotify, the loop reloads when
+ * the file is written or replaced (editors and deployments often write a
+ * new file and rename it over the old one, watching the file would lose it)
+ */
+static int watchDictionary(Server *server, const char *path)
+{
+    const char *name = strrchr(path, '/');
+    char *directory = NULL;
+    struct epoll_event event;
+    int rc = NOK;
+
+    if ((directory = strdup(path)) == NULL)
+    {
+        errno = ENOMEM;
+        return NOK;
+    }
+    if (name != NULL)
+    {
+        // "/dict" is in "/", "dir/dict" in "dir"
+        directory[(name == path) ? 1 : name - path] = 0;
+        name++;
+    }
+    else
+    {
+        strcpy(directory, ".");
+        name = path;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = &server->watch;
+    if ((server->watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0 &&
+        inotify_add_watch(server->watch, directory, IN_CLOSE_WRITE | IN_MOVED_TO) >= 0 &&
+        epoll_ctl(server->epoll, EPOLL_CTL_ADD, server->watch, &event) == 0)
+    {
+        server->watched = name;
+        rc = OK;
+    }
+    else if (server->watch >= 0)
+    {
+        int error = errno;
+
+        close(server->watch);
+        server->watch = -1;
+        errno = error;
+    }
+    free(directory);
+    return rc;
+}
+
+/******************************************************************************
+ * readSignals
+ *
+ * @param Server *server the server
+ *
+ * Take the pending signals: SIGHUP asks a reload, SIGINT and SIGTERM stop
+ * the server (0 is returned)
+ */
+static int readSignals(Server *server)
+{
+    struct signalfd_siginfo info;
+    int running = 1;
+
+    while (read(server->signals, &info, sizeof(info)) == sizeof(info))
+    {
+        if (info.ssi_signo != SIGHUP)
+        {
+            running = 0;
+        }
+        else if (server->reload != NULL)
+        {
+            askReload(server);
+        }
+        else
+        {
+            printf("WARNING: SIGHUP ignored, this server can't reload its dictionary\n");
+            fflush(stdout);
+        }
+    }
+    return running;
+}
+
+/******************************************************************************
+ * readWatch
+ *
+ * @param Server *server the server
+ *
+ * Take the pending inotify events of the dictionary directory, a reload is
+ * asked if one of them is about the dictionary file
+ */
+static void readWatch(Server *server)
+{
+    uint64_t buffer[WATCH_EVENTS / sizeof(uint64_t)];  // Aligned for the events
+    char *events = (char *)buffer;
+    ssize_t got = 0;
+    int changed = 0;
+
+    while ((got = read(server->watch, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *next = events; next < events + got; )
+        {
+            const struct inotify_event *event = (const struct inotify_event *)next;
+
+            if (event->len != 0 && strcmp(event->name, server->watched) == 0)
+            {
+                changed = 1;
+            }
+            next += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    if (changed)
+    {
+        askReload(server);
+    }
+}
+
+/******************************************************************************
+ * askReload
+ *
+ * @param Server *server the server
+ *
+ * Wake the reload thread up, it doesn't block the loop
+ */
+static void askReload(Server *server)
+{
+    pthread_mutex_lock(&server->lock);
+    server->pending = 1;
+    pthread_cond_signal(&server->reloading);
+    pthread_mutex_unlock(&server->lock);
+}
+
+/******************************************************************************
+ * acceptClients
+ *
+ * @param Server *server the server
+ *
+ * Accept all the pending clients, every one gets a non blocking socket
+ * watched for reading
+ */
+static void acceptClients(Server *server)
+{
+    int fd = -1;
+
+    while ((fd = accept4(server->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        Connection *connection = (Connection *)calloc(1, sizeof(Connection));
+
+        if (connection == NULL)
+        {
+            printf("WARNING: Out of memory, client refused\n");
+            close(fd);
+            continue;
+        }
+        connection->fd = fd;
+        connection->state = CONNECTION_READING;
+        reportInitialize(&connection->report, -1, server->options->format);
+
+        connection->following = server->connections;
+        if (server->connections != NULL)
+        {
+            server->connections->previous = connection;
+        }
+        server->connections = connection;
+
+        if (watchConnection(server, connection, EPOLLIN) != OK)
+        {
+            closeConnection(server, connection);
+        }
+    }
+}
+
+/******************************************************************************
+ * readRequest
+ *
+ * @param Server *server the server
+ * @param Connection *connection client with something to read
+ *
+ * Read all that the socket has, then see if a request is complete
+ */
+static void readRequest(Server *server, Connection *connection)
+{
+    while (!connection->eof)
+    {
+        ssize_t got = 0;
+
+        if (reserveData(connection, SERVER_READ) != OK)
+        {
+            printf("WARNING: Out of memory, client dropped\n");
+            closeConnection(server, connection);
+            return;
+        }
+        got = read(connection->fd, connection->data + connection->used, connection->size - connection->used);
+        if (got > 0)
+        {
+            connection->used += got;
+        }
+        else if (got == 0)
+        {
+            connection->eof = 1;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            break;
+        }
+        else if (errno != EINTR)
+        {
+            closeConnection(server, connection);
+            return;
+        }
+    }
+    nextRequest(server, connection);
+}
+
+/******************************************************************************
+ * nextRequest
+ *
+ * @param Server *server the server
+ * @param Connection *connection client waiting for its next request
+ *
+ * Queue the request at the front of the data if it is complete, otherwise
+ * wait for more bytes (or close, if none will come)
+ */
+static void nextRequest(Server *server, Connection *connection)
+{
+    uint32_t length = 0;
+
+    if (connection->used >= REQUEST_HEADER)
+    {
+        memcpy(&length, connection->data, sizeof(length));
+        length = ntohl(length);
+
+        if (length > SERVER_MAX_REQUEST)
+        {
+            // Answer and close, the rest of the stream can't be trusted
+            connection->status = SERVER_TOO_LARGE;
+            connection->request = connection->used;
+            connection->eof = 1;
+            sendResponse(server, connection);
+            return;
+        }
+        if (connection->used >= REQUEST_HEADER + (size_t)length)
+        {
+            connection->request = REQUEST_HEADER + (size_t)length;
+            connection->state = CONNECTION_CHECKING;
+            // Only hang ups while the worker has it
+            if (watchConnection(server, connection, 0) != OK)
+            {
+                closeConnection(server, connection);
+                return;
+            }
+
+            pthread_mutex_lock(&server->lock);
+            connection->next = NULL;
+            if (server->work_tail != NULL)
+            {
+                server->work_tail->next = connection;
+            }
+            else
+            {
+                server->work = connection;
+            }
+            server->work_tail = connection;
+            pthread_cond_signal(&server->ready);
+            pthread_mutex_unlock(&server->lock);
+            return;
+        }
+        // The whole request has to fit, it is checked in place
+        if (reserveData(connection, REQUEST_HEADER + (size_t)length - connection->used) != OK)
+        {
+            printf("WARNING: Out of memory, client dropped\n");
+            closeConnection(server, connection);
+            return;
+        }
+    }
+
+    if (connection->eof)
+    {
+        closeConnection(server, connection);
+    }
+    else if (watchConnection(server, connection, EPOLLIN) != OK)
+    {
+        closeConnection(server, connection);
+    }
+}
+
+/******************************************************************************
+ * sendResponse
+ *
+ * @param Server *server the server
+ * @param Connection *connection client with a response to send
+ *
+ * Write as much of the response as the socket takes, wait for the socket if
+ * it is full. When it is all out, the next request of the client is served
+ */
+static void sendResponse(Server *server, Connection *connection)
+{
+    size_t total = SERVER_HEADER + connection->report.used;
+
+    if (connection->state != CONNECTION_SENDING)
+    {
+        uint32_t status = htonl(connection->status), length = htonl((uint32_t)connection->report.used);
+
+        memcpy(connection->header, &status, sizeof(status));
+        memcpy(connection->header + sizeof(status), &length, sizeof(length));
+        connection->sent = 0;
+        connection->state = CONNECTION_SENDING;
+    }
+
+    while (connection->sent < total)
+    {
+        struct iovec vector[2];
+        struct msghdr message;
+        int count = 0;
+        ssize_t written = 0;
+
+        if (connection->sent < SERVER_HEADER)
+        {
+            vector[count].iov_base = connection->header + connection->sent;
+            vector[count++].iov_len = SERVER_HEADER - connection->sent;
+        }
+        if (connection->report.used != 0)
+        {
+            size_t skip = (connection->sent > SERVER_HEADER) ? connection->sent - SERVER_HEADER : 0;
+
+            vector[count].iov_base = connection->report.data + skip;
+            vector[count++].iov_len = connection->report.used - skip;
+        }
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = vector;
+        message.msg_iovlen = count;
+
+        // No SIGPIPE if the client is gone, we get EPIPE
+        if ((written = sendmsg(connection->fd, &message, MSG_NOSIGNAL)) >= 0)
+        {
+            connection->sent += written;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            if (watchConnection(server, connection, EPOLLOUT) != OK)
+            {
+                closeConnection(server, connection);
+            }
+            return;
+        }
+        else if (errno != EINTR)
+        {
+            closeConnection(server, connection);
+            return;
+        }
+    }
+
+    // Done, drop the request from the data
+    connection->used -= connection->request;
+    memmove(connection->data, connection->data + connection->request, connection->used);
+    connection->request = 0;
+    connection->report.used = 0;
+    connection->state = CONNECTION_READING;
+
+    nextRequest(server, connection);
+}
+
+/******************************************************************************
+ * finishRequests
+ *
+ * @param Server *server the server
+ *
+ * Take the requests checked by the workers and send their responses
+ */
+static void finishRequests(Server *server)
+{
+    Connection *connection = NULL;
+    uint64_t count = 0;
+
+    if (read(server->wake, &count, sizeof(count)) != sizeof(count))
+    {
+        // Spurious wake up, the done list tells
+    }
+    pthread_mutex_lock(&server->lock);
+    connection = server->done;
+    server->done = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    while (connection != NULL)
+    {
+        Connection *next = connection->next;
+
+        if (connection->closed)
+        {
+            closeConnection(server, connection);
+        }
+        else
+        {
+            sendResponse(server, connection);
+        }
+        connection = next;
+    }
+}
+
+/******************************************************************************
+ * watchConnection
+ *
+ * @param Server *server the server
+ * @param Connection *connection client to watch
+ * @param uint32_t events EPOLLIN, EPOLLOUT or 0 (hang ups only)
+ *
+ * Set what epoll reports for the client, adding it the first time
+ */
+static int watchConnection(Server *server, Connection *connection, uint32_t events)
+{
+    struct epoll_event event;
+
+    event.events = events;
+    event.data.ptr = connection;
+    if (epoll_ctl(server->epoll, EPOLL_CTL_MOD, connection->fd, &event) == 0 ||
+        (errno == ENOENT && epoll_ctl(server->epoll, EPOLL_CTL_ADD, connection->fd, &event) == 0))
+    {
+        return OK;
+    }
+    return NOK;
+}
+
+/******************************************************************************
+ * closeConnection
+ *
+ * @param Server *server the server
+ * @param Connection *connection client to close, no worker holds it
+ *
+ * Close the socket (epoll forgets it) and free everything of the client
+ */
+static void closeConnection(Server *server, Connection *connection)
+{
+    if (connection->previous != NULL)
+    {
+        connection->previous->following = connection->following;
+    }
+    else
+    {
+        server->connections = connection->following;
+    }
+    if (connection->following != NULL)
+    {
+        connection->following->previous = connection->previous;
+    }
+
+    close(connection->fd);
+    reportRelease(&connection->report);
+    free(connection->data);
+    free(connection);
+}
+
+/******************************************************************************
+ * reserveData
+ *
+ * @param Connection *connection client reading
+ * @param size_t size bytes needed after the used ones
+ *
+ * Make room for size more bytes of the request, doubling the buffer
+ */
+static int reserveData(Connection *connection, size_t size)
+{
+    if (connection->used + size > connection->size)
+    {
+        size_t grow = (connection->size != 0) ? connection->size : SERVER_READ;
+        char *data = NULL;
+
+        while (connection->used + size > grow)
+        {
+            grow *= 2;
+        }
+        if ((data = (char *)realloc(connection->data, grow)) == NULL)
+        {
+            return NOK;
+        }
+        connection->data = data;
+        connection->size = grow;
+    }
+    return OK;
+}
+
+/******************************************************************************
+ * readDocument
+ *
+ * @param FILE *doc_fd stream that can't be mapped (pipe, stdin)
+ * @param char **data filled with the document, to free
+ * @param size_t *size filled with the bytes of the document
+ *
+ * Read a whole stream in memory, up to one byte over SERVER_MAX_REQUEST
+ * (enough to know it is too large)
+ */
+static int readDocument(FILE *doc_fd, char **data, size_t *size)
+{
+    size_t allocated = SERVER_READ;
+
+    *size = 0;
+    if ((*data = (char *)malloc(allocated)) == NULL)
+    {
+        return NOK;
+    }
+    while (*size <= SERVER_MAX_REQUEST)
+    {
+        size_t got = 0;
+
+        if (*size == allocated)
+        {
+            char *grow = (char *)realloc(*data, allocated * 2);
+
+            if (grow == NULL)
+            {
+                free(*data);
+                return NOK;
+            }
+            *data = grow;
+            allocated *= 2;
+        }
+        if ((got = fread(*data + *size, 1, allocated - *size, doc_fd)) == 0)
+        {
+            break;
+        }
+        *size += got;
+    }
+    if (ferror(doc_fd))
+    {
+        free(*data);
+        return NOK;
+    }
+    return OK;
+}
+
+/******************************************************************************
+ * writeFully
+ *
+ * @param int fd blocking socket
+ * @param const void *data bytes to write
+ * @param size_t size number of bytes
+ *
+ * send until everything is out
+ */
+static int writeFully(int fd, const void *data, size_t size)
+{
+    const char *bytes = (const char *)data;
+
+    while (size > 0)
+    {
+        // No SIGPIPE if the server is gone, we get EPIPE
+        ssize_t written = send(fd, bytes, size, MSG_NOSIGNAL);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return NOK;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return OK;
+}
+
+/******************************************************************************
+ * readFully
+ *
+ * @param int fd blocking socket
+ * @param void *data where bytes go
+ * @param size_t size number of bytes
+ *
+ * read exactly size bytes, the end of the stream is an error
+ */
+static int readFully(int fd, void *data, size_t size)
+{
+    char *bytes = (char *)data;
+
+    while (size > 0)
+    {
+        ssize_t got = read(fd, bytes, size);
+
+        if (got <= 0)
+        {
+            if (got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return NOK;
+        }
+        bytes += got;
+        size -= got;
+    }
+    return OK;
+}
@@ -0,0 +1,142 @@
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dictionary.h"
+#include "parse_text.h"
+
+/*******************************************************************************
+ * SERVER - Resident spellcheck over a local Unix socket
+ *
+ * The dictionary is loaded once and documents are checked on request, so a
+ * small document doesn't pay the dictionary build anymore.
+ *
+ * Every request and every response is a frame, numbers are big endian:
+ *
+ *   request   | length (4) | document (length bytes)                  |
+ *   response  | status (4) | length (4) | findings (length bytes)     |
+ *
+ * Findings are written in the format the server was started with (text,
+ * tsv or jsonl, see report.h), lines start from 1 in every document.
+ * A client can send many requests on the same connection, even without
+ * waiting for the responses: they are answered in order. A request longer
+ * than SERVER_MAX_REQUEST gets SERVER_TOO_LARGE and the connection closed.
+ *
+ * One thread runs an epoll loop: it accepts the clients and reads and writes
+ * all the sockets, never blocking. A complete request goes to a queue served
+ * by a pool of workers (every worker has its own tokenizer buffers), the
+ * worker hands the findings back to the loop through an eventfd. A
+ * connection has one request at a time in the workers, so the responses
+ * keep the order of the requests. SIGINT or SIGTERM stop the server.
+ *
+ * SIGHUP (or, when watched, a new version of the dictionary file) reloads
+ * the dictionary while the requests go on: a reload thread builds the new
+ * generation next to the current one, then swaps it in the handle the
+ * workers read through (see dict_handle.h). The requests already checking
+ * finish with the old generation, it is freed when they are all done. A
+ * reload that fails keeps the current dictionary.
+ *
+ ******************************************************************************/
+
+#define SERVER_HEADER       8                   // Bytes of a response header
+#define SERVER_MAX_REQUEST  (16 * 1024 * 1024)  // Longest document accepted
+
+typedef enum {
+    SERVER_OK = 0,              // Document checked, findings follow
+    SERVER_TOO_LARGE,           // Document over SERVER_MAX_REQUEST
+    SERVER_FAILED               // Check failed (out of memory)
+}ServerStatus;
+
+typedef struct {
+    uint32_t        status;     // ServerStatus of the response
+    char            *data;      // Findings
+    size_t          length;     // Bytes in data
+    size_t          size;       // Bytes allocated for data
+}ServerReply;
+
+// Builds a dictionary, NOK leaves nothing to release
+typedef int (*ServerLoader)(Dictionary *dictionary, void *context);
+
+typedef struct {
+    ServerLoader    load;       // Builds the new generation of a reload
+    void            *context;   // Given to load
+    const char      *watch;     // Dictionary file to watch, a new version
+                                // of it reloads; NULL for SIGHUP only
+}ServerReload;
+
+
+/*
+ * runServer
+ *
+ * Listen on a Unix socket and check the documents of the clients until
+ * SIGINT or SIGTERM, reloading the dictionary on SIGHUP. A stale socket
+ * file left at path is replaced, the socket file is removed on exit
+ *
+ * @param const char         * path path of the socket
+ * @param Dictionary         * dictionary first dictionary to check against,
+ *                             released (not freed) if a reload replaces it:
+ *                             the caller still deallocates it at the end
+ * @param const ParseOptions * options workers (threads) and findings format
+ * @param const ServerReload * reload how to build a new dictionary, NULL to
+ *                             keep the first one (SIGHUP is ignored)
+ * @return OK or NOK if the server can't start
+ *
+ */
+int runServer(const char *path, Dictionary *dictionary, const ParseOptions *options, const ServerReload *reload);
+
+
+/*
+ * runClient
+ *
+ * Send a document to a server and print the findings on stdout
+ *
+ * @param const char * path path of the server socket
+ * @param FILE       * doc_fd document to check
+ * @return OK or NOK
+ *
+ */
+int runClient(const char *path, FILE *doc_fd);
+
+
+/*
+ * connectServer
+ *
+ * Connect to a server
+ *
+ * @param const char * path path of the server socket
+ * @return the connected socket or -1
+ *
+ */
+int connectServer(const char *path);
+
+
+/*
+ * sendRequest
+ *
+ * Send a document on a connection and wait for the response. The reply
+ * buffer is reused from one request to the next
+ *
+ * @param int           fd connected socket
+ * @param const char  * text document
+ * @param size_t        size bytes of the document
+ * @param ServerReply * reply status and findings, initialize with zeros
+ * @return OK or NOK if the connection fails
+ *
+ */
+int sendRequest(int fd, const char *text, size_t size, ServerReply *reply);
+
+
+/*
+ * releaseReply
+ *
+ * Free the buffer of a reply
+ *
+ * @param ServerReply * reply reply to release
+ *
+ */
+void releaseReply(ServerReply *reply);
+
+#endif // _SERVER_H
@@ -1,15 +1,67 @@
 // System include
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
 
 // Project include
 #include "spellcheck.h"
 #include "dictionary.h"
+#include "dict_image.h"
 #include "parse_text.h"
+#include "stats.h"
+#include "server.h"
+
+// A layer stacked on the dictionary
+typedef struct {
+    const char      *path;      // Word list (or image)
+    unsigned char   exclude;    // 1 if its words are removed (--exclude)
+}LayerOption;
+
+// Command line options
+typedef struct {
+    const char      *compile;   // Text dictionary to compile (--compile-dict)
+    const char      *output;    // Image file to write (-o)
+    const char      *serve;     // Socket to serve the dictionary on (--serve)
+    const char      *connect;   // Server socket to send the document to
+    const char      *files_from;// List of documents to check (--files-from)
+    unsigned char   verify;     // Check the image checksum (--verify)
+    unsigned char   stats;      // Print the statistics at exit (--stats)
+    StatsFormat     format;     // Format of the statistics
+    DictionaryBackend backend;  // Where the words are kept (--backend)
+    unsigned int    suggest;    // Suggestions per misspelled word (--suggest)
+    unsigned int    filter;     // Bloom filter bits per word (--filter)
+    ParseOptions    parse;      // How to check the document (-j)
+    unsigned char   watch;      // Reload the served dictionary when its
+                                // file changes (--watch)
+    LayerOption     layers[MAX_LAYERS]; // Stacked on the dictionary, bottom
+                                        // up (--overlay, --exclude)
+    unsigned int    layer_count;// Layers given
+}Options;
+
+// What the server loads again on a reload
+typedef struct {
+    const char      *path;      // Dictionary file
+    const Options   *options;   // Backend, suggestions, filter, threads
+}ServedDictionary;
 
 // Static function declaration
-static int openFiles(char *argv[], FILE **dict, FILE **doc);
+static int parseOptions(int argc, char *argv[], Options *options);
+static void printUsage(const char *name);
+static int checkDocument(const char *dict_path, const char *doc_path, Options *options);
+static int checkBatch(const char *dict_path, char *const *docs, size_t count, Options *options);
+static int readList(const char *list_path, char ***paths, size_t *count, size_t *size);
+static int compileDictionary(Options *options);
+static int serveDictionary(const char *dict_path, Options *options);
+static int loadServed(Dictionary *dictionary, void *context);
+static int loadLayers(Dictionary *layers, Dictionary *base, const Options *options, Dictionary **top);
+static void releaseLayers(Dictionary *layers, unsigned int count);
+static int checkRemote(const char *doc_path, Options *options);
+static int openFiles(const char *dict_path, const char *doc_path, FILE **dict, FILE **doc);
+static FILE *openStream(const char *path);
 static int closeFile(FILE **fd);
 
 
@@ -20,41 +72,65 @@ static int closeFile(FILE **fd);
 int main (int argc, char *argv[])
 {
     int rc = NOK;
+    Options options;
 
-    // We need 3 (and only) arguments to proceed
-    if (argc == 3)
+    if (parseOptions(argc, argv, &options) == OK)
     {
-        FILE *dict_fd = NULL, *doc_fd = NULL;
-
-        if ((rc = openFiles(argv, &dict_fd, &doc_fd)) == OK)
+        // Only the server has a dictionary to reload, layers are for the
+        // checks done here
+        if ((options.watch && options.serve == NULL) ||
+            (options.layer_count != 0 && (options.serve != NULL || options.compile != NULL ||
+                                          options.connect != NULL)))
         {
-            DictionaryElement dictionary[ALPHABET_SIZE];
-            
-            // Initialize dictionary structure
-            if ((rc = initializeDictionary(dictionary)) == OK)
+            printf("%s: invalid options\n", argv[0]);
+            printUsage(argv[0]);
+        }
+        else if (options.compile != NULL)
+        {
+            // We need the output and no document
+            if (options.output != NULL && optind == argc && options.parse.cache == NULL)
             {
-                // Parse the dictionary file and store it in memory
-                if ((rc = populateDictionary(dict_fd, dictionary)) == OK)
-                {
-                    //parseDictionary(dictionary);
-
-                    parseText(doc_fd, dictionary);
-                }
+                rc = compileDictionary(&options);
+            }
+            else
+            {
+                printf("%s: invalid options\n", argv[0]);
+                printUsage(argv[0]);
             }
-
-            deallocateDictionary(dictionary);
-            closeFile(&dict_fd);
-            closeFile(&doc_fd);
+        }
+        // The server needs only the dictionary, a line cache is for one
+        // document only
+        else if (options.serve != NULL && argc - optind == 1 && options.parse.cache == NULL)
+        {
+            rc = serveDictionary(argv[optind], &options);
+        }
+        // The client only the document, none is stdin
+        else if (options.connect != NULL && argc - optind <= 1 && options.parse.cache == NULL)
+        {
+            rc = checkRemote((argc - optind == 1) ? argv[optind] : "-", &options);
+        }
+        // Many documents (or a list of them) share one dictionary load
+        else if (options.serve == NULL && options.connect == NULL && argc - optind >= 1 &&
+                 (argc - optind > 2 || options.files_from != NULL) && options.parse.cache == NULL)
+        {
+            rc = checkBatch(argv[optind], &argv[optind + 1], argc - optind - 1, &options);
+        }
+        // We need the dictionary and the document, no document is stdin
+        else if (options.serve == NULL && options.connect == NULL && (argc - optind == 2 || argc - optind == 1))
+        {
+            rc = checkDocument(argv[optind], (argc - optind == 2) ? argv[optind + 1] : "-", &options);
+        }
+        else
+        {
+            printf("%s: invalid options\n", argv[0]);
+            printUsage(argv[0]);
         }
     }
     else
     {
-        printf("%s: invalid options\n", argv[0]);
-        printf("usage: %s <dictionary> <document>\n", argv[0]);
-        printf("\t<dictionary> text file of known words\n");
-        printf("\t<document> text document to spell check\n");
+        printUsage(argv[0]);
     }
-    
+
     exit(rc);
 }
 
@@ -64,10 +140,689 @@ int main (int argc, char *argv[])
  * Static functions
  ******************************************************************************/
 
+/* 
+ * Parse the command line options
+ * 
+ * @param int argc number of arguments
+ * @param char * argv[] arguments
+ * @param Options * options filled with the options found
+ * @return OK or NOK
+ * 
+ * On return optind is the index of the first positional argument
+ */
+static int parseOptions(int argc, char *argv[], Options *options)
+{
+    static const struct option longOptions[] = {
+        {"compile-dict", required_argument, NULL, 'c'},
+        {"output",       required_argument, NULL, 'o'},
+        {"verify",       no_argument,       NULL, 'V'},
+        {"jobs",         required_argument, NULL, 'j'},
+        {"stats",        optional_argument, NULL, 'S'},
+        {"format",       required_argument, NULL, 'f'},
+        {"stream",       no_argument,       NULL, 's'},
+        {"serve",        required_argument, NULL, 'L'},
+        {"connect",      required_argument, NULL, 'C'},
+        {"backend",      required_argument, NULL, 'B'},
+        {"suggest",      required_argument, NULL, 'G'},
+        {"filter",       optional_argument, NULL, 'F'},
+        {"files-from",   required_argument, NULL, 'l'},
+        {"cache",        required_argument, NULL, 'K'},
+        {"watch",        no_argument,       NULL, 'W'},
+        {"overlay",      required_argument, NULL, 'O'},
+        {"exclude",      required_argument, NULL, 'X'},
+        {NULL,           0,                 NULL, 0}
+    };
+    int rc = OK, option = 0;
+    char *end = NULL;
+    long value = 0;
+
+    options->compile = NULL;
+    options->output = NULL;
+    options->serve = NULL;
+    options->connect = NULL;
+    options->files_from = NULL;
+    options->verify = 0;
+    options->stats = 0;
+    options->format = STATS_TEXT;
+    options->backend = DICTIONARY_SETS;
+    options->suggest = 0;
+    options->filter = 0;
+    options->parse.threads = 1;
+    options->parse.format = REPORT_TEXT;
+    options->parse.stream = 0;
+    options->parse.cache = NULL;
+    options->watch = 0;
+    options->layer_count = 0;
+
+    while (rc == OK && (option = getopt_long(argc, argv, "o:j:", longOptions, NULL)) != -1)
+    {
+        switch (option)
+        {
+            case 'c':
+                options->compile = optarg;
+                break;
+            case 'o':
+                options->output = optarg;
+                break;
+            case 'V':
+                options->verify = 1;
+                break;
+            case 's':
+                options->parse.stream = 1;
+                break;
+            case 'L':
+                options->serve = optarg;
+                break;
+            case 'C':
+                options->connect = optarg;
+                break;
+            case 'l':
+                options->files_from = optarg;
+                break;
+            case 'K':
+                options->parse.cache = optarg;
+                break;
+            case 'W':
+                options->watch = 1;
+                break;
+            case 'O':
+            case 'X':
+                if (options->layer_count == MAX_LAYERS)
+                {
+                    rc = NOK;
+                    printf("ERROR: Too many dictionary layers (most %d)\n", MAX_LAYERS);
+                    break;
+                }
+                options->layers[options->layer_count].path = optarg;
+                options->layers[options->layer_count].exclude = (option == 'X');
+                options->layer_count++;
+                break;
+            case 'f':
+                if (strcmp(optarg, "text") == 0)
+                {
+                    options->parse.format = REPORT_TEXT;
+                }
+                else if (strcmp(optarg, "tsv") == 0)
+                {
+                    options->parse.format = REPORT_TSV;
+                }
+                else if (strcmp(optarg, "jsonl") == 0)
+                {
+                    options->parse.format = REPORT_JSONL;
+                }
+                else
+                {
+                    rc = NOK;
+                    printf("ERROR: Invalid output format %s (text, tsv, jsonl)\n", optarg);
+                }
+                break;
+            case 'B':
+                if (strcmp(optarg, "sets") == 0)
+                {
+                    options->backend = DICTIONARY_SETS;
+                }
+                else if (strcmp(optarg, "graph") == 0)
+                {
+                    options->backend = DICTIONARY_GRAPH;
+                }
+                else if (strcmp(optarg, "perfect") == 0)
+                {
+                    options->backend = DICTIONARY_PERFECT;
+                }
+                else
+                {
+                    rc = NOK;
+                    printf("ERROR: Invalid dictionary backend %s (sets, graph, perfect)\n", optarg);
+                }
+                break;
+            case 'G':
+                value = strtol(optarg, &end, 10);
+                if (*end != 0 || value < 1 || value > GRAPH_MAX_MATCHES)
+                {
+                    rc = NOK;
+                    printf("ERROR: Invalid number of suggestions %s (1-%d)\n", optarg, GRAPH_MAX_MATCHES);
+                }
+                else
+                {
+                    options->suggest = value;
+                }
+                break;
+            case 'F':
+                options->filter = BLOOM_BITS;
+                if (optarg != NULL)
+                {
+                    value = strtol(optarg, &end, 10);
+                    if (*end != 0 || value < 1 || value > BLOOM_MAX_BITS)
+                    {
+                        rc = NOK;
+                        printf("ERROR: Invalid filter bits per word %s (1-%d)\n", optarg, BLOOM_MAX_BITS);
+                    }
+                    else
+                    {
+                        options->filter = value;
+                    }
+                }
+                break;
+            case 'S':
+                options->stats = 1;
+                if (optarg != NULL && strcmp(optarg, "json") == 0)
+                {
+                    options->format = STATS_JSON;
+                }
+                else if (optarg != NULL && strcmp(optarg, "text") != 0)
+                {
+                    rc = NOK;
+                    printf("ERROR: Invalid statistics format %s (text, json)\n", optarg);
+                }
+                break;
+            case 'j':
+                // 0 means one thread per online CPU
+                value = strtol(optarg, &end, 10);
+                if (*end != 0 || value < 0 || value > MAX_THREADS)
+                {
+                    rc = NOK;
+                    printf("ERROR: Invalid number of threads %s (0-%d)\n", optarg, MAX_THREADS);
+                }
+                else if (value == 0)
+                {
+                    value = sysconf(_SC_NPROCESSORS_ONLN);
+                    options->parse.threads = (value > 0 && value <= MAX_THREADS) ? value : 1;
+                }
+                else
+                {
+                    options->parse.threads = value;
+                }
+                break;
+            default:
+                rc = NOK;
+                break;
+        }
+    }
+    return rc;
+}
+
+/* 
+ * Print how to use the program
+ * 
+ * @param const char * name program name
+ */
+static void printUsage(const char *name)
+{
+    printf("usage: %s [--verify] [--stats[=json]] [--format fmt] [--stream] [--backend b] [--suggest n] "
+           "[--filter[=bits]] [-j threads] [--cache file] [--overlay words]... [--exclude words]... "
+           "<dictionary> [<document>]\n", name);
+    printf("       %s [options] [--files-from list] <dictionary> <document> <document>...\n", name);
+    printf("       %s [-j threads] [--backend b] --compile-dict <dictionary> -o <image>\n", name);
+    printf("       %s [--verify] [--stats[=json]] [--format fmt] [--backend b] [--suggest n] "
+           "[--filter[=bits]] [-j threads] [--watch] --serve <socket> <dictionary>\n", name);
+    printf("       %s --connect <socket> [<document>]\n", name);
+    printf("\t<dictionary> text file of known words (or compiled image)\n");
+    printf("\t<document> text document to spell check, - or nothing for stdin\n");
+    printf("\t           with many documents, the findings of each one follow\n");
+    printf("\t           its header, in order, - is a file\n");
+    printf("\t--files-from check the documents listed in list (one path per\n");
+    printf("\t             line, - for stdin) too, loading the dictionary once\n");
+    printf("\t--compile-dict compile the dictionary in a binary image\n");
+    printf("\t--verify check the image checksum before using it\n");
+    printf("\t--format findings as text (default), tsv (line, column, type,\n");
+    printf("\t         word) or jsonl (one JSON object per line)\n");
+    printf("\t--stream read the document in blocks instead of mapping it\n");
+    printf("\t--overlay add the words of a list on top of the dictionary\n");
+    printf("\t--exclude remove the words of a list from the dictionary; the\n");
+    printf("\t          layers go in order, the last one given is looked up\n");
+    printf("\t          first, only its words are loaded\n");
+    printf("\t--cache keep the findings of every line of the document in file,\n");
+    printf("\t        the next check of the document only checks the lines\n");
+    printf("\t        changed since (serially, one document only)\n");
+    printf("\t--backend keep the words in hash sets (sets, default) or in one\n");
+    printf("\t          word graph (graph), much smaller, slower to load, or\n");
+    printf("\t          in one minimal perfect hash (perfect), one probe per\n");
+    printf("\t          word, slower to build: compile it in an image\n");
+    printf("\t--suggest give up to n (1-%d) corrections of every misspelled\n", GRAPH_MAX_MATCHES);
+    printf("\t          word, within %d edits, best first\n", SUGGEST_DISTANCE);
+    printf("\t--filter put a Bloom filter of bits (1-%d, default %d) per word in\n", BLOOM_MAX_BITS, BLOOM_BITS);
+    printf("\t         front of the lookups, misspelled words skip the sets\n");
+    printf("\t--stats print counters and phase times on stderr at exit, as\n");
+    printf("\t        text or (--stats=json) as JSON\n");
+    printf("\t--serve load the dictionary once and check the documents sent on\n");
+    printf("\t        the Unix socket, until SIGINT or SIGTERM; SIGHUP loads the\n");
+    printf("\t        dictionary again and swaps it in, requests go on\n");
+    printf("\t--watch with --serve, reload when the dictionary file changes\n");
+    printf("\t--connect check the document on the server listening on socket\n");
+    printf("\t-j, --jobs build the dictionary and check the document with N\n");
+    printf("\t           threads (0 = all CPUs), with --serve the workers, with\n");
+    printf("\t           many documents N documents at a time\n");
+}
+
+/* 
+ * Load the dictionary and spell check the document
+ * 
+ * @param const char * dict_path dictionary (text or image)
+ * @param const char * doc_path document to check
+ * @param Options * options command line options
+ * @return OK or NOK
+ */
+static int checkDocument(const char *dict_path, const char *doc_path, Options *options)
+{
+    int rc = NOK;
+    FILE *dict_fd = NULL, *doc_fd = NULL;
+
+    if ((rc = openFiles(dict_path, doc_path, &dict_fd, &doc_fd)) == OK)
+    {
+        Dictionary dictionary, layers[MAX_LAYERS], *top = NULL;
+
+        // Initialize dictionary structure
+        if ((rc = initializeDictionary(&dictionary)) == OK)
+        {
+            STATS_TIMER(start);
+
+            dictionary.backend = options->backend;
+            dictionary.suggest = options->suggest;
+            dictionary.filter = options->filter;
+
+            // Parse the dictionary file and store it in memory
+            if ((rc = populateDictionary(dict_fd, &dictionary, options->parse.threads)) == OK &&
+                (!options->verify || (rc = verifyDictionaryImage(&dictionary)) == OK) &&
+                (rc = loadLayers(layers, &dictionary, options, &top)) == OK)
+            {
+                STATS_ELAPSED(STATS_LOAD, start);
+                //parseDictionary(&dictionary);
+
+                rc = parseText(doc_fd, top, &options->parse);
+                releaseLayers(layers, options->layer_count);
+            }
+        }
+        if (options->stats)
+        {
+            fflush(stdout);
+            statsPrint(stderr, options->format);
+        }
+
+        deallocateDictionary(&dictionary);
+        closeFile(&dict_fd);
+        closeFile(&doc_fd);
+    }
+    return rc;
+}
+
+/* 
+ * Load the dictionary once and spell check many documents
+ * 
+ * @param const char * dict_path dictionary (text or image)
+ * @param char * const * docs documents of the command line
+ * @param size_t count number of documents of the command line
+ * @param Options * options command line options (list, workers, format)
+ * @return OK or NOK, NOK too if a document can't be read
+ */
+static int checkBatch(const char *dict_path, char *const *docs, size_t count, Options *options)
+{
+    int rc = NOK;
+    FILE *dict_fd = NULL;
+    char **paths = NULL;
+    size_t total = count, size = count;
+
+    // Documents of the command line first, then the ones of the list
+    if ((paths = (char **)malloc((size ? size : 1) * sizeof(char *))) == NULL)
+    {
+        printf("ERROR: Out of memory for %zu documents\n", count);
+        return NOK;
+    }
+    memcpy(paths, docs, count * sizeof(char *));
+    if (options->files_from != NULL && readList(options->files_from, &paths, &total, &size) != OK)
+    {
+        rc = NOK;
+    }
+    else if ((dict_fd = openStream(dict_path)) != NULL)
+    {
+        Dictionary dictionary, layers[MAX_LAYERS], *top = NULL;
+
+        if ((rc = initializeDictionary(&dictionary)) == OK)
+        {
+            STATS_TIMER(start);
+
+            dictionary.backend = options->backend;
+            dictionary.suggest = options->suggest;
+            dictionary.filter = options->filter;
+
+            if ((rc = populateDictionary(dict_fd, &dictionary, options->parse.threads)) == OK &&
+                (!options->verify || (rc = verifyDictionaryImage(&dictionary)) == OK) &&
+                (rc = loadLayers(layers, &dictionary, options, &top)) == OK)
+            {
+                STATS_ELAPSED(STATS_LOAD, start);
+
+                rc = checkDocuments((const char *const *)paths, total, top, &options->parse);
+                releaseLayers(layers, options->layer_count);
+            }
+        }
+        if (options->stats)
+        {
+            fflush(stdout);
+            statsPrint(stderr, options->format);
+        }
+
+        deallocateDictionary(&dictionary);
+        closeFile(&dict_fd);
+    }
+    else
+    {
+        printf("ERROR: Can't open dictionary %s: errno %d\n", dict_path, errno);
+    }
+
+    // Paths after the command line ones are copies from the list
+    for (size_t index = count; index < total; index++)
+    {
+        free(paths[index]);
+    }
+    free(paths);
+    return rc;
+}
+
+/* 
+ * Stack the layers of the command line on the dictionary
+ * 
+ * @param Dictionary * layers filled with the layers, bottom up, at least
+ *                     options->layer_count
+ * @param Dictionary * base dictionary populated, the bottom layer
+ * @param const Options * options layers, suggestions, verify
+ * @param Dictionary ** top set to the top layer, base if there are none
+ * @return OK or NOK, then the layers loaded are released
+ * 
+ * Layers are word lists of a few hundred words on top of a big base: every
+ * one is built alone, in sets, from its own file, the base is not touched
+ */
+static int loadLayers(Dictionary *layers, Dictionary *base, const Options *options, Dictionary **top)
+{
+    int rc = OK;
+    unsigned int layer = 0;
+
+    *top = base;
+    for (layer = 0; rc == OK && layer < options->layer_count; layer++)
+    {
+        const LayerOption *option = &options->layers[layer];
+        FILE *layer_fd = NULL;
+
+        if ((layer_fd = openStream(option->path)) == NULL)
+        {
+            rc = NOK;
+            printf("ERROR: Can't open dictionary layer %s: errno %d\n", option->path, errno);
+            break;
+        }
+        if ((rc = initializeDictionary(&layers[layer])) == OK)
+        {
+            // Suggestions come from the layers adding words, the top one
+            // tells how many
+            layers[layer].suggest = options->suggest;
+            layers[layer].exclude = option->exclude;
+            layers[layer].below = *top;
+
+            if ((rc = populateDictionary(layer_fd, &layers[layer], 1)) == OK &&
+                (!options->verify || (rc = verifyDictionaryImage(&layers[layer])) == OK))
+            {
+                *top = &layers[layer];
+            }
+            else
+            {
+                deallocateDictionary(&layers[layer]);
+            }
+        }
+        closeFile(&layer_fd);
+    }
+    if (rc != OK)
+    {
+        releaseLayers(layers, *top == base ? 0 : (unsigned int)(*top - layers) + 1);
+        *top = NULL;
+    }
+    return rc;
+}
+
+/* 
+ * Release the layers loaded by loadLayers, the base stays
+ * 
+ * @param Dictionary * layers the layers, bottom up
+ * @param unsigned int count number of layers
+ */
+static void releaseLayers(Dictionary *layers, unsigned int count)
+{
+    for (unsigned int layer = 0; layer < count; layer++)
+    {
+        deallocateDictionary(&layers[layer]);
+    }
+}
+
+/* 
+ * Read a list of documents, one path per line
+ * 
+ * @param const char * list_path the list, "-" is stdin
+ * @param char *** paths array the paths are appended to, grown as needed
+ * @param size_t * count paths in the array, updated
+ * @param size_t * size paths allocated in the array, updated
+ * @return OK or NOK
+ * 
+ * Empty lines are skipped. The paths added are allocated, the caller frees
+ * them (even when NOK is returned)
+ */
+static int readList(const char *list_path, char ***paths, size_t *count, size_t *size)
+{
+    int rc = OK;
+    FILE *list_fd = NULL;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length = 0;
+
+    if ((list_fd = openStream(list_path)) == NULL)
+    {
+        printf("ERROR: Can't open list of documents %s: errno %d\n", list_path, errno);
+        return NOK;
+    }
+
+    while (rc == OK && (length = getline(&line, &line_size, list_fd)) >= 0)
+    {
+        if (length > 0 && line[length - 1] == '\n')
+        {
+            line[--length] = 0;
+        }
+        if (length == 0)
+        {
+            continue;
+        }
+        if (*count == *size)
+        {
+            size_t grown = (*size < 64) ? 64 : *size * 2;
+            char **more = (char **)realloc(*paths, grown * sizeof(char *));
+
+            if (more == NULL)
+            {
+                rc = NOK;
+                break;
+            }
+            *paths = more;
+            *size = grown;
+        }
+        if (((*paths)[*count] = strdup(line)) == NULL)
+        {
+            rc = NOK;
+            break;
+        }
+        (*count)++;
+    }
+    if (rc != OK)
+    {
+        printf("ERROR: Out of memory reading list of documents %s\n", list_path);
+    }
+    else if (ferror(list_fd))
+    {
+        rc = NOK;
+        printf("ERROR: Can't read list of documents %s: errno %d\n", list_path, errno);
+    }
+
+    free(line);
+    if (list_fd != stdin)
+    {
+        fclose(list_fd);
+    }
+    return rc;
+}
+
+/* 
+ * Load the dictionary and serve it on a socket
+ * 
+ * @param const char * dict_path dictionary (text or image)
+ * @param Options * options command line options (socket, workers, format)
+ * @return OK or NOK
+ * 
+ * A dictionary from a file is loaded again on SIGHUP (or when it changes,
+ * with --watch), one from stdin can't be
+ */
+static int serveDictionary(const char *dict_path, Options *options)
+{
+    int rc = NOK;
+    Dictionary dictionary;
+    ServedDictionary served = {dict_path, options};
+    ServerReload reload = {loadServed, &served, options->watch ? dict_path : NULL};
+
+    if (options->watch && strcmp(dict_path, "-") == 0)
+    {
+        printf("ERROR: Can't watch a dictionary read from stdin\n");
+        return NOK;
+    }
+    if ((rc = loadServed(&dictionary, &served)) == OK)
+    {
+        rc = runServer(options->serve, &dictionary, &options->parse,
+                       (strcmp(dict_path, "-") != 0) ? &reload : NULL);
+        deallocateDictionary(&dictionary);
+    }
+    if (options->stats)
+    {
+        fflush(stdout);
+        statsPrint(stderr, options->format);
+    }
+    return rc;
+}
+
+/* 
+ * Load the dictionary of the server, at start and on every reload
+ * 
+ * @param Dictionary * dictionary dictionary to fill
+ * @param void * context the ServedDictionary
+ * @return OK or NOK, then nothing is left to release
+ */
+static int loadServed(Dictionary *dictionary, void *context)
+{
+    const ServedDictionary *served = (const ServedDictionary *)context;
+    const Options *options = served->options;
+    FILE *dict_fd = NULL;
+    int rc = NOK;
+
+    if ((dict_fd = openStream(served->path)) == NULL)
+    {
+        printf("ERROR: Can't open dictionary %s: errno %d\n", served->path, errno);
+        return NOK;
+    }
+    if ((rc = initializeDictionary(dictionary)) == OK)
+    {
+        STATS_TIMER(start);
+
+        dictionary->backend = options->backend;
+        dictionary->suggest = options->suggest;
+        dictionary->filter = options->filter;
+        // The file may be rewritten in place while served
+        dictionary->copy = 1;
+
+        if ((rc = populateDictionary(dict_fd, dictionary, options->parse.threads)) == OK &&
+            (!options->verify || (rc = verifyDictionaryImage(dictionary)) == OK))
+        {
+            STATS_ELAPSED(STATS_LOAD, start);
+        }
+        else
+        {
+            deallocateDictionary(dictionary);
+        }
+    }
+    closeFile(&dict_fd);
+    return rc;
+}
+
+/* 
+ * Send the document to a server and print its findings
+ * 
+ * @param const char * doc_path document to check
+ * @param Options * options command line options (socket)
+ * @return OK or NOK
+ */
+static int checkRemote(const char *doc_path, Options *options)
+{
+    int rc = NOK;
+    FILE *doc_fd = NULL;
+
+    if ((doc_fd = openStream(doc_path)) != NULL)
+    {
+        rc = runClient(options->connect, doc_fd);
+        closeFile(&doc_fd);
+    }
+    else
+    {
+        printf("ERROR: Can't open document %s: errno %d\n", doc_path, errno);
+    }
+    return rc;
+}
+
+/* 
+ * Build the dictionary from text and save it as an image, of the sets or,
+ * with --backend perfect, of the perfect hash
+ * 
+ * @param Options * options command line options (input and output)
+ * @return OK or NOK
+ */
+static int compileDictionary(Options *options)
+{
+    int rc = NOK;
+    FILE *dict_fd = NULL;
+
+    if (options->backend == DICTIONARY_GRAPH)
+    {
+        printf("ERROR: Images hold the hash sets or the perfect hash, --backend graph can't be compiled\n");
+    }
+    else if ((dict_fd = openStream(options->compile)) != NULL)
+    {
+        Dictionary dictionary;
+
+        rc = initializeDictionary(&dictionary);
+        dictionary.backend = options->backend;
+        if (rc == OK && (rc = populateDictionary(dict_fd, &dictionary, options->parse.threads)) == OK)
+        {
+            if (dictionary.image)
+            {
+                rc = NOK;
+                printf("ERROR: %s is already an image\n", options->compile);
+            }
+            else if ((rc = compileDictionaryImage(&dictionary, options->output)) == OK)
+            {
+                unsigned int words = 0;
+
+                for (int index = 0; index < ALPHABET_SIZE; index++)
+                {
+                    words += dictionary.letters[index].words;
+                }
+                printf("INFO: Compiled words=[%u] duplicates dropped=[%u] in %s\n", words,
+                       dictionary.duplicates, options->output);
+            }
+        }
+
+        deallocateDictionary(&dictionary);
+        closeFile(&dict_fd);
+    }
+    else
+    {
+        printf("ERROR: Can't open dictionary %s: errno %d\n", options->compile, errno);
+    }
+    return rc;
+}
+
 /* 
  * Open Dictionary and Document files
  * 
- * @param char * argv[] Array containing path to files (dict and doc)
+ * @param const char * dict_path path of the dictionary
+ * @param const char * doc_path path of the document
  * @param FILE * dict File descriptor for the dictionary
  * @param FILE * doc File descriptor for the document
  * @return OK or NOK
@@ -76,19 +831,21 @@ int main (int argc, char *argv[])
  * closed, so this function succeed or not.
  * 
  * Note: we use fopen family functions because they use some buffer optimizations
- * in the kernel that could results in faster/smoother disk I/O
+ * in the kernel that could results in faster/smoother disk I/O.
+ * Regular files are then mapped by the loaders, the stream is the fallback
+ * for pipes and stdin
  */
-static int openFiles(char *argv[], FILE **dict_fd, FILE **doc_fd)
+static int openFiles(const char *dict_path, const char *doc_path, FILE **dict_fd, FILE **doc_fd)
 {
     int rc = OK;
 
-    if ((*dict_fd = fopen(argv[1], "r")) != NULL)
+    if ((*dict_fd = openStream(dict_path)) != NULL)
     {
         // We open the document file only if dictionary is valid
-        if ((*doc_fd = fopen(argv[2], "r")) == NULL)
+        if ((*doc_fd = openStream(doc_path)) == NULL)
         {
             rc = NOK;
-            printf("ERROR: Can't open document %s: errno %d\n", argv[2], errno);
+            printf("ERROR: Can't open document %s: errno %d\n", doc_path, errno);
             
             fclose(*dict_fd);
             dict_fd = NULL;
@@ -97,13 +854,28 @@ static int openFiles(char *argv[], FILE **dict_fd, FILE **doc_fd)
     else
     {
         rc = NOK;
-        printf("ERROR: Can't open dictionary %s: errno %d\n", argv[1], errno);
+        printf("ERROR: Can't open dictionary %s: errno %d\n", dict_path, errno);
     }
 
     
     return rc;
 }
 
+/* 
+ * Open a file for reading, "-" is stdin
+ * 
+ * @param const char * path path of the file
+ * @return the stream or NULL
+ */
+static FILE *openStream(const char *path)
+{
+    if (strcmp(path, "-") == 0)
+    {
+        return stdin;
+    }
+    return fopen(path, "r");
+}
+
 /* 
  * Close Dictionary and Document files
  * 
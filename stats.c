@@ -0,0 +1,147 @@
+// System include
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// Project include
+#include "spellcheck.h"
+#include "stats.h"
+
+#ifndef NO_STATS
+__thread Stats threadStats;                 // Counters of the calling thread
+
+static Stats totalStats;                    // Counters of the finished threads
+static pthread_mutex_t totalLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *phaseNames[STATS_PHASES] = {
+    "load", "tokenize", "lookup", "report", "suggest"
+};
+#endif
+
+
+uint64_t statsClock(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+#ifdef NO_STATS
+void statsMerge(void)
+{
+}
+
+void statsPrint(FILE *out, StatsFormat format)
+{
+    (void)format;
+    fprintf(out, "WARNING: Statistics are not available, built with NO_STATS\n");
+}
+#else
+void statsMerge(void)
+{
+    uint64_t *from = (uint64_t *)&threadStats, *to = (uint64_t *)&totalStats;
+
+    // Stats is only made of uint64_t counters
+    pthread_mutex_lock(&totalLock);
+    for (size_t counter = 0; counter < sizeof(Stats) / sizeof(uint64_t); counter++)
+    {
+        to[counter] += from[counter];
+    }
+    pthread_mutex_unlock(&totalLock);
+
+    memset(&threadStats, 0, sizeof(threadStats));
+}
+
+void statsPrint(FILE *out, StatsFormat format)
+{
+    const Stats *stats = &totalStats;
+    const char *separator = "";
+    uint64_t misses = 0, cached = 0;
+
+    statsMerge();
+
+    // False positive rate: among the words not in the dictionary, the ones
+    // the filter let through
+    misses = stats->filtered + stats->false_positives;
+    cached = stats->cache_hits + stats->cache_misses;
+
+    if (format == STATS_JSON)
+    {
+        fprintf(out, "{\"bytes\":%llu,\"lines\":%llu,\"tokens\":%llu,\"lookups\":%llu,"
+                "\"misspelled\":%llu,\"malformed\":%llu,\"suggested\":%llu,",
+                (unsigned long long)stats->bytes, (unsigned long long)stats->lines,
+                (unsigned long long)stats->tokens, (unsigned long long)stats->lookups,
+                (unsigned long long)stats->misspelled, (unsigned long long)stats->malformed,
+                (unsigned long long)stats->suggested);
+        fprintf(out, "\"filter\":{\"rejected\":%llu,\"false_positives\":%llu,\"rate\":%.4f},",
+                (unsigned long long)stats->filtered, (unsigned long long)stats->false_positives,
+                misses ? (double)stats->false_positives / misses : 0.0);
+        fprintf(out, "\"cache\":{\"hits\":%llu,\"misses\":%llu,\"rate\":%.4f},",
+                (unsigned long long)stats->cache_hits, (unsigned long long)stats->cache_misses,
+                cached ? (double)stats->cache_hits / cached : 0.0);
+        fprintf(out, "\"incremental\":{\"reused\":%llu,\"checked\":%llu},",
+                (unsigned long long)stats->lines_reused, (unsigned long long)stats->lines_checked);
+        fprintf(out, "\"dictionary\":{\"words\":%llu,\"duplicates\":%llu,\"bytes\":%llu},\"time\":{",
+                (unsigned long long)stats->words, (unsigned long long)stats->duplicates,
+                (unsigned long long)stats->memory);
+        for (int phase = 0; phase < STATS_PHASES; phase++)
+        {
+            fprintf(out, "%s\"%s\":%.6f", separator, phaseNames[phase], stats->time[phase] / 1e9);
+            separator = ",";
+        }
+        fprintf(out, "},\"letters\":{");
+        separator = "";
+        for (int letter = 0; letter < STATS_LETTERS; letter++)
+        {
+            if (stats->letter_lookups[letter] != 0)
+            {
+                fprintf(out, "%s\"%c\":{\"lookups\":%llu,\"probes\":%llu,\"average\":%.3f}", separator, 'a' + letter,
+                        (unsigned long long)stats->letter_lookups[letter],
+                        (unsigned long long)stats->letter_probes[letter],
+                        (double)stats->letter_probes[letter] / stats->letter_lookups[letter]);
+                separator = ",";
+            }
+        }
+        fprintf(out, "}}\n");
+    }
+    else
+    {
+        fprintf(out, "STATS: bytes=%llu lines=%llu tokens=%llu lookups=%llu misspelled=%llu malformed=%llu "
+                "suggested=%llu\n",
+                (unsigned long long)stats->bytes, (unsigned long long)stats->lines,
+                (unsigned long long)stats->tokens, (unsigned long long)stats->lookups,
+                (unsigned long long)stats->misspelled, (unsigned long long)stats->malformed,
+                (unsigned long long)stats->suggested);
+        fprintf(out, "STATS: filter rejected=%llu false_positives=%llu rate=%.4f\n",
+                (unsigned long long)stats->filtered, (unsigned long long)stats->false_positives,
+                misses ? (double)stats->false_positives / misses : 0.0);
+        fprintf(out, "STATS: cache hits=%llu misses=%llu rate=%.4f\n",
+                (unsigned long long)stats->cache_hits, (unsigned long long)stats->cache_misses,
+                cached ? (double)stats->cache_hits / cached : 0.0);
+        fprintf(out, "STATS: incremental reused=%llu checked=%llu\n",
+                (unsigned long long)stats->lines_reused, (unsigned long long)stats->lines_checked);
+        fprintf(out, "STATS: dictionary words=%llu duplicates=%llu bytes=%llu\n",
+                (unsigned long long)stats->words, (unsigned long long)stats->duplicates,
+                (unsigned long long)stats->memory);
+        fprintf(out, "STATS: time");
+        for (int phase = 0; phase < STATS_PHASES; phase++)
+        {
+            fprintf(out, " %s=%.6fs", phaseNames[phase], stats->time[phase] / 1e9);
+        }
+        fprintf(out, "\n");
+        for (int letter = 0; letter < STATS_LETTERS; letter++)
+        {
+            if (stats->letter_lookups[letter] != 0)
+            {
+                fprintf(out, "STATS: letter=%c lookups=%llu probes=%llu average=%.3f\n", 'a' + letter,
+                        (unsigned long long)stats->letter_lookups[letter],
+                        (unsigned long long)stats->letter_probes[letter],
+                        (double)stats->letter_probes[letter] / stats->letter_lookups[letter]);
+            }
+        }
+    }
+}
+#endif
@@ -0,0 +1,129 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*******************************************************************************
+ * STATS - Hot path counters and phase timers
+ *
+ * Every thread counts in its own Stats (thread local, no locks, no shared
+ * cache lines), a worker adds its counters to the totals with STATS_MERGE
+ * when it is done. statsPrint merges the calling thread and prints the
+ * totals (--stats).
+ *
+ * Counters are plain increments, timers are read once per tokenizer window
+ * (64 KiB) or per report flush, never per word (but for the suggestion
+ * search, that takes microseconds anyway), so they are always compiled
+ * in. Build with -DNO_STATS to compile all of them out: the macros below
+ * become empty and --stats only prints a warning.
+ *
+ * Times of a parallel check are summed over the threads.
+ *
+ ******************************************************************************/
+
+#define STATS_LETTERS 26    // One probe counter for every initial
+
+typedef enum {
+    STATS_LOAD = 0,         // Dictionary build (or image load)
+    STATS_TOKENIZE,         // Splitting the document in words
+    STATS_LOOKUP,           // Checking the words (formatting findings too)
+    STATS_REPORT,           // Writing the findings out (a flush done while
+                            // checking is in the lookup time too)
+    STATS_SUGGEST,          // Searching suggestions (in the lookup time too)
+    STATS_PHASES
+}StatsPhase;
+
+typedef enum {
+    STATS_TEXT = 0,         // One "STATS:" line per group of values
+    STATS_JSON              // One JSON object
+}StatsFormat;
+
+typedef struct {
+    uint64_t        bytes;                      // Document bytes read
+    uint64_t        lines;                      // Document endlines
+    uint64_t        tokens;                     // Words found in the document
+    uint64_t        lookups;                    // Dictionary lookups
+    uint64_t        misspelled;                 // Words reported misspelled
+    uint64_t        malformed;                  // Words reported malformed
+    uint64_t        suggested;                  // Misspelled words searched
+                                                // for suggestions
+    uint64_t        filtered;                   // Lookups the Bloom filter
+                                                // rejected
+    uint64_t        false_positives;            // Lookups the filter let
+                                                // through, not found
+    uint64_t        cache_hits;                 // Words whose verdict was in
+                                                // the cache
+    uint64_t        cache_misses;               // Words looked up through the
+                                                // cache, not in it
+    uint64_t        lines_reused;               // Lines whose findings came
+                                                // from the line cache
+    uint64_t        lines_checked;              // Lines checked with a line
+                                                // cache, new or changed
+    uint64_t        words;                      // Words in the dictionary
+    uint64_t        duplicates;                 // Dictionary words dropped,
+                                                // already known
+    uint64_t        memory;                     // Bytes taken by the dictionary
+    uint64_t        letter_lookups[STATS_LETTERS];  // Lookups per initial
+    uint64_t        letter_probes[STATS_LETTERS];   // Slots (or nodes) visited
+                                                    // per initial
+    uint64_t        time[STATS_PHASES];         // Nanoseconds per phase
+}Stats;
+
+#ifdef NO_STATS
+#define STATS_ADD(field, value)     ((void)(value))
+#define STATS_LOOKUP(index, probes) ((void)(probes))
+#define STATS_TIMER(name)
+#define STATS_ELAPSED(phase, name)
+#define STATS_MERGE()
+#else
+extern __thread Stats threadStats;
+
+// Add value to a counter of the calling thread
+#define STATS_ADD(field, value)     (threadStats.field += (value))
+// Count a lookup under letter index, visiting probes slots
+#define STATS_LOOKUP(index, probes) (threadStats.lookups++, threadStats.letter_lookups[index]++, \
+                                     threadStats.letter_probes[index] += (probes))
+// Start a timer, name is a local variable
+#define STATS_TIMER(name)           uint64_t name = statsClock()
+// Add the time since the timer name to a phase
+#define STATS_ELAPSED(phase, name)  (threadStats.time[phase] += statsClock() - (name))
+// Add the counters of the calling thread to the totals
+#define STATS_MERGE()               statsMerge()
+#endif
+
+
+/*
+ * statsClock
+ *
+ * Monotonic time, for the timers
+ *
+ * @return nanoseconds from an arbitrary point
+ *
+ */
+uint64_t statsClock(void);
+
+
+/*
+ * statsMerge
+ *
+ * Add the counters of the calling thread to the totals and clear them.
+ * Safe to call from any thread at any time
+ *
+ */
+void statsMerge(void);
+
+
+/*
+ * statsPrint
+ *
+ * Merge the calling thread and print the totals: counters, phase times and
+ * the average probes of every letter looked up
+ *
+ * @param FILE        * out stream to print to
+ * @param StatsFormat   format text or JSON
+ *
+ */
+void statsPrint(FILE *out, StatsFormat format);
+
+#endif // _STATS_H
@@ -0,0 +1,40 @@
+// System include
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// Project include
+#include "spellcheck.h"
+#include "thread_pool.h"
+
+
+unsigned int runWorkers(unsigned int threads, void *(*worker)(void *), void *arg)
+{
+    pthread_t *ids = NULL;
+    unsigned int started = 0;
+
+    if (threads > 1 && (ids = (pthread_t *)malloc((threads - 1) * sizeof(pthread_t))) != NULL)
+    {
+        while (started < threads - 1 && pthread_create(&ids[started], NULL, worker, arg) == 0)
+        {
+            started++;
+        }
+    }
+
+    // Calling thread is a worker too
+    worker(arg);
+
+    for (unsigned int thread = 0; thread < started; thread++)
+    {
+        pthread_join(ids[thread], NULL);
+    }
+    free(ids);
+
+    return started + 1;
+}
+
+unsigned int nextTask(unsigned int *counter)
+{
+    return __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,40 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+/*******************************************************************************
+ * THREAD POOL - Run the same worker on several threads
+ *
+ * Workers are expected to pull their work from a shared queue (usually an
+ * index bumped with nextTask), so the job gets done whatever the number of
+ * threads actually started: if a thread can't be created the others, and
+ * the calling thread itself, take its share.
+ *
+ ******************************************************************************/
+
+/*
+ * runWorkers
+ *
+ * Run worker(arg) on threads threads, the calling thread being one of them,
+ * and wait for all of them to return
+ *
+ * @param unsigned int threads number of threads, calling one included
+ * @param void *(*worker)(void *) function run by every thread
+ * @param void * arg argument given to every worker
+ * @return number of threads that actually run the worker
+ *
+ */
+unsigned int runWorkers(unsigned int threads, void *(*worker)(void *), void *arg);
+
+
+/*
+ * nextTask
+ *
+ * Atomically get the next task index from a shared counter
+ *
+ * @param unsigned int * counter shared counter, starting from 0
+ * @return the task index (counter value before the increment)
+ *
+ */
+unsigned int nextTask(unsigned int *counter);
+
+#endif // _THREAD_POOL_H
@@ -0,0 +1,220 @@
+// System include
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+
+// Project include
+#include "spellcheck.h"
+#include "tokenizer.h"
+#include "case_fold.h"
+
+#if defined(__AVX2__)
+#define TOKEN_BLOCK 32  // Bytes scanned at once
+#else
+#define TOKEN_BLOCK 16
+#endif
+
+// 1 for the delimiters dropped at the end of a word
+static const unsigned char trailing[256] = {
+    [','] = 1, ['.'] = 1, ['?'] = 1, ['!'] = 1, [':'] = 1, [';'] = 1
+};
+
+// Static function declarations
+static inline void scanBlock(const char *text, char *folded, unsigned int *space, unsigned int *endline);
+static inline void closeSpan(WordSpan *span, const char *text, size_t end);
+
+
+int tokensInitialize(Tokens *tokens)
+{
+    assert(tokens != NULL);
+
+    tokens->folded = (char *)malloc(TOKEN_WINDOW);
+    tokens->spans = (WordSpan *)malloc((TOKEN_WINDOW / 2 + 1) * sizeof(WordSpan));
+    tokens->count = 0;
+
+    if (tokens->folded == NULL || tokens->spans == NULL)
+    {
+        tokensRelease(tokens);
+        return NOK;
+    }
+    return OK;
+}
+
+size_t tokenizeText(Tokens *tokens, const char *text, size_t size, int last, TextPosition *position)
+{
+    WordSpan *spans = tokens->spans;
+    unsigned int current = position->line, before = 1;
+    size_t count = 0, closed = 0, used = size;
+    // Where the current line begins, it can be in a previous window
+    ptrdiff_t begin = 1 - (ptrdiff_t)position->column;
+
+    assert(tokens != NULL);
+    assert(size <= TOKEN_WINDOW);
+
+    for (size_t block = 0; block < size; block += TOKEN_BLOCK)
+    {
+        unsigned int bytes = (size - block < TOKEN_BLOCK) ? (unsigned int)(size - block) : TOKEN_BLOCK;
+        unsigned int valid = (bytes == 32) ? ~0u : (1u << bytes) - 1;
+        unsigned int space = 0, endline = 0, shifted = 0, starts = 0, ends = 0;
+
+        if (bytes == TOKEN_BLOCK)
+        {
+            scanBlock(text + block, tokens->folded + block, &space, &endline);
+        }
+        else
+        {
+            // Last piece of the window, never read past the text
+            char padded[TOKEN_BLOCK], folded[TOKEN_BLOCK];
+
+            memset(padded, ' ', TOKEN_BLOCK);
+            memcpy(padded, text + block, bytes);
+            scanBlock(padded, folded, &space, &endline);
+            memcpy(tokens->folded + block, folded, bytes);
+        }
+
+        // A word starts on a non whitespace after a whitespace, ends on a
+        // whitespace after a non whitespace. Starts and ends alternate, so
+        // the n-th end closes the n-th word
+        shifted = (space << 1) | before;
+        starts = ~space & shifted & valid;
+        ends = space & ~shifted & valid;
+        before = (space >> (bytes - 1)) & 1;
+
+        while (starts != 0)
+        {
+            unsigned int bit = __builtin_ctz(starts);
+            unsigned int above = endline & ((1u << bit) - 1);
+
+            // The line begins after the last endline before the word
+            spans[count].offset = (unsigned int)(block + bit);
+            spans[count].line = current + __builtin_popcount(above);
+            spans[count].column = (unsigned int)((ptrdiff_t)(block + bit) + 1 -
+                                  ((above != 0) ? (ptrdiff_t)(block + 32 - __builtin_clz(above)) : begin));
+            count++;
+            starts &= starts - 1;
+        }
+        while (ends != 0)
+        {
+            closeSpan(&spans[closed++], text, block + __builtin_ctz(ends));
+            ends &= ends - 1;
+        }
+        if ((endline &= valid) != 0)
+        {
+            current += __builtin_popcount(endline);
+            begin = block + 32 - __builtin_clz(endline);
+        }
+    }
+
+    tokens->count = count;
+    if (closed < count)
+    {
+        // The word could go on after the window, leave it to the next one
+        if (!last)
+        {
+            tokens->count = closed;
+            used = spans[closed].offset;
+        }
+        else
+        {
+            closeSpan(&spans[closed], text, size);
+        }
+    }
+
+    position->line = current;
+    position->column = (unsigned int)((ptrdiff_t)used + 1 - begin);
+    return used;
+}
+
+void tokenCloseSpan(WordSpan *span, const char *text, size_t end)
+{
+    closeSpan(span, text, end);
+}
+
+void tokensRelease(Tokens *tokens)
+{
+    assert(tokens != NULL);
+
+    free(tokens->folded);
+    free(tokens->spans);
+    tokens->folded = NULL;
+    tokens->spans = NULL;
+    tokens->count = 0;
+}
+
+
+
+/*******************************************************************************
+ * Static functions
+ ******************************************************************************/
+
+/******************************************************************************
+ * scanBlock
+ *
+ * @param const char *text TOKEN_BLOCK bytes to scan
+ * @param char *folded where the lower case bytes go
+ * @param unsigned int *space bit mask of the whitespace
+ * @param unsigned int *endline bit mask of the endlines
+ *
+ * Whitespace is ' ' or '\t' to '\r', as isspace in the C locale. Only ASCII
+ * upper case letters are folded, like tolower in the C locale
+ */
+static inline void scanBlock(const char *text, char *folded, unsigned int *space, unsigned int *endline)
+{
+#if defined(__AVX2__)
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)text);
+    __m256i control = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+
+    // x <= n unsigned is min(x, n) == x
+    control = _mm256_cmpeq_epi8(_mm256_min_epu8(control, _mm256_set1_epi8('\r' - '\t')), control);
+
+    _mm256_storeu_si256((__m256i *)folded, foldBlock32(bytes));
+    *space = (unsigned int)_mm256_movemask_epi8(
+                 _mm256_or_si256(control, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '))));
+    *endline = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')));
+#elif defined(__SSE2__)
+    __m128i bytes = _mm_loadu_si128((const __m128i *)text);
+    __m128i control = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+
+    // x <= n unsigned is min(x, n) == x
+    control = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8('\r' - '\t')), control);
+
+    _mm_storeu_si128((__m128i *)folded, foldBlock16(bytes));
+    *space = (unsigned int)_mm_movemask_epi8(_mm_or_si128(control, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '))));
+    *endline = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')));
+#else
+    *space = 0;
+    *endline = 0;
+    for (unsigned int pos = 0; pos < TOKEN_BLOCK; pos++)
+    {
+        unsigned char byte = (unsigned char)text[pos];
+
+        folded[pos] = (byte >= 'A' && byte <= 'Z') ? byte + 0x20 : byte;
+        if (byte == ' ' || (byte >= '\t' && byte <= '\r'))
+        {
+            *space |= 1u << pos;
+        }
+        if (byte == '\n')
+        {
+            *endline |= 1u << pos;
+        }
+    }
+#endif
+}
+
+/******************************************************************************
+ * closeSpan
+ *
+ * @param WordSpan *span word to close
+ * @param const char *text text of the window
+ * @param size_t end offset after the last byte of the word
+ *
+ * Set the lengths of a word. The trimmed length drops one trailing
+ * delimiter, so we get less false negative ("word," is still "word")
+ */
+static inline void closeSpan(WordSpan *span, const char *text, size_t end)
+{
+    span->length = (unsigned int)(end - span->offset);
+    span->trimmed = span->length - trailing[(unsigned char)text[end - 1]];
+}
@@ -0,0 +1,113 @@
+#ifndef _TOKENIZER_H
+#define _TOKENIZER_H
+
+#include <stddef.h>
+
+/*******************************************************************************
+ * TOKENIZER - Vectorized word scanner
+ *
+ * The document is scanned in windows of at most TOKEN_WINDOW bytes. Every
+ * block of the window (32 bytes with AVX2, 16 with SSE2, 16 bytes one by one
+ * without them) is loaded once and gives:
+ *
+ *   - a bit mask of the whitespace (space, \t, \n, \v, \f, \r)
+ *   - a bit mask of the endlines, to count lines
+ *   - the block lower cased, stored in the folded copy of the window
+ *
+ * Word boundaries are found walking the bits of the masks, so there is no
+ * more byte by byte loop. Words come out as spans, pointing both in the text
+ * (what gets reported) and in the folded copy (what gets looked up):
+ *
+ *   text    |The  cat,\tsat.\n|
+ *   folded  |the  cat,\tsat.\n|
+ *   spans   {0,3,3,1,1} {5,4,3,1,6} {10,4,3,1,11}
+ *            | | | | +- column (byte in the line, from 1)
+ *            | | | +- line
+ *            | | +- length without the trailing punctuation
+ *            | +- length
+ *            +- offset in the window
+ *
+ ******************************************************************************/
+
+#define TOKEN_WINDOW (64 * 1024)  // Bytes tokenized at most in one call
+
+typedef struct {
+    unsigned int    offset;     // Offset of the word in the window
+    unsigned int    length;     // Length of the word in the text
+    unsigned int    trimmed;    // Length without the trailing , . ? ! : ;
+    unsigned int    line;       // Line of the word
+    unsigned int    column;     // Column of the first byte of the word
+}WordSpan;
+
+typedef struct {
+    unsigned int    line;       // Line, from 1
+    unsigned int    column;     // Byte in the line, from 1
+}TextPosition;
+
+typedef struct {
+    char            *folded;    // Lower case copy of the window
+    WordSpan        *spans;     // Words of the window
+    size_t          count;      // Words in spans
+}Tokens;
+
+
+/*
+ * tokensInitialize
+ *
+ * Allocate the buffers for one window: the folded copy and the spans (a
+ * window can't hold more than TOKEN_WINDOW / 2 + 1 words)
+ *
+ * @param Tokens * tokens buffers to allocate
+ * @return OK or NOK if out of memory
+ *
+ */
+int tokensInitialize(Tokens *tokens);
+
+
+/*
+ * tokenizeText
+ *
+ * Split a window of text in words. Words are separated by whitespace, the
+ * text is never modified (it can be a read only mapping).
+ * A word touching the end of the window could go on in the next one, so it
+ * is left out unless this is the last window: the returned size tells where
+ * the next window has to start. 0 means the window is a single word longer
+ * than TOKEN_WINDOW, nothing has been tokenized.
+ *
+ * @param Tokens       * tokens where the folded copy and the spans go
+ * @param const char   * text text to split
+ * @param size_t         size bytes of the text, TOKEN_WINDOW at most
+ * @param int            last 1 if no text follows the window
+ * @param TextPosition * position position of the first byte, updated to
+ *                       the position of the first byte not consumed
+ * @return bytes consumed
+ *
+ */
+size_t tokenizeText(Tokens *tokens, const char *text, size_t size, int last, TextPosition *position);
+
+
+/*
+ * tokenCloseSpan
+ *
+ * Set the length and the trimmed length of a word ending at end, the way
+ * tokenizeText does, for a word it can't split (longer than a window)
+ *
+ * @param WordSpan   * span word to close, offset set
+ * @param const char * text text of the word
+ * @param size_t       end offset after the last byte of the word
+ *
+ */
+void tokenCloseSpan(WordSpan *span, const char *text, size_t end);
+
+
+/*
+ * tokensRelease
+ *
+ * Free the buffers of the tokens
+ *
+ * @param Tokens * tokens buffers to release
+ *
+ */
+void tokensRelease(Tokens *tokens);
+
+#endif // _TOKENIZER_H
@@ -0,0 +1,739 @@
+// System include
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+// Project include
+#include "spellcheck.h"
+#include "word_graph.h"
+
+#define GRAPH_TERMINAL      0x100u  // A word ends with the edge
+#define GRAPH_LAST          0x200u  // Last edge of its node
+#define GRAPH_TARGET_SHIFT  10      // Target is above the flags
+#define GRAPH_LABEL(edge)   ((edge) & 0xFFu)
+#define GRAPH_TARGET(edge)  ((edge) >> GRAPH_TARGET_SHIFT)
+#define MIN_NODES_SIZE      1024    // Initial size of the closed nodes set
+#define MIN_PATH_EDGES      4       // Initial edges of an open node
+
+// An edge of an open node
+typedef struct {
+    uint32_t        target;     // First edge of the closed node it goes to,
+                                // 0 while the node is open (or has no edges)
+    unsigned char   label;
+    unsigned char   terminal;   // 1 if a word ends with the edge
+}GraphEdge;
+
+struct GraphNodeT {
+    GraphEdge       *edges;
+    unsigned int    count;
+    unsigned int    size;
+};
+
+// State of a graphSuggest walk
+typedef struct {
+    const WordGraph *graph;
+    char            word[GRAPH_MAX_WORD];   // Word searched, lower case
+    size_t          length;
+    unsigned int    distance;               // Largest distance accepted
+    unsigned int    max;                    // Matches wanted
+    GraphMatches    *matches;
+    unsigned int    ranks[GRAPH_MAX_MATCHES];   // Distance << 8 | difference
+                                                // of length, of every match
+    char            path[GRAPH_MAX_WORD + GRAPH_MAX_DISTANCE];  // Labels from
+                                                                // the root
+    unsigned char   rows[GRAPH_MAX_WORD + GRAPH_MAX_DISTANCE + 1][GRAPH_MAX_WORD + 1];
+                                            // Edit distances of the path
+                                            // prefixes to the word prefixes
+}GraphSearch;
+
+// Static function declarations
+static int closeNode(WordGraph *graph, size_t depth, uint32_t *first);
+static int growNodes(WordGraph *graph);
+static int growPath(WordGraph *graph, size_t depth);
+static int addEdge(GraphNode *node, unsigned char label);
+static inline uint32_t packEdge(const GraphEdge *edge, int last);
+static void releaseBuild(WordGraph *graph);
+static inline uint64_t hashNode(const GraphEdge *edges, unsigned int count);
+static inline uint64_t hashEdges(const uint32_t *edges);
+static void searchNode(GraphSearch *search, uint32_t node, size_t depth);
+static unsigned int fillRow(GraphSearch *search, size_t depth, unsigned char label, size_t first, size_t last);
+static void addMatch(GraphSearch *search, size_t length, unsigned int distance);
+static inline unsigned int searchLimit(const GraphSearch *search);
+
+
+void graphInitialize(WordGraph *graph)
+{
+    assert(graph != NULL);
+
+    memset(graph, 0, sizeof(WordGraph));
+}
+
+int graphAddWord(WordGraph *graph, const char *word, size_t length)
+{
+    size_t common = 0;
+
+    assert(graph != NULL);
+    assert(length > 0);
+
+    // Edges shared with the last word
+    while (common < graph->depth && common < length &&
+           graph->path[common].edges[graph->path[common].count - 1].label == (unsigned char)word[common])
+    {
+        common++;
+    }
+
+    // What is left of the last word can't be reached by the next ones
+    for (size_t depth = graph->depth; depth > common; depth--)
+    {
+        GraphNode *parent = &graph->path[depth - 1];
+
+        if (closeNode(graph, depth, &parent->edges[parent->count - 1].target) != OK)
+        {
+            return NOK;
+        }
+    }
+
+    if (growPath(graph, length) != OK)
+    {
+        return NOK;
+    }
+    for (size_t pos = common; pos < length; pos++)
+    {
+        if (addEdge(&graph->path[pos], (unsigned char)word[pos]) != OK)
+        {
+            return NOK;
+        }
+    }
+    graph->path[length - 1].edges[graph->path[length - 1].count - 1].terminal = 1;
+    graph->depth = length;
+    graph->words++;
+
+    return OK;
+}
+
+int graphFinish(WordGraph *graph)
+{
+    int rc = OK;
+
+    assert(graph != NULL);
+
+    for (size_t depth = graph->depth; rc == OK && depth > 0; depth--)
+    {
+        GraphNode *parent = &graph->path[depth - 1];
+
+        rc = closeNode(graph, depth, &parent->edges[parent->count - 1].target);
+    }
+    if (rc == OK && graph->path != NULL)
+    {
+        rc = closeNode(graph, 0, &graph->root);
+    }
+    releaseBuild(graph);
+
+    // The graph doesn't grow anymore
+    if (rc == OK && graph->edges != NULL)
+    {
+        uint32_t *edges = (uint32_t *)realloc(graph->edges, graph->count * sizeof(uint32_t));
+
+        if (edges != NULL)
+        {
+            graph->edges = edges;
+            graph->size = graph->count;
+        }
+    }
+    return rc;
+}
+
+int graphLookup(const WordGraph *graph, const char *word, size_t length, unsigned int *probes)
+{
+    uint32_t node = graph->root, edge = 0;
+    unsigned int visited = 0;
+
+    for (size_t pos = 0; pos < length; pos++)
+    {
+        const uint32_t *next = NULL;
+        uint32_t label = (unsigned char)tolower((unsigned char)word[pos]);
+
+        if (node == 0)
+        {
+            *probes = visited;
+            return 0;
+        }
+        next = graph->edges + node;
+        // Labels are sorted, stop at the first one not below ours
+        do
+        {
+            edge = *next++;
+            visited++;
+        } while (GRAPH_LABEL(edge) < label && !(edge & GRAPH_LAST));
+
+        if (GRAPH_LABEL(edge) != label)
+        {
+            *probes = visited;
+            return 0;
+        }
+        node = GRAPH_TARGET(edge);
+    }
+    *probes = visited;
+    return length > 0 && (edge & GRAPH_TERMINAL) != 0;
+}
+
+unsigned int graphSuggest(const WordGraph *graph, const char *word, size_t length, unsigned int distance,
+                          unsigned int max, GraphMatches *matches)
+{
+    GraphSearch search;
+
+    assert(graph != NULL);
+    assert(matches != NULL);
+    assert(distance >= 1 && distance <= GRAPH_MAX_DISTANCE);
+    assert(max >= 1 && max <= GRAPH_MAX_MATCHES);
+
+    matches->count = 0;
+    if (graph->root == 0 || length == 0 || length > GRAPH_MAX_WORD)
+    {
+        return 0;
+    }
+
+    search.graph = graph;
+    search.length = length;
+    search.max = max;
+    search.matches = matches;
+    for (size_t pos = 0; pos < length; pos++)
+    {
+        search.word[pos] = tolower((unsigned char)word[pos]);
+    }
+    // Empty path: pos deletes to get the first pos bytes of the word
+    for (size_t pos = 0; pos <= length; pos++)
+    {
+        search.rows[0][pos] = (unsigned char)pos;
+    }
+
+    // Closest first: the walk at distance 1 is much shorter, the one at 2
+    // only runs when it doesn't find enough words
+    for (search.distance = 1; search.distance <= distance && matches->count < max; search.distance++)
+    {
+        matches->count = 0;
+        searchNode(&search, graph->root, 0);
+    }
+    return matches->count;
+}
+
+void graphRelease(WordGraph *graph)
+{
+    assert(graph != NULL);
+
+    releaseBuild(graph);
+    free(graph->edges);
+    graphInitialize(graph);
+}
+
+
+
+/*******************************************************************************
+ * Static functions
+ ******************************************************************************/
+
+/******************************************************************************
+ * closeNode
+ *
+ * @param WordGraph *graph graph being built
+ * @param size_t depth open node to close
+ * @param uint32_t *first filled with the first edge of the closed node
+ *
+ * An open node is final once its children are: if the graph has an equal
+ * node (same labels, flags and targets) that one is used, otherwise its
+ * edges are appended to the graph. The open node is emptied
+ */
+static int closeNode(WordGraph *graph, size_t depth, uint32_t *first)
+{
+    GraphNode *node = &graph->path[depth];
+    size_t slot = 0;
+
+    if (node->count == 0)
+    {
+        *first = 0;
+        return OK;
+    }
+    if ((graph->nodes_count + 1) * 2 > graph->nodes_mask + 1 && growNodes(graph) != OK)
+    {
+        return NOK;
+    }
+
+    slot = (size_t)hashNode(node->edges, node->count) & graph->nodes_mask;
+    while (graph->nodes[slot] != 0)
+    {
+        const uint32_t *edges = graph->edges + graph->nodes[slot];
+        unsigned int edge = 0;
+
+        while (edge < node->count && edges[edge] == packEdge(&node->edges[edge], edge == node->count - 1))
+        {
+            edge++;
+        }
+        if (edge == node->count)
+        {
+            // Same node, already in the graph
+            *first = graph->nodes[slot];
+            node->count = 0;
+            return OK;
+        }
+        slot = (slot + 1) & graph->nodes_mask;
+    }
+
+    if (graph->count == 0)
+    {
+        // Edge 0 is not used, target 0 means no node
+        graph->count = 1;
+    }
+    if (graph->count + node->count > GRAPH_MAX_EDGES)
+    {
+        printf("ERROR: Word graph over %u edges\n", GRAPH_MAX_EDGES - 1);
+        return NOK;
+    }
+    if (graph->count + node->count > graph->size)
+    {
+        size_t size = (graph->size != 0) ? graph->size * 2 : 1024;
+        uint32_t *edges = NULL;
+
+        while (graph->count + node->count > size)
+        {
+            size *= 2;
+        }
+        if ((edges = (uint32_t *)realloc(graph->edges, size * sizeof(uint32_t))) == NULL)
+        {
+            return NOK;
+        }
+        edges[0] = 0;
+        graph->edges = edges;
+        graph->size = size;
+    }
+
+    *first = graph->count;
+    for (unsigned int edge = 0; edge < node->count; edge++)
+    {
+        graph->edges[graph->count++] = packEdge(&node->edges[edge], edge == node->count - 1);
+    }
+    graph->nodes[slot] = *first;
+    graph->nodes_count++;
+    node->count = 0;
+
+    return OK;
+}
+
+/******************************************************************************
+ * releaseBuild
+ *
+ * @param WordGraph *graph graph being built
+ *
+ * Free the open nodes and the set of the closed ones, the graph stays
+ */
+static void releaseBuild(WordGraph *graph)
+{
+    for (size_t depth = 0; depth < graph->path_size; depth++)
+    {
+        free(graph->path[depth].edges);
+    }
+    free(graph->path);
+    free(graph->nodes);
+    graph->path = NULL;
+    graph->path_size = graph->depth = 0;
+    graph->nodes = NULL;
+    graph->nodes_mask = graph->nodes_count = 0;
+}
+
+/******************************************************************************
+ * growNodes
+ *
+ * @param WordGraph *graph graph being built
+ *
+ * Double the set of the closed nodes, the hash of a node comes from its
+ * edges in the graph
+ */
+static int growNodes(WordGraph *graph)
+{
+    size_t size = (graph->nodes == NULL) ? MIN_NODES_SIZE : (graph->nodes_mask + 1) * 2;
+    uint32_t *nodes = (uint32_t *)calloc(size, sizeof(uint32_t));
+
+    if (nodes == NULL)
+    {
+        return NOK;
+    }
+
+    for (size_t old = 0; graph->nodes != NULL && old <= graph->nodes_mask; old++)
+    {
+        if (graph->nodes[old] != 0)
+        {
+            size_t slot = (size_t)hashEdges(graph->edges + graph->nodes[old]) & (size - 1);
+
+            while (nodes[slot] != 0)
+            {
+                slot = (slot + 1) & (size - 1);
+            }
+            nodes[slot] = graph->nodes[old];
+        }
+    }
+
+    free(graph->nodes);
+    graph->nodes = nodes;
+    graph->nodes_mask = size - 1;
+
+    return OK;
+}
+
+/******************************************************************************
+ * growPath
+ *
+ * @param WordGraph *graph graph being built
+ * @param size_t depth length of the word to add
+ *
+ * Make sure there is an open node for every byte of the word, plus the one
+ * after the last byte
+ */
+static int growPath(WordGraph *graph, size_t depth)
+{
+    if (depth + 1 > graph->path_size)
+    {
+        size_t size = (graph->path_size != 0) ? graph->path_size : 32;
+        GraphNode *path = NULL;
+
+        while (depth + 1 > size)
+        {
+            size *= 2;
+        }
+        if ((path = (GraphNode *)realloc(graph->path, size * sizeof(GraphNode))) == NULL)
+        {
+            return NOK;
+        }
+        memset(path + graph->path_size, 0, (size - graph->path_size) * sizeof(GraphNode));
+        graph->path = path;
+        graph->path_size = size;
+    }
+    return OK;
+}
+
+/******************************************************************************
+ * addEdge
+ *
+ * @param GraphNode *node open node
+ * @param unsigned char label label of the edge
+ *
+ * Append an edge, still going nowhere, to an open node
+ */
+static int addEdge(GraphNode *node, unsigned char label)
+{
+    if (node->count == node->size)
+    {
+        unsigned int size = (node->size != 0) ? node->size * 2 : MIN_PATH_EDGES;
+        GraphEdge *edges = (GraphEdge *)realloc(node->edges, size * sizeof(GraphEdge));
+
+        if (edges == NULL)
+        {
+            return NOK;
+        }
+        node->edges = edges;
+        node->size = size;
+    }
+    node->edges[node->count].target = 0;
+    node->edges[node->count].label = label;
+    node->edges[node->count].terminal = 0;
+    node->count++;
+
+    return OK;
+}
+
+/******************************************************************************
+ * packEdge
+ *
+ * @param const GraphEdge *edge edge of an open node
+ * @param int last 1 if it is the last edge of the node
+ *
+ * The 32 bits form of an edge, as stored in the graph
+ */
+static inline uint32_t packEdge(const GraphEdge *edge, int last)
+{
+    return (edge->target << GRAPH_TARGET_SHIFT) | (last ? GRAPH_LAST : 0) |
+           (edge->terminal ? GRAPH_TERMINAL : 0) | edge->label;
+}
+
+/******************************************************************************
+ * hashNode
+ *
+ * @param const GraphEdge *edges edges of an open node
+ * @param unsigned int count number of edges
+ *
+ * Hash of a node from its packed edges, the same as hashEdges gives once
+ * the node is in the graph
+ */
+static inline uint64_t hashNode(const GraphEdge *edges, unsigned int count)
+{
+    uint64_t hash = 0;
+
+    for (unsigned int edge = 0; edge < count; edge++)
+    {
+        hash = (hash ^ packEdge(&edges[edge], edge == count - 1)) * 0x9E3779B97F4A7C15ull;
+    }
+    return hash ^ (hash >> 29);
+}
+
+/******************************************************************************
+ * hashEdges
+ *
+ * @param const uint32_t *edges first edge of a node in the graph
+ *
+ * Hash of a node of the graph, see hashNode
+ */
+static inline uint64_t hashEdges(const uint32_t *edges)
+{
+    uint64_t hash = 0;
+
+    do
+    {
+        hash = (hash ^ *edges) * 0x9E3779B97F4A7C15ull;
+    } while (!(*edges++ & GRAPH_LAST));
+
+    return hash ^ (hash >> 29);
+}
+
+/******************************************************************************
+ * searchNode
+ *
+ * @param GraphSearch *search walk in progress
+ * @param uint32_t node first edge of the node to walk
+ * @param size_t depth bytes of the path to the node (its row)
+ *
+ * Fill the row of every edge of the node from the rows above it, take the
+ * word if the edge ends one close enough, go down if the row can still lead
+ * to one. A swap of the next two bytes can go under the row, so its cost is
+ * counted in the bound too.
+ * Only the band of the row within distance of the diagonal is computed,
+ * the cells around it are set over the distance: a path of length depth + 1
+ * is always more than distance edits away from the word prefixes outside.
+ * The path never goes deeper than length + distance, the size of the rows
+ */
+static void searchNode(GraphSearch *search, uint32_t node, size_t depth)
+{
+    const unsigned char *above = search->rows[depth];
+    unsigned char *row = search->rows[depth + 1];
+    const uint32_t *next = search->graph->edges + node;
+    const char *word = search->word;
+    unsigned int over = search->distance + 1;
+    size_t first = (depth + 1 > search->distance) ? depth + 1 - search->distance : 1;
+    size_t last = (depth + 1 + search->distance < search->length) ? depth + 1 + search->distance : search->length;
+    unsigned int limit = searchLimit(search), highest = 0;
+    uint64_t labels[4] = {0, 0, 0, 0}, band[4] = {0, 0, 0, 0};
+    unsigned char plain_row[2 * GRAPH_MAX_DISTANCE + 1];
+    unsigned int plain_bound = 0;
+    int any = 0, plain = 0;
+    uint32_t edge = 0;
+
+    row[0] = (depth + 1 < over) ? depth + 1 : over;
+    row[first - 1] = (first > 1) ? over : row[0];
+    if (last < search->length)
+    {
+        row[last + 1] = over;
+    }
+
+    // With no edit left only the labels matching the word go on: find them,
+    // so the other edges are skipped without filling their row. Labels are
+    // sorted, the edges after the highest one are not even read
+    any = (row[0] <= limit);
+    for (size_t pos = first; !any && pos <= last; pos++)
+    {
+        unsigned char label = 0;
+
+        if (above[pos - 1] + 1u <= limit || above[pos] + 1u <= limit)
+        {
+            any = 1;
+            break;
+        }
+        if (above[pos - 1] <= limit)
+        {
+            label = (unsigned char)word[pos - 1];
+            labels[label >> 6] |= 1ull << (label & 63);
+            highest = (label > highest) ? label : highest;
+        }
+        if (depth > 0 && pos > 1 && word[pos - 1] == search->path[depth - 1] &&
+            search->rows[depth - 1][pos - 2] + 1u <= limit)
+        {
+            label = (unsigned char)word[pos - 2];
+            labels[label >> 6] |= 1ull << (label & 63);
+            highest = (label > highest) ? label : highest;
+        }
+    }
+
+    // The bytes of the word a label is compared to, the other labels all get
+    // the same row: 0 not filled yet, 1 filled, 2 in row
+    for (size_t pos = (first > 1) ? first - 1 : first; any && pos <= last; pos++)
+    {
+        unsigned char label = (unsigned char)word[pos - 1];
+
+        band[label >> 6] |= 1ull << (label & 63);
+    }
+
+    do
+    {
+        unsigned char label = 0;
+        unsigned int bound = 0;
+
+        edge = *next++;
+        label = (unsigned char)GRAPH_LABEL(edge);
+        if (!any)
+        {
+            if (label > highest)
+            {
+                break;
+            }
+            if (!((labels[label >> 6] >> (label & 63)) & 1))
+            {
+                continue;
+            }
+        }
+
+        if (!any || ((band[label >> 6] >> (label & 63)) & 1))
+        {
+            bound = fillRow(search, depth, label, first, last);
+            plain = (plain == 2) ? 1 : plain;
+        }
+        else
+        {
+            // A byte not in the band of the word: same row for all of them
+            if (plain == 0)
+            {
+                plain_bound = fillRow(search, depth, label, first, last);
+                memcpy(plain_row, row + first, last + 1 - first);
+            }
+            else if (plain == 1)
+            {
+                memcpy(row + first, plain_row, last + 1 - first);
+            }
+            plain = 2;
+            bound = plain_bound;
+        }
+        search->path[depth] = (char)label;
+
+        if ((edge & GRAPH_TERMINAL) && first <= search->length && last == search->length &&
+            row[search->length] <= searchLimit(search))
+        {
+            addMatch(search, depth + 1, row[search->length]);
+        }
+        // A path longer than length + distance is always too far away
+        if (GRAPH_TARGET(edge) != 0 && bound <= searchLimit(search) &&
+            depth + 1 < search->length + search->distance)
+        {
+            searchNode(search, GRAPH_TARGET(edge), depth + 1);
+        }
+    } while (!(edge & GRAPH_LAST));
+}
+
+/******************************************************************************
+ * fillRow
+ *
+ * @param GraphSearch *search walk in progress
+ * @param size_t depth bytes of the path above the row
+ * @param unsigned char label label of the edge
+ * @param size_t first first cell of the band
+ * @param size_t last last cell of the band
+ *
+ * Fill the band of the row of an edge, return the smallest distance a path
+ * going on with the edge can still get
+ */
+static unsigned int fillRow(GraphSearch *search, size_t depth, unsigned char label, size_t first, size_t last)
+{
+    const unsigned char *above = search->rows[depth];
+    unsigned char *row = search->rows[depth + 1];
+    const char *word = search->word;
+    unsigned int over = search->distance + 1;
+    unsigned int bound = row[0];
+
+    for (size_t pos = first; pos <= last; pos++)
+    {
+        unsigned int cost = above[pos - 1] + ((unsigned char)word[pos - 1] != label);
+
+        if (above[pos] + 1u < cost)
+        {
+            cost = above[pos] + 1;
+        }
+        if (row[pos - 1] + 1u < cost)
+        {
+            cost = row[pos - 1] + 1;
+        }
+        // Two bytes swapped
+        if (depth > 0 && pos > 1 && (unsigned char)word[pos - 1] == (unsigned char)search->path[depth - 1] &&
+            (unsigned char)word[pos - 2] == label && search->rows[depth - 1][pos - 2] + 1u < cost)
+        {
+            cost = search->rows[depth - 1][pos - 2] + 1;
+        }
+        row[pos] = (unsigned char)((cost < over) ? cost : over);
+        if (cost < bound)
+        {
+            bound = cost;
+        }
+        // A child can swap its label with this one
+        if (pos > 1 && (unsigned char)word[pos - 1] == label && above[pos - 2] + 1u < bound)
+        {
+            bound = above[pos - 2] + 1;
+        }
+    }
+    return bound;
+}
+
+/******************************************************************************
+ * addMatch
+ *
+ * @param GraphSearch *search walk in progress
+ * @param size_t length bytes of the path, the word found
+ * @param unsigned int distance distance of the word
+ *
+ * Insert the word of the path in the matches, sorted by distance then by
+ * difference of length. Words come in byte order, so a word never goes
+ * before an equal one. When the matches are full the last one goes away
+ */
+static void addMatch(GraphSearch *search, size_t length, unsigned int distance)
+{
+    GraphMatches *matches = search->matches;
+    unsigned int rank = (distance << 8) | (unsigned int)((length > search->length) ? length - search->length :
+                                                                                  search->length - length);
+    unsigned int place = matches->count;
+
+    if (place == search->max && rank >= search->ranks[place - 1])
+    {
+        return;
+    }
+    while (place > 0 && search->ranks[place - 1] > rank)
+    {
+        place--;
+    }
+
+    if (matches->count == search->max)
+    {
+        matches->count--;
+    }
+    memmove(matches->words[place + 1], matches->words[place], (matches->count - place) * sizeof(matches->words[0]));
+    memmove(&matches->distance[place + 1], &matches->distance[place], matches->count - place);
+    memmove(&search->ranks[place + 1], &search->ranks[place], (matches->count - place) * sizeof(unsigned int));
+    memcpy(matches->words[place], search->path, length);
+    matches->words[place][length] = 0;
+    matches->distance[place] = (unsigned char)distance;
+    search->ranks[place] = rank;
+    matches->count++;
+}
+
+/******************************************************************************
+ * searchLimit
+ *
+ * @param const GraphSearch *search walk in progress
+ *
+ * Largest distance still worth a look: once the matches are full, nothing
+ * further than the last one can get in, nor as far with a length as close
+ */
+static inline unsigned int searchLimit(const GraphSearch *search)
+{
+    unsigned int worst = search->ranks[search->max - 1];
+
+    if (search->matches->count < search->max)
+    {
+        return search->distance;
+    }
+    return ((worst & 0xFF) != 0 || worst == 0) ? worst >> 8 : (worst >> 8) - 1;
+}
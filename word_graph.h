@@ -0,0 +1,160 @@
+#ifndef _WORD_GRAPH_H
+#define _WORD_GRAPH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************************************
+ * WORD GRAPH - Minimal acyclic word graph (DAWG)
+ *
+ * All the words in one automaton: words starting the same way share the
+ * edges of their prefix, words ending the same way share the nodes of their
+ * suffix. The graph is minimal, no two nodes accept the same word endings,
+ * so a big word list shrinks to a fraction of its text size.
+ *
+ *   words: cat cats car
+ *
+ *   (root) -c-> ( ) -a-> ( ) -r*-> ( )
+ *                            -t*-> ( ) -s*-> ( )     * a word ends here
+ *
+ * A node is a run of edges, sorted by label, and every edge is a 32 bits
+ * word:
+ *
+ *   | target (22 bits) | last | terminal | label (8 bits) |
+ *
+ * target is the first edge of the node the edge goes to (0 if none), last
+ * marks the last edge of a node, terminal tells that a word ends with the
+ * edge. Edge 0 is not used, so there are at most GRAPH_MAX_EDGES - 1 edges.
+ *
+ * The graph is built in one pass from words given in byte order, without
+ * duplicates (Daciuk incremental construction): only the nodes of the last
+ * word are still open, every node is closed when no later word can reach it
+ * and replaced by an equal node already in the graph, if there is one.
+ *
+ * graphSuggest finds the words close to a misspelled one (Damerau edit
+ * distance: insert, delete, replace or swap two bytes). It walks the graph
+ * depth first keeping one row of the edit distance matrix per byte of the
+ * path, so a prefix shared by many words is compared once, and leaves a
+ * branch as soon as its best row value is over the distance.
+ *
+ ******************************************************************************/
+
+#define GRAPH_MAX_EDGES (1u << 22)  // Edges the 22 bits targets can address
+#define GRAPH_MAX_WORD      100     // Longest word graphSuggest searches for
+#define GRAPH_MAX_DISTANCE  2       // Largest distance of graphSuggest
+#define GRAPH_MAX_MATCHES   16      // Most matches of graphSuggest
+
+// A node of the last word added, still open (build only)
+typedef struct GraphNodeT GraphNode;
+
+typedef struct {
+    uint32_t        *edges;     // All the nodes, edge 0 not used
+    size_t          count;      // Edges used
+    size_t          size;       // Edges allocated
+    uint32_t        root;       // First edge of the root, 0 if no words
+    size_t          words;      // Words added
+    GraphNode       *path;      // Open nodes, one per byte of the last
+                                // word (build only)
+    size_t          depth;      // Length of the last word (build only)
+    size_t          path_size;  // Nodes allocated in path (build only)
+    uint32_t        *nodes;     // Hash set of the closed nodes, by first
+                                // edge, 0 if empty (build only)
+    size_t          nodes_mask; // Set size - 1 (build only)
+    size_t          nodes_count;// Nodes in the set (build only)
+}WordGraph;
+
+// Words found by graphSuggest, best first
+typedef struct {
+    unsigned int    count;                          // Matches found
+    unsigned char   distance[GRAPH_MAX_MATCHES];    // Edit distance of every
+                                                    // match
+    char            words[GRAPH_MAX_MATCHES][GRAPH_MAX_WORD + GRAPH_MAX_DISTANCE + 1];
+                                                    // Lower case, NULL
+                                                    // terminated
+}GraphMatches;
+
+
+/*
+ * graphInitialize
+ *
+ * Initialize an empty graph, ready for graphAddWord
+ *
+ * @param WordGraph * graph graph to initialize
+ *
+ */
+void graphInitialize(WordGraph *graph);
+
+
+/*
+ * graphAddWord
+ *
+ * Add a word to the graph being built. Words must come in byte order
+ * (memcmp, then length), lower case, without duplicates
+ *
+ * @param WordGraph  * graph graph being built
+ * @param const char * word word to add (not NULL terminated)
+ * @param size_t       length length of the word, at least 1
+ * @return OK or NOK if out of memory or over GRAPH_MAX_EDGES
+ *
+ */
+int graphAddWord(WordGraph *graph, const char *word, size_t length);
+
+
+/*
+ * graphFinish
+ *
+ * Close the nodes of the last word and free what was only needed to build
+ *
+ * @param WordGraph * graph graph being built
+ * @return OK or NOK if out of memory or over GRAPH_MAX_EDGES
+ *
+ */
+int graphFinish(WordGraph *graph);
+
+
+/*
+ * graphLookup
+ *
+ * Search a word in the graph, ignoring the case
+ *
+ * @param const WordGraph * graph finished graph
+ * @param const char      * word word to search (not NULL terminated)
+ * @param size_t            length length of the word
+ * @param unsigned int    * probes filled with the number of edges read
+ * @return 1 if the word is in the graph, 0 otherwise
+ *
+ */
+int graphLookup(const WordGraph *graph, const char *word, size_t length, unsigned int *probes);
+
+
+/*
+ * graphSuggest
+ *
+ * Find the words of the graph closest to a word, at most distance edits
+ * away. Matches are sorted by distance, then by difference of length, then
+ * in byte order. A word longer than GRAPH_MAX_WORD gets no matches
+ *
+ * @param const WordGraph * graph finished graph
+ * @param const char      * word word to search around, any case
+ * @param size_t            length length of the word
+ * @param unsigned int      distance largest distance, 1 to GRAPH_MAX_DISTANCE
+ * @param unsigned int      max matches wanted, 1 to GRAPH_MAX_MATCHES
+ * @param GraphMatches    * matches filled with the matches found
+ * @return number of matches
+ *
+ */
+unsigned int graphSuggest(const WordGraph *graph, const char *word, size_t length, unsigned int distance,
+                          unsigned int max, GraphMatches *matches);
+
+
+/*
+ * graphRelease
+ *
+ * Free the graph, built or not
+ *
+ * @param WordGraph * graph graph to release
+ *
+ */
+void graphRelease(WordGraph *graph);
+
+#endif // _WORD_GRAPH_H